@@ -0,0 +1,476 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+#define HEADER_SIZE 12
+#define TRAILER_SIZE 32
+#define CHECK_SIZE 4
+#define MAX_ENTRY_SIZE (5 + 5 + MAX_NAME_LEN + 5) // Two length varints, a name and a score varint
+#define MAX_INDEX_ENTRY (8 + 4 + 4 + 1 + MAX_NAME_LEN)
+
+// CRC-32 (the zlib polynomial), eight bytes at a time: crc_tables[k][b]
+// is the CRC of byte b followed by k zero bytes, so the eight bytes'
+// contributions can be looked up independently and xored together
+static uint32_t crc_tables[8][256];
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_tables(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+        crc_tables[0][byte] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int byte = 0; byte < 256; byte++) {
+            uint32_t prev = crc_tables[k - 1][byte];
+            crc_tables[k][byte] = (prev >> 8) ^ crc_tables[0][prev & 0xff];
+        }
+    }
+}
+
+static uint32_t crc32(const unsigned char *data, size_t len) {
+    pthread_once(&crc_tables_once, build_crc_tables);
+    uint32_t crc = 0xffffffff;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+        crc = crc_tables[7][low & 0xff] ^ crc_tables[6][(low >> 8) & 0xff] ^
+              crc_tables[5][(low >> 16) & 0xff] ^ crc_tables[4][low >> 24] ^
+              crc_tables[3][data[4]] ^ crc_tables[2][data[5]] ^ crc_tables[1][data[6]] ^
+              crc_tables[0][data[7]];
+    }
+    for (; len > 0; data++, len--) {
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *data) & 0xff];
+    }
+    return ~crc;
+}
+
+static void put_le(unsigned char *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t get_le(const unsigned char *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t) in[i] << (8 * i);
+    }
+    return value;
+}
+
+// Appends value 7 bits at a time, low bits first. Returns the bytes used.
+static size_t put_varint(unsigned char *out, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+// Returns 0, or -1 if the varint runs past end or past 32 bits
+static int get_varint(const unsigned char **pos, const unsigned char *end, uint32_t *value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (*pos == end) {
+            return -1;
+        }
+        unsigned char byte = *(*pos)++;
+        result |= (uint32_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Scores are zigzag coded so small negative scores stay short too
+static uint32_t zigzag(int score) {
+    return (uint32_t) score << 1 ^ (uint32_t) (score >> 31);
+}
+
+static int unzigzag(uint32_t value) {
+    return (int) (value >> 1 ^ -(value & 1));
+}
+
+static int write_all(int fd, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *) buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Entries are front coded into block until it reaches ARCHIVE_BLOCK_SIZE
+// bytes, then the block gets its check and is written out
+typedef struct {
+    int fd;
+    unsigned char block[ARCHIVE_BLOCK_SIZE + MAX_ENTRY_SIZE + CHECK_SIZE];
+    size_t block_len;          // Bytes in block
+    char prev[MAX_NAME_LEN];   // Last name added to block
+    size_t prev_len;
+    uint64_t offset;           // Where block will be written
+    archive_block_t *blocks;   // Index of every block so far, and block itself
+    unsigned num_blocks;       // Blocks in the index, counting block once it has entries
+    unsigned max_blocks;       // Room in blocks
+    unsigned size;             // Entries written
+    int err;                   // Set once a write or allocation fails
+} archive_writer_t;
+
+static void finish_block(archive_writer_t *writer) {
+    if (writer->block_len == 0) {
+        return;
+    }
+    put_le(writer->block + writer->block_len, crc32(writer->block, writer->block_len), CHECK_SIZE);
+    writer->block_len += CHECK_SIZE;
+    archive_block_t *block = &writer->blocks[writer->num_blocks - 1];
+    block->offset = writer->offset;
+    block->len = writer->block_len;
+    if (write_all(writer->fd, writer->block, writer->block_len) != 0) {
+        writer->err = 1;
+    }
+    writer->offset += writer->block_len;
+    writer->block_len = 0;
+    writer->prev_len = 0;
+}
+
+static void add_entry(const char *name, int score, void *arg) {
+    archive_writer_t *writer = arg;
+    if (writer->err) {
+        return;
+    }
+    size_t len = strlen(name);
+    if (writer->block_len == 0) {
+        // A new block: note where it starts in the index
+        if (writer->num_blocks == writer->max_blocks) {
+            unsigned max_blocks = writer->max_blocks == 0 ? 64 : writer->max_blocks * 2;
+            archive_block_t *blocks = realloc(writer->blocks, max_blocks * sizeof(archive_block_t));
+            if (blocks == NULL) {
+                writer->err = 1;
+                return;
+            }
+            writer->blocks = blocks;
+            writer->max_blocks = max_blocks;
+        }
+        archive_block_t *block = &writer->blocks[writer->num_blocks++];
+        memcpy(block->first, name, len + 1);
+        block->count = 0;
+    }
+    size_t shared = 0;
+    while (shared < len && shared < writer->prev_len && name[shared] == writer->prev[shared]) {
+        shared++;
+    }
+    unsigned char *out = writer->block + writer->block_len;
+    size_t pos = put_varint(out, shared);
+    pos += put_varint(out + pos, len - shared);
+    memcpy(out + pos, name + shared, len - shared);
+    pos += len - shared;
+    pos += put_varint(out + pos, zigzag(score));
+    writer->block_len += pos;
+    memcpy(writer->prev, name, len);
+    writer->prev_len = len;
+    writer->blocks[writer->num_blocks - 1].count++;
+    writer->size++;
+    if (writer->block_len >= ARCHIVE_BLOCK_SIZE) {
+        finish_block(writer);
+    }
+}
+
+// Write the sparse index and the trailer after the last block
+static int write_index(archive_writer_t *writer) {
+    unsigned char *index = malloc((size_t) writer->num_blocks * MAX_INDEX_ENTRY + CHECK_SIZE);
+    if (index == NULL) {
+        return -1;
+    }
+    size_t len = 0;
+    for (unsigned i = 0; i < writer->num_blocks; i++) {
+        const archive_block_t *block = &writer->blocks[i];
+        size_t first_len = strlen(block->first);
+        put_le(index + len, block->offset, 8);
+        put_le(index + len + 8, block->len, 4);
+        put_le(index + len + 12, block->count, 4);
+        index[len + 16] = first_len;
+        memcpy(index + len + 17, block->first, first_len);
+        len += 17 + first_len;
+    }
+    unsigned char trailer[TRAILER_SIZE];
+    put_le(trailer, writer->offset, 8);
+    put_le(trailer + 8, len, 4);
+    put_le(trailer + 12, writer->num_blocks, 4);
+    put_le(trailer + 16, writer->size, 4);
+    put_le(trailer + 20, crc32(index, len), CHECK_SIZE);
+    memcpy(trailer + 24, ARCHIVE_MAGIC, 8);
+    int err = write_all(writer->fd, index, len) != 0 ||
+              write_all(writer->fd, trailer, TRAILER_SIZE) != 0;
+    free(index);
+    return err ? -1 : 0;
+}
+
+int write_gradebook_to_archive(gradebook_t *book) {
+    if (book == NULL) {
+        return -1;
+    }
+    char file_name[MAX_NAME_LEN + strlen(".arc")];
+    char tmp_name[MAX_NAME_LEN + strlen(".arc.tmp")];
+    strcpy(file_name, get_gradebook_name(book));
+    strcat(file_name, ".arc");
+    strcpy(tmp_name, file_name);
+    strcat(tmp_name, ".tmp");
+    archive_writer_t *writer = calloc(1, sizeof(archive_writer_t));
+    if (writer == NULL) {
+        return -1;
+    }
+    writer->fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writer->fd < 0) {
+        free(writer);
+        return -1;
+    }
+
+    unsigned char header[HEADER_SIZE];
+    memcpy(header, ARCHIVE_MAGIC, 8);
+    put_le(header + 8, ARCHIVE_BLOCK_SIZE, 4);
+    writer->err = write_all(writer->fd, header, HEADER_SIZE) != 0;
+    writer->offset = HEADER_SIZE;
+    // "" matches every name, so this is a walk of the whole book in order
+    for_each_with_prefix(book, "", add_entry, writer);
+    finish_block(writer);
+    int ok = !writer->err && write_index(writer) == 0 && fsync(writer->fd) == 0;
+    ok = close(writer->fd) == 0 && ok;
+    free(writer->blocks);
+    free(writer);
+    if (ok && rename(tmp_name, file_name) == 0) {
+        return 0;
+    }
+    unlink(tmp_name);
+    return -1;
+}
+
+// Steps through the entries of one block, undoing the front coding
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+    char name[MAX_NAME_LEN]; // Current name, '\0'-terminated
+    size_t name_len;
+    int score;
+} block_cursor_t;
+
+// Returns 0, or -1 if the block is malformed
+static int next_entry(block_cursor_t *cursor) {
+    uint32_t shared, suffix, score;
+    if (get_varint(&cursor->pos, cursor->end, &shared) != 0 ||
+        get_varint(&cursor->pos, cursor->end, &suffix) != 0 || shared > cursor->name_len ||
+        suffix >= MAX_NAME_LEN - shared || suffix > (size_t) (cursor->end - cursor->pos)) {
+        return -1;
+    }
+    memcpy(cursor->name + shared, cursor->pos, suffix);
+    cursor->pos += suffix;
+    cursor->name_len = shared + suffix;
+    cursor->name[cursor->name_len] = '\0';
+    if (get_varint(&cursor->pos, cursor->end, &score) != 0) {
+        return -1;
+    }
+    cursor->score = unzigzag(score);
+    return 0;
+}
+
+// Check a block of len bytes read into buf and start a cursor over it.
+// Returns 0, or -1 if its check does not match.
+static int start_block(const unsigned char *buf, size_t len, block_cursor_t *cursor) {
+    if (len < CHECK_SIZE || crc32(buf, len - CHECK_SIZE) != get_le(buf + len - CHECK_SIZE, 4)) {
+        return -1;
+    }
+    cursor->pos = buf;
+    cursor->end = buf + len - CHECK_SIZE;
+    cursor->name_len = 0;
+    return 0;
+}
+
+// Class name for a file: the file name without ".arc". Returns 0, or -1
+// if the name is too short or the class name would not fit.
+static int class_name_from_file(const char *file_name, char *class_name) {
+    size_t len = strlen(file_name);
+    if (len < strlen(".arc") || len - strlen(".arc") >= MAX_NAME_LEN) {
+        return -1;
+    }
+    memcpy(class_name, file_name, len - strlen(".arc"));
+    class_name[len - strlen(".arc")] = '\0';
+    return 0;
+}
+
+archive_t *open_archive(const char *file_name) {
+    archive_t *archive = calloc(1, sizeof(archive_t));
+    if (archive == NULL) {
+        return NULL;
+    }
+    archive->fd = -1;
+    unsigned char header[HEADER_SIZE], trailer[TRAILER_SIZE];
+    unsigned char *index = NULL;
+    struct stat st;
+    if (class_name_from_file(file_name, archive->class_name) != 0 ||
+        (archive->fd = open(file_name, O_RDONLY)) < 0 || fstat(archive->fd, &st) != 0 ||
+        st.st_size < HEADER_SIZE + TRAILER_SIZE ||
+        read_at(archive->fd, header, HEADER_SIZE, 0) != 0 ||
+        read_at(archive->fd, trailer, TRAILER_SIZE, st.st_size - TRAILER_SIZE) != 0 ||
+        memcmp(header, ARCHIVE_MAGIC, 8) != 0 || memcmp(trailer + 24, ARCHIVE_MAGIC, 8) != 0) {
+        goto fail;
+    }
+    uint64_t index_off = get_le(trailer, 8);
+    uint32_t index_len = get_le(trailer + 8, 4);
+    archive->num_blocks = get_le(trailer + 12, 4);
+    archive->size = get_le(trailer + 16, 4);
+    if (index_off < HEADER_SIZE || index_off + index_len + TRAILER_SIZE != (uint64_t) st.st_size ||
+        (uint64_t) archive->num_blocks * 17 > index_len) {
+        goto fail;
+    }
+    index = malloc(index_len + 1);
+    archive->blocks = malloc((archive->num_blocks + 1) * sizeof(archive_block_t));
+    if (index == NULL || archive->blocks == NULL ||
+        read_at(archive->fd, index, index_len, index_off) != 0 ||
+        crc32(index, index_len) != get_le(trailer + 20, 4)) {
+        goto fail;
+    }
+    size_t pos = 0, max_len = 0;
+    uint64_t entries = 0, next_offset = HEADER_SIZE;
+    for (unsigned i = 0; i < archive->num_blocks; i++) {
+        archive_block_t *block = &archive->blocks[i];
+        if (pos + 17 > index_len || index[pos + 16] >= MAX_NAME_LEN ||
+            pos + 17 + index[pos + 16] > index_len) {
+            goto fail;
+        }
+        block->offset = get_le(index + pos, 8);
+        block->len = get_le(index + pos + 8, 4);
+        block->count = get_le(index + pos + 12, 4);
+        memcpy(block->first, index + pos + 17, index[pos + 16]);
+        block->first[index[pos + 16]] = '\0';
+        pos += 17 + index[pos + 16];
+        // Blocks sit back to back between the header and the index
+        if (block->offset != next_offset || block->len > index_off - block->offset) {
+            goto fail;
+        }
+        next_offset += block->len;
+        entries += block->count;
+        max_len = block->len > max_len ? block->len : max_len;
+    }
+    if (pos != index_len || next_offset != index_off || entries != archive->size) {
+        goto fail;
+    }
+    archive->buf = malloc(max_len + 1);
+    if (archive->buf == NULL) {
+        goto fail;
+    }
+    free(index);
+    return archive;
+
+fail:
+    free(index);
+    close_archive(archive);
+    return NULL;
+}
+
+int archive_find_score(archive_t *archive, const char *name) {
+    if (archive == NULL || name == NULL) {
+        return -1;
+    }
+    // The last block whose first name is not past name
+    unsigned lo = 0, hi = archive->num_blocks;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (strcmp(archive->blocks[mid].first, name) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+    const archive_block_t *block = &archive->blocks[lo - 1];
+    block_cursor_t cursor;
+    if (read_at(archive->fd, archive->buf, block->len, block->offset) != 0 ||
+        start_block(archive->buf, block->len, &cursor) != 0) {
+        return -1;
+    }
+    for (unsigned i = 0; i < block->count && next_entry(&cursor) == 0; i++) {
+        int cmp = strcmp(cursor.name, name);
+        if (cmp >= 0) {
+            return cmp == 0 ? cursor.score : -1;
+        }
+    }
+    return -1;
+}
+
+void close_archive(archive_t *archive) {
+    if (archive == NULL) {
+        return;
+    }
+    if (archive->fd >= 0) {
+        close(archive->fd);
+    }
+    free(archive->blocks);
+    free(archive->buf);
+    free(archive);
+}
+
+gradebook_t *read_gradebook_from_archive(const char *file_name) {
+    archive_t *archive = open_archive(file_name);
+    if (archive == NULL) {
+        return NULL;
+    }
+    // Every block at once: they sit back to back from the first one on
+    uint64_t start = HEADER_SIZE, len = 0;
+    if (archive->num_blocks > 0) {
+        const archive_block_t *last = &archive->blocks[archive->num_blocks - 1];
+        len = last->offset + last->len - start;
+    }
+    unsigned char *data = malloc(len + 1);
+    gradebook_t *book = create_gradebook(archive->class_name, archive->size);
+    int err = data == NULL || book == NULL || read_at(archive->fd, data, len, start) != 0;
+    for (unsigned i = 0; !err && i < archive->num_blocks; i++) {
+        const archive_block_t *block = &archive->blocks[i];
+        block_cursor_t cursor;
+        err = start_block(data + (block->offset - start), block->len, &cursor) != 0;
+        for (unsigned j = 0; !err && j < block->count; j++) {
+            err = next_entry(&cursor) != 0 || add_score(book, cursor.name, cursor.score) != 0;
+        }
+    }
+    free(data);
+    close_archive(archive);
+    if (err) {
+        free_gradebook(book);
+        return NULL;
+    }
+    return book;
+}
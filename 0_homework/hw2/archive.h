@@ -0,0 +1,78 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gradebook.h"
+
+#define ARCHIVE_BLOCK_SIZE 4096 // Bytes of entries a block is filled to before it is closed
+#define ARCHIVE_MAGIC "GBARC001"
+
+// A compact, read-mostly gradebook file, <class>.arc, for books that are
+// archived and then only looked up now and then. Entries are sorted by
+// name and cut into blocks of about ARCHIVE_BLOCK_SIZE bytes:
+//   header:  magic (8 bytes) | block size (4 bytes)
+//   blocks:  entries | check (4 bytes)
+//   index:   per block: offset (8 bytes) | length (4 bytes) | entries (4 bytes)
+//            | first name length (1 byte) | first name
+//   trailer: index offset (8 bytes) | index length (4 bytes) | blocks (4 bytes)
+//            | entries (4 bytes) | index check (4 bytes) | magic (8 bytes)
+// Every integer is little-endian, and every check is the CRC-32 of the
+// bytes before it in the block or index. Each entry is front coded
+// against the one before it in its block:
+//   shared prefix length | suffix length | suffix | score
+// with the lengths as varints and the score as a zigzag varint, so the
+// first entry of every block is stored whole and a block decodes on its
+// own. A lookup reads the trailer and index once and then one block.
+
+// Where one block is and the first name in it
+typedef struct {
+    uint64_t offset;          // File offset of the block
+    uint32_t len;             // Bytes in the block, including its check
+    uint32_t count;           // Entries in the block
+    char first[MAX_NAME_LEN]; // Lowest name in the block
+} archive_block_t;
+
+// An archive opened for lookups: its index is in memory, its blocks are
+// read as needed
+typedef struct {
+    int fd;
+    char class_name[MAX_NAME_LEN]; // Class name, from the file name
+    archive_block_t *blocks;       // Sparse index, in name order
+    unsigned num_blocks;           // Blocks in the file
+    unsigned size;                 // Entries in the file
+    unsigned char *buf;            // Room for the largest block
+} archive_t;
+
+// Write out all scores in the gradebook to <class>.arc. Like the other
+// formats, it is written to <class>.arc.tmp and renamed once complete.
+// book: A pointer to the gradebook containing the scores to write out
+// Returns: 0 on success or -1 if the file could not be written
+int write_gradebook_to_archive(gradebook_t *book);
+
+// Open an archive for lookups, reading only its trailer and index
+// file_name: The name of the archive file to open
+// Returns: A pointer to the opened archive
+//          or NULL if it cannot be read or its index is damaged
+archive_t *open_archive(const char *file_name);
+
+// Search an archive for a student's score, reading the one block that
+// could hold the name
+// archive: A pointer to an archive from open_archive
+// name: The student's name
+// Returns: The student's score if their name is found
+//          or -1 if it is not found or its block is damaged
+int archive_find_score(archive_t *archive, const char *name);
+
+// Close an archive and free its index
+// archive: A pointer to the archive to close
+void close_archive(archive_t *archive);
+
+// Read every block of an archive into a new gradebook
+// file_name: The name of the archive file to read
+// Returns: A pointer to a new gradebook with all scores as recorded in the file
+//          or NULL if the file cannot be read or any block is damaged
+gradebook_t *read_gradebook_from_archive(const char *file_name);
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "catalog.h"
+
+// The file a class is spilled to
+static void spill_file(const catalog_entry_t *entry, char *file_name) {
+    strcpy(file_name, entry->class_name);
+    strcat(file_name, CATALOG_SPILL_EXT);
+}
+
+// Delete entry's spill file, if it has one
+static void remove_spill(catalog_entry_t *entry) {
+    if (entry->spilled) {
+        char file_name[MAX_NAME_LEN + strlen(CATALOG_SPILL_EXT)];
+        spill_file(entry, file_name);
+        unlink(file_name);
+        entry->spilled = 0;
+    }
+}
+
+static catalog_entry_t **bucket_for(const catalog_t *catalog, const char *class_name) {
+    unsigned h = hash(class_name, strlen(class_name));
+    return &catalog->buckets[h & (catalog->num_buckets - 1)];
+}
+
+static catalog_entry_t *find_entry(const catalog_t *catalog, const char *class_name) {
+    catalog_entry_t *entry = *bucket_for(catalog, class_name);
+    while (entry != NULL && strcmp(entry->class_name, class_name) != 0) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Double the bucket array. Returns 0, or -1 if no memory is available.
+static int grow_buckets(catalog_t *catalog) {
+    unsigned old_num = catalog->num_buckets;
+    catalog_entry_t **old = catalog->buckets;
+    catalog_entry_t **buckets = calloc(old_num * 2, sizeof(catalog_entry_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+    catalog->buckets = buckets;
+    catalog->num_buckets = old_num * 2;
+    for (unsigned i = 0; i < old_num; i++) {
+        while (old[i] != NULL) {
+            catalog_entry_t *entry = old[i];
+            old[i] = entry->next;
+            catalog_entry_t **bucket = bucket_for(catalog, entry->class_name);
+            entry->next = *bucket;
+            *bucket = entry;
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void lru_unlink(catalog_t *catalog, catalog_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        catalog->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        catalog->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(catalog_t *catalog, catalog_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = catalog->lru_head;
+    if (catalog->lru_head != NULL) {
+        catalog->lru_head->lru_prev = entry;
+    } else {
+        catalog->lru_tail = entry;
+    }
+    catalog->lru_head = entry;
+}
+
+// Start tracking entry's book as resident and most recently used
+static void make_resident(catalog_t *catalog, catalog_entry_t *entry, gradebook_t *book) {
+    entry->book = book;
+    entry->bytes = gradebook_memory_usage(book);
+    catalog->resident_bytes += entry->bytes;
+    lru_push_front(catalog, entry);
+}
+
+// The book handed out last may have grown or shrunk since
+static void remeasure_last(catalog_t *catalog) {
+    catalog_entry_t *entry = catalog->last;
+    if (entry != NULL && entry->book != NULL) {
+        catalog->resident_bytes -= entry->bytes;
+        entry->bytes = gradebook_memory_usage(entry->book);
+        catalog->resident_bytes += entry->bytes;
+    }
+}
+
+// Write entry's book out to its spill file and free it. A book reloaded
+// from the spill file and still backed by it is unmodified since, so the
+// file already holds it. Returns 0, or -1 if the book could not be
+// written.
+static int spill(catalog_t *catalog, catalog_entry_t *entry) {
+    if (!entry->spilled || entry->book->mapping == NULL) {
+        char file_name[MAX_NAME_LEN + strlen(CATALOG_SPILL_EXT)];
+        spill_file(entry, file_name);
+        if (write_gradebook_to_bin_file(entry->book, file_name) != 0) {
+            return -1;
+        }
+        entry->spilled = 1;
+    }
+    free_gradebook(entry->book);
+    entry->book = NULL;
+    catalog->resident_bytes -= entry->bytes;
+    lru_unlink(catalog, entry);
+    catalog->evictions++;
+    return 0;
+}
+
+// Spill least recently used books until the rest fit in the budget,
+// never spilling keep, which the caller is about to hand out. Should a
+// book fail to write, it stays resident and the budget is left exceeded.
+static void enforce_budget(catalog_t *catalog, const catalog_entry_t *keep) {
+    while (catalog->resident_bytes > catalog->memory_budget && catalog->lru_tail != NULL &&
+           catalog->lru_tail != keep) {
+        if (spill(catalog, catalog->lru_tail) != 0) {
+            return;
+        }
+    }
+}
+
+catalog_t *create_catalog(size_t memory_budget) {
+    catalog_t *catalog = calloc(1, sizeof(catalog_t));
+    if (catalog == NULL) {
+        return NULL;
+    }
+    catalog->buckets = calloc(CATALOG_INITIAL_BUCKETS, sizeof(catalog_entry_t *));
+    if (catalog->buckets == NULL) {
+        free(catalog);
+        return NULL;
+    }
+    catalog->num_buckets = CATALOG_INITIAL_BUCKETS;
+    catalog->memory_budget = memory_budget;
+    return catalog;
+}
+
+int catalog_add(catalog_t *catalog, gradebook_t *book) {
+    if (catalog == NULL || book == NULL) {
+        return -1;
+    }
+    remeasure_last(catalog);
+    if (find_entry(catalog, book->class_name) != NULL) {
+        return -1;
+    }
+    if (catalog->num_entries >= catalog->num_buckets && grow_buckets(catalog) != 0) {
+        return -1;
+    }
+    catalog_entry_t *entry = calloc(1, sizeof(catalog_entry_t));
+    if (entry == NULL) {
+        return -1;
+    }
+    strcpy(entry->class_name, book->class_name);
+    catalog_entry_t **bucket = bucket_for(catalog, entry->class_name);
+    entry->next = *bucket;
+    *bucket = entry;
+    catalog->num_entries++;
+    make_resident(catalog, entry, book);
+    // The caller may go on modifying the book it just added
+    catalog->last = entry;
+    enforce_budget(catalog, entry);
+    return 0;
+}
+
+gradebook_t *catalog_get(catalog_t *catalog, const char *class_name) {
+    if (catalog == NULL || class_name == NULL) {
+        return NULL;
+    }
+    remeasure_last(catalog);
+    catalog_entry_t *entry = find_entry(catalog, class_name);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (entry->book == NULL) {
+        char file_name[MAX_NAME_LEN + strlen(CATALOG_SPILL_EXT)];
+        spill_file(entry, file_name);
+        gradebook_t *book = read_gradebook_from_bin_file(file_name, entry->class_name);
+        if (book == NULL) {
+            return NULL;
+        }
+        catalog->misses++;
+        make_resident(catalog, entry, book);
+    } else {
+        catalog->hits++;
+        lru_unlink(catalog, entry);
+        lru_push_front(catalog, entry);
+    }
+    catalog->last = entry;
+    enforce_budget(catalog, entry);
+    return entry->book;
+}
+
+int catalog_remove(catalog_t *catalog, const char *class_name) {
+    if (catalog == NULL || class_name == NULL) {
+        return -1;
+    }
+    remeasure_last(catalog);
+    catalog_entry_t **link = bucket_for(catalog, class_name);
+    while (*link != NULL && strcmp((*link)->class_name, class_name) != 0) {
+        link = &(*link)->next;
+    }
+    catalog_entry_t *entry = *link;
+    if (entry == NULL) {
+        return -1;
+    }
+    *link = entry->next;
+    catalog->num_entries--;
+    if (entry->book != NULL) {
+        catalog->resident_bytes -= entry->bytes;
+        lru_unlink(catalog, entry);
+        free_gradebook(entry->book);
+    }
+    remove_spill(entry);
+    if (catalog->last == entry) {
+        catalog->last = NULL;
+    }
+    free(entry);
+    return 0;
+}
+
+void free_catalog(catalog_t *catalog) {
+    if (catalog == NULL) {
+        return;
+    }
+    for (unsigned i = 0; i < catalog->num_buckets; i++) {
+        while (catalog->buckets[i] != NULL) {
+            catalog_entry_t *entry = catalog->buckets[i];
+            catalog->buckets[i] = entry->next;
+            free_gradebook(entry->book);
+            remove_spill(entry);
+            free(entry);
+        }
+    }
+    free(catalog->buckets);
+    free(catalog);
+}
@@ -0,0 +1,77 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+
+#include "gradebook.h"
+
+#define CATALOG_INITIAL_BUCKETS 64 // Class name buckets in a fresh catalog (a power of two)
+#define CATALOG_SPILL_EXT ".spill"  // Spilled books go to <class>.spill
+
+// A class known to the catalog. Its book is either resident, and on the
+// LRU list, or spilled to <class>.spill and reloaded on next use.
+typedef struct catalog_entry {
+    char class_name[MAX_NAME_LEN];
+    gradebook_t *book;              // Resident book, or NULL while spilled
+    size_t bytes;                   // gradebook_memory_usage when last measured
+    int spilled;                    // Set once <class>.spill has been written
+    struct catalog_entry *next;     // Next entry in the same bucket
+    struct catalog_entry *lru_prev; // Resident entries, most recently used first
+    struct catalog_entry *lru_next;
+} catalog_entry_t;
+
+// Many gradebooks kept open by class name. Once the resident books use
+// more than memory_budget bytes, the least recently used ones are written
+// out to spill files of the catalog's own and freed. <class>.bin and
+// <class>.txt are never touched; the spill files are deleted when their
+// class is removed or the catalog is freed.
+typedef struct {
+    catalog_entry_t **buckets;  // Entries chained by hash of class name
+    unsigned num_buckets;       // A power of two
+    unsigned num_entries;       // Classes known, resident or not
+    catalog_entry_t *lru_head;  // Most recently used resident entry
+    catalog_entry_t *lru_tail;  // Least recently used resident entry
+    catalog_entry_t *last;      // Entry handed out last; remeasured on the next call
+    size_t memory_budget;       // Bytes resident books may use
+    size_t resident_bytes;      // Sum of bytes over resident entries
+    unsigned long hits;         // Lookups that found the book resident
+    unsigned long misses;       // Lookups that reloaded a spilled book
+    unsigned long evictions;    // Books spilled to make room
+} catalog_t;
+
+// Create an empty catalog
+// memory_budget: Bytes the resident gradebooks may use in total
+// Returns: Pointer to the new catalog or NULL if an error occurs
+catalog_t *create_catalog(size_t memory_budget);
+
+// Hand a gradebook over to the catalog, which frees it from then on. The
+// class must not already be in the catalog.
+// catalog: A pointer to the catalog to add to
+// book: The gradebook, filed under its class name
+// Returns: 0 on success or -1 if the class is already present or an
+//          error occurs
+int catalog_add(catalog_t *catalog, gradebook_t *book);
+
+// Look up a class's gradebook, reloading it if it was spilled. The book
+// may be modified freely; its size is measured again on the next catalog
+// call. The pointer is only valid until then, since that call may spill
+// the book to make room.
+// catalog: A pointer to the catalog to search
+// class_name: The class to look up
+// Returns: The class's gradebook, or NULL if the class is not in the
+//          catalog or could not be reloaded
+gradebook_t *catalog_get(catalog_t *catalog, const char *class_name);
+
+// Drop a class from the catalog, freeing its book and deleting its spill
+// file.
+// catalog: A pointer to the catalog to remove from
+// class_name: The class to remove
+// Returns: 0 on success or -1 if the class is not in the catalog
+int catalog_remove(catalog_t *catalog, const char *class_name);
+
+// Deallocate a catalog and every resident gradebook in it, and delete
+// its spill files. Nothing is written to disk.
+// catalog: A pointer to the catalog to deallocate
+void free_catalog(catalog_t *catalog);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "catalog.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+static void check_counters(const catalog_t *catalog, unsigned long hits, unsigned long misses,
+                           unsigned long evictions) {
+    CHECK(catalog->hits == hits);
+    CHECK(catalog->misses == misses);
+    CHECK(catalog->evictions == evictions);
+}
+
+int main(void) {
+    // The user's own saved copy of catalog_a, which spilling must not touch
+    gradebook_t *saved = create_gradebook("catalog_a", 0);
+    add_score(saved, "Ada", 1);
+    CHECK(write_gradebook_to_bin(saved) == 0);
+    free_gradebook(saved);
+
+    // With a one-byte budget every book but the one handed out is spilled
+    catalog_t *catalog = create_catalog(1);
+    gradebook_t *a = create_gradebook("catalog_a", 0);
+    gradebook_t *b = create_gradebook("catalog_b", 0);
+    add_score(a, "Ada", 91);
+    add_score(b, "Ken", 74);
+    CHECK(catalog_add(catalog, a) == 0);
+    check_counters(catalog, 0, 0, 0);
+    CHECK(catalog_add(catalog, b) == 0);
+    check_counters(catalog, 0, 0, 1);
+    CHECK(access("catalog_a.spill", F_OK) == 0);
+    gradebook_t *twin = create_gradebook("catalog_b", 0);
+    CHECK(catalog_add(catalog, twin) == -1);
+    free_gradebook(twin);
+
+    a = catalog_get(catalog, "catalog_a");
+    CHECK(a != NULL && find_score(a, "Ada") == 91);
+    check_counters(catalog, 0, 1, 2);
+    a = catalog_get(catalog, "catalog_a");
+    CHECK(a != NULL && find_score(a, "Ada") == 91);
+    check_counters(catalog, 1, 1, 2);
+
+    // A change to a reloaded book is written out when it is spilled again
+    b = catalog_get(catalog, "catalog_b");
+    CHECK(b != NULL && find_score(b, "Ken") == 74);
+    check_counters(catalog, 1, 2, 3);
+    CHECK(add_score(b, "Ken", 80) == 0);
+    CHECK(catalog_get(catalog, "catalog_a") != NULL);
+    check_counters(catalog, 1, 3, 4);
+    b = catalog_get(catalog, "catalog_b");
+    CHECK(b != NULL && find_score(b, "Ken") == 80);
+    check_counters(catalog, 1, 4, 5);
+    CHECK(catalog_get(catalog, "catalog_c") == NULL);
+
+    // The user's file still holds what was saved to it
+    saved = read_gradebook_from_bin("catalog_a.bin");
+    CHECK(saved != NULL && find_score(saved, "Ada") == 1);
+    free_gradebook(saved);
+
+    CHECK(catalog_remove(catalog, "catalog_a") == 0);
+    CHECK(access("catalog_a.spill", F_OK) != 0);
+    CHECK(catalog_remove(catalog, "catalog_a") == -1);
+    CHECK(access("catalog_b.spill", F_OK) == 0);
+    free_catalog(catalog);
+    CHECK(access("catalog_b.spill", F_OK) != 0);
+    CHECK(access("catalog_a.bin", F_OK) == 0);
+    unlink("catalog_a.bin");
+
+    if (failures == 0) {
+        printf("catalog_test: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "concurrent_gradebook.h"
+
+#define CG_MAX_LOAD_NUM 3 // Grow a stripe's table once it is 3/4 full; linear
+#define CG_MAX_LOAD_DEN 4 // probing degrades faster than group probing
+
+// Reader slots are handed out per thread, process-wide, so a thread uses
+// the same slot in every book. A bit is set in reader_slots_used while its
+// slot is taken; the slot is given back when the thread exits.
+static _Atomic uint64_t reader_slots_used;
+static _Thread_local int reader_slot = -1;
+static pthread_key_t reader_slot_key;
+static pthread_once_t reader_slot_once = PTHREAD_ONCE_INIT;
+
+static void release_reader_slot(void *value) {
+    int slot = (int) (intptr_t) value - 1;
+    atomic_fetch_and(&reader_slots_used, ~(UINT64_C(1) << slot));
+}
+
+static void create_reader_slot_key(void) {
+    pthread_key_create(&reader_slot_key, release_reader_slot);
+}
+
+// Returns this thread's reader slot, claiming one on first use, or -1 if
+// all CG_MAX_READERS are taken
+static int claim_reader_slot(void) {
+    if (reader_slot >= 0) {
+        return reader_slot;
+    }
+    pthread_once(&reader_slot_once, create_reader_slot_key);
+    uint64_t used = atomic_load(&reader_slots_used);
+    while (~used != 0) {
+        int slot = __builtin_ctzll(~used);
+        if (atomic_compare_exchange_weak(&reader_slots_used, &used,
+                                         used | (UINT64_C(1) << slot))) {
+            // Stored off by one, since a NULL value never runs the destructor
+            pthread_setspecific(reader_slot_key, (void *) (intptr_t) (slot + 1));
+            reader_slot = slot;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static cg_stripe_t *stripe_for(concurrent_gradebook_t *book, uint32_t h) {
+    return &book->stripes[h >> (32 - __builtin_ctz(CG_STRIPES))];
+}
+
+static cg_table_t *alloc_cg_table(unsigned capacity) {
+    cg_table_t *table = calloc(1, sizeof(cg_table_t) + capacity * sizeof(cg_node_t *));
+    if (table != NULL) {
+        table->capacity = capacity;
+    }
+    return table;
+}
+
+// Returns the node for name in table, or NULL. Safe without the stripe
+// lock: a slot only ever goes from NULL to a fully built node.
+static cg_node_t *cg_table_find(cg_table_t *table, const char *name, size_t len, uint32_t h) {
+    unsigned mask = table->capacity - 1;
+    for (unsigned i = h & mask;; i = (i + 1) & mask) {
+        cg_node_t *node = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+        if (node == NULL) {
+            return NULL;
+        }
+        if (node->hash == h && node->name_len == len && memcmp(node->name, name, len) == 0) {
+            return node;
+        }
+    }
+}
+
+// Publish node in the first empty slot of its probe sequence. The caller
+// holds the stripe lock and has checked the table has room.
+static void cg_table_insert(cg_table_t *table, cg_node_t *node) {
+    unsigned mask = table->capacity - 1;
+    unsigned i = node->hash & mask;
+    while (atomic_load_explicit(&table->slots[i], memory_order_relaxed) != NULL) {
+        i = (i + 1) & mask;
+    }
+    atomic_store_explicit(&table->slots[i], node, memory_order_release);
+}
+
+// Advance the global epoch if every reader inside the book has seen the
+// current one, then free the tables no reader can still be probing: those
+// retired two or more epochs ago. The caller holds retire_lock.
+static void reclaim_tables(concurrent_gradebook_t *book) {
+    uint64_t epoch = atomic_load(&book->epoch);
+    int advance = 1;
+    for (int i = 0; i < CG_MAX_READERS; i++) {
+        uint64_t seen = atomic_load(&book->readers[i].epoch);
+        if (seen != 0 && seen != epoch) {
+            advance = 0;
+            break;
+        }
+    }
+    if (advance && atomic_compare_exchange_strong(&book->epoch, &epoch, epoch + 1)) {
+        epoch++;
+    }
+    cg_retired_t **link = &book->retired;
+    while (*link != NULL) {
+        cg_retired_t *retired = *link;
+        if (retired->epoch + 2 <= epoch) {
+            *link = retired->next;
+            free(retired->table);
+            free(retired);
+        } else {
+            link = &retired->next;
+        }
+    }
+}
+
+// Replace the stripe's table with one twice the size. Readers still
+// probing the old table see every node it had, so it is only retired.
+// Returns 0, or -1 if no memory is available.
+static int grow_stripe(concurrent_gradebook_t *book, cg_stripe_t *stripe) {
+    cg_table_t *old = atomic_load_explicit(&stripe->table, memory_order_relaxed);
+    cg_table_t *bigger = alloc_cg_table(old->capacity * 2);
+    cg_retired_t *retired = malloc(sizeof(cg_retired_t));
+    if (bigger == NULL || retired == NULL) {
+        free(bigger);
+        free(retired);
+        return -1;
+    }
+    for (unsigned i = 0; i < old->capacity; i++) {
+        cg_node_t *node = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+        if (node != NULL) {
+            cg_table_insert(bigger, node);
+        }
+    }
+    atomic_store(&stripe->table, bigger);
+
+    pthread_mutex_lock(&book->retire_lock);
+    retired->table = old;
+    retired->epoch = atomic_load(&book->epoch);
+    retired->next = book->retired;
+    book->retired = retired;
+    reclaim_tables(book);
+    pthread_mutex_unlock(&book->retire_lock);
+    return 0;
+}
+
+concurrent_gradebook_t *create_concurrent_gradebook(const char *class_name) {
+    if (class_name == NULL || strlen(class_name) >= MAX_NAME_LEN) {
+        return NULL;
+    }
+    concurrent_gradebook_t *book;
+    if (posix_memalign((void **) &book, CG_CACHE_LINE, sizeof(concurrent_gradebook_t)) != 0) {
+        return NULL;
+    }
+    memset(book, 0, sizeof(concurrent_gradebook_t));
+    strcpy(book->class_name, class_name);
+    atomic_init(&book->epoch, 1);
+    pthread_mutex_init(&book->retire_lock, NULL);
+    for (int i = 0; i < CG_MAX_READERS; i++) {
+        atomic_init(&book->readers[i].epoch, 0);
+    }
+    for (int i = 0; i < CG_STRIPES; i++) {
+        pthread_mutex_init(&book->stripes[i].lock, NULL);
+        atomic_init(&book->stripes[i].table, NULL);
+    }
+    for (int i = 0; i < CG_STRIPES; i++) {
+        cg_table_t *table = alloc_cg_table(CG_INITIAL_CAPACITY);
+        if (table == NULL) {
+            free_concurrent_gradebook(book);
+            return NULL;
+        }
+        atomic_store(&book->stripes[i].table, table);
+    }
+    return book;
+}
+
+int concurrent_add_score(concurrent_gradebook_t *book, const char *name, int score) {
+    if (book == NULL || name == NULL) {
+        return -1;
+    }
+    size_t len = strnlen(name, MAX_NAME_LEN - 1);
+    uint32_t h = hash_wy(name, len);
+    cg_stripe_t *stripe = stripe_for(book, h);
+    int ret = -1;
+
+    pthread_mutex_lock(&stripe->lock);
+    cg_table_t *table = atomic_load_explicit(&stripe->table, memory_order_relaxed);
+    cg_node_t *found = cg_table_find(table, name, len, h);
+    if (found != NULL) {
+        atomic_store_explicit(&found->score, score, memory_order_relaxed);
+        ret = 0;
+        goto out;
+    }
+    if ((unsigned long long) (stripe->size + 1) * CG_MAX_LOAD_DEN >
+        (unsigned long long) table->capacity * CG_MAX_LOAD_NUM) {
+        if (grow_stripe(book, stripe) != 0) {
+            goto out;
+        }
+        table = atomic_load_explicit(&stripe->table, memory_order_relaxed);
+    }
+    cg_node_t *node = malloc(sizeof(cg_node_t) + len + 1);
+    if (node == NULL) {
+        goto out;
+    }
+    node->hash = h;
+    node->name_len = len;
+    atomic_init(&node->score, score);
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    cg_table_insert(table, node);
+    stripe->size++;
+    ret = 0;
+out:
+    pthread_mutex_unlock(&stripe->lock);
+    return ret;
+}
+
+int concurrent_find_score(concurrent_gradebook_t *book, const char *name) {
+    if (book == NULL || name == NULL) {
+        return -1;
+    }
+    size_t len = strnlen(name, MAX_NAME_LEN - 1);
+    uint32_t h = hash_wy(name, len);
+    cg_stripe_t *stripe = stripe_for(book, h);
+    int slot = claim_reader_slot();
+    if (slot < 0) {
+        pthread_mutex_lock(&stripe->lock);
+        cg_node_t *found = cg_table_find(atomic_load(&stripe->table), name, len, h);
+        int score = found == NULL ? -1 : atomic_load(&found->score);
+        pthread_mutex_unlock(&stripe->lock);
+        return score;
+    }
+
+    // Announce the epoch before loading the table, so a writer that
+    // replaces the table afterwards will not free it under us
+    _Atomic uint64_t *announced = &book->readers[slot].epoch;
+    atomic_store(announced, atomic_load(&book->epoch));
+    cg_node_t *found = cg_table_find(atomic_load(&stripe->table), name, len, h);
+    int score = found == NULL ? -1 : atomic_load_explicit(&found->score, memory_order_relaxed);
+    atomic_store_explicit(announced, 0, memory_order_release);
+    return score;
+}
+
+unsigned concurrent_gradebook_size(concurrent_gradebook_t *book) {
+    unsigned size = 0;
+    for (int i = 0; i < CG_STRIPES; i++) {
+        pthread_mutex_lock(&book->stripes[i].lock);
+        size += book->stripes[i].size;
+        pthread_mutex_unlock(&book->stripes[i].lock);
+    }
+    return size;
+}
+
+void free_concurrent_gradebook(concurrent_gradebook_t *book) {
+    if (book == NULL) {
+        return;
+    }
+    for (int i = 0; i < CG_STRIPES; i++) {
+        cg_table_t *table = atomic_load(&book->stripes[i].table);
+        for (unsigned j = 0; table != NULL && j < table->capacity; j++) {
+            free(atomic_load_explicit(&table->slots[j], memory_order_relaxed));
+        }
+        free(table);
+        pthread_mutex_destroy(&book->stripes[i].lock);
+    }
+    while (book->retired != NULL) {
+        cg_retired_t *next = book->retired->next;
+        free(book->retired->table);
+        free(book->retired);
+        book->retired = next;
+    }
+    pthread_mutex_destroy(&book->retire_lock);
+    free(book);
+}
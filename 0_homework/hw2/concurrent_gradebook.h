@@ -0,0 +1,101 @@
+#ifndef CONCURRENT_GRADEBOOK_H
+#define CONCURRENT_GRADEBOOK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "gradebook.h"
+
+// A gradebook that many threads can share. Writers lock one of
+// CG_STRIPES stripes, picked by the name's hash, so adds to different
+// stripes run in parallel. Readers take no locks at all: every stripe has
+// its own open-addressing table of node pointers, nodes are never moved
+// or freed while the book is alive, and a table replaced by growth is only
+// freed once every reader that might still be probing it has finished
+// (epoch-based reclamation).
+#define CG_STRIPES 64            // Writer stripes (a power of two)
+#define CG_INITIAL_CAPACITY 16   // Slots in each stripe's first table (a power of two)
+#define CG_MAX_READERS 64        // Threads that can read without locking at once
+#define CG_CACHE_LINE 64
+
+// A student's score. The name never changes once the node is published,
+// so readers can compare it without synchronizing; the score is atomic so
+// an update is seen whole.
+typedef struct {
+    uint32_t hash;        // hash_wy of the name; its top bits pick the stripe
+    uint32_t name_len;    // Length of name
+    _Atomic int score;    // Student's score
+    char name[];          // '\0'-terminated student name
+} cg_node_t;
+
+// One stripe's table: linear probing over node pointers, NULL marking
+// the end of a probe sequence. Entries are never removed.
+typedef struct {
+    unsigned capacity;              // Slots (a power of two)
+    _Atomic(cg_node_t *) slots[];   // Published with release stores
+} cg_table_t;
+
+typedef struct {
+    pthread_mutex_t lock;           // Held by writers to this stripe
+    _Atomic(cg_table_t *) table;    // Current table, swapped on growth
+    unsigned size;                  // Entries in table (writers only)
+} __attribute__((aligned(CG_CACHE_LINE))) cg_stripe_t;
+
+// Epoch announced by a reader slot: 0 while the slot's thread is outside
+// the book, otherwise the global epoch it saw on entering
+typedef struct {
+    _Atomic uint64_t epoch;
+} __attribute__((aligned(CG_CACHE_LINE))) cg_reader_t;
+
+// A table waiting for every reader to leave the epoch it was retired in
+typedef struct cg_retired {
+    cg_table_t *table;
+    uint64_t epoch;               // Global epoch when it was replaced
+    struct cg_retired *next;
+} cg_retired_t;
+
+typedef struct {
+    char class_name[MAX_NAME_LEN];       // Name of class for grades
+    cg_stripe_t stripes[CG_STRIPES];
+    cg_reader_t readers[CG_MAX_READERS]; // Indexed by each thread's reader slot
+    _Atomic uint64_t epoch;              // Global epoch, starting at 1
+    pthread_mutex_t retire_lock;         // Guards retired
+    cg_retired_t *retired;               // Tables not yet safe to free
+} concurrent_gradebook_t;
+
+// Create a new, empty concurrent gradebook
+// class_name: The name of the class for grades
+// Returns: Pointer to the new gradebook or NULL if an error occurs
+concurrent_gradebook_t *create_concurrent_gradebook(const char *class_name);
+
+// Add a new score or update an existing one. Safe to call from any
+// number of threads at once.
+// book: A pointer to a gradebook to add the score to
+// name: Student's name
+// score: Student's score
+// Returns: 0 if the score was successfully added/updated
+//          or -1 if the score could not be added/updated
+int concurrent_add_score(concurrent_gradebook_t *book, const char *name, int score);
+
+// Search for a student's score without taking any locks. Safe to call
+// from any number of threads at once, alongside concurrent_add_score.
+// Threads beyond the first CG_MAX_READERS alive at once fall back to
+// locking the stripe.
+// book: A pointer to a gradebook to search for the student score in
+// name: The student's name
+// Returns: The student's score if their name is found
+//          or -1 if no matching student name is found
+int concurrent_find_score(concurrent_gradebook_t *book, const char *name);
+
+// Returns the number of entries in the gradebook. Only exact while no
+// adds are in progress.
+// book: A pointer to the gradebook to count
+unsigned concurrent_gradebook_size(concurrent_gradebook_t *book);
+
+// Deallocate all memory of a concurrent gradebook. No other thread may be
+// using it.
+// book: A pointer to the gradebook to deallocate
+void free_concurrent_gradebook(concurrent_gradebook_t *book);
+
+#endif
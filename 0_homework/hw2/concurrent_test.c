@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "concurrent_gradebook.h"
+
+#define WRITERS 4
+#define READERS 4
+#define NAMES_PER_WRITER 20000
+
+static concurrent_gradebook_t *book;
+static _Atomic int writers_left = WRITERS;
+static _Atomic unsigned long bad_reads;
+static _Atomic unsigned long reads;
+
+static void name_of(unsigned writer, unsigned i, char *name, size_t size) {
+    snprintf(name, size, "w%u-%05u", writer, i);
+}
+
+// The score a writer first adds for a name, and the one it regrades every
+// other name to afterwards
+static int score_of(unsigned writer, unsigned i) {
+    return writer * NAMES_PER_WRITER + i;
+}
+
+static int regrade_of(unsigned writer, unsigned i) {
+    return score_of(writer, i) + WRITERS * NAMES_PER_WRITER;
+}
+
+// Each writer adds its own names, which no other writer touches, then
+// regrades every other one
+static void *write_names(void *arg) {
+    unsigned writer = (unsigned) (uintptr_t) arg;
+    char name[MAX_NAME_LEN];
+    for (unsigned i = 0; i < NAMES_PER_WRITER; i++) {
+        name_of(writer, i, name, sizeof(name));
+        concurrent_add_score(book, name, score_of(writer, i));
+    }
+    for (unsigned i = 0; i < NAMES_PER_WRITER; i += 2) {
+        name_of(writer, i, name, sizeof(name));
+        concurrent_add_score(book, name, regrade_of(writer, i));
+    }
+    atomic_fetch_sub(&writers_left, 1);
+    return NULL;
+}
+
+// While the writers run, every score read must be missing or one its
+// writer has set
+static void *read_names(void *arg) {
+    unsigned long x = 88172645463325252UL + (uintptr_t) arg;
+    char name[MAX_NAME_LEN];
+    unsigned long n = 0, bad = 0;
+    while (atomic_load(&writers_left) > 0) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        unsigned writer = x % WRITERS, i = (x >> 8) % NAMES_PER_WRITER;
+        name_of(writer, i, name, sizeof(name));
+        int score = concurrent_find_score(book, name);
+        bad += score != -1 && score != score_of(writer, i) && score != regrade_of(writer, i);
+        n++;
+    }
+    atomic_fetch_add(&bad_reads, bad);
+    atomic_fetch_add(&reads, n);
+    return NULL;
+}
+
+int main(void) {
+    book = create_concurrent_gradebook("concurrent");
+    if (book == NULL) {
+        printf("concurrent_test: could not create the gradebook\n");
+        return 1;
+    }
+    pthread_t writers[WRITERS], readers[READERS];
+    for (uintptr_t t = 0; t < READERS; t++) {
+        pthread_create(&readers[t], NULL, read_names, (void *) t);
+    }
+    for (uintptr_t t = 0; t < WRITERS; t++) {
+        pthread_create(&writers[t], NULL, write_names, (void *) t);
+    }
+    for (int t = 0; t < WRITERS; t++) {
+        pthread_join(writers[t], NULL);
+    }
+    for (int t = 0; t < READERS; t++) {
+        pthread_join(readers[t], NULL);
+    }
+
+    int failures = 0;
+    if (atomic_load(&bad_reads) != 0) {
+        printf("concurrent_test: %lu of %lu reads saw a wrong score\n", atomic_load(&bad_reads),
+               atomic_load(&reads));
+        failures++;
+    }
+    // Every name is in, with its last score
+    char name[MAX_NAME_LEN];
+    unsigned missing = 0, wrong = 0;
+    for (unsigned writer = 0; writer < WRITERS; writer++) {
+        for (unsigned i = 0; i < NAMES_PER_WRITER; i++) {
+            name_of(writer, i, name, sizeof(name));
+            int score = concurrent_find_score(book, name);
+            missing += score == -1;
+            wrong += score != -1 && score != (i % 2 == 0 ? regrade_of(writer, i) : score_of(writer, i));
+        }
+    }
+    if (missing != 0 || wrong != 0 || concurrent_gradebook_size(book) != WRITERS * NAMES_PER_WRITER) {
+        printf("concurrent_test: %u names missing, %u wrong, size %u\n", missing, wrong,
+               concurrent_gradebook_size(book));
+        failures++;
+    }
+    free_concurrent_gradebook(book);
+    if (failures == 0) {
+        printf("concurrent_test: all checks passed (%lu concurrent reads)\n", atomic_load(&reads));
+    }
+    return failures == 0 ? 0 : 1;
+}
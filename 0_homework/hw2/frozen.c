@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "frozen.h"
+
+// Names longer than MAX_NAME_LEN - 1 are cut short, as find_score does
+static inline size_t name_length(const char *name) {
+    return strnlen(name, MAX_NAME_LEN - 1);
+}
+
+// The bucket of a name's hash: its high half scaled to num_buckets
+static inline unsigned bucket_of(uint64_t hash_val, unsigned num_buckets) {
+    return (hash_val >> 32) * num_buckets >> 32;
+}
+
+// The slot pilot sends a name's hash to: the hash scrambled with the
+// pilot (MurmurHash3's finalizer) and scaled to size
+static inline unsigned slot_of(uint64_t hash_val, uint32_t pilot, unsigned size) {
+    uint64_t x = hash_val ^ (pilot + 1ULL) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (unsigned) ((__uint128_t) x * size >> 64);
+}
+
+static inline unsigned slot_in_bucket(const frozen_gradebook_t *frozen, uint64_t hash_val,
+                                      uint32_t pilot) {
+    return pilot & FROZEN_DIRECT ? pilot & ~FROZEN_DIRECT : slot_of(hash_val, pilot, frozen->size);
+}
+
+// Whether slot holds name, which is len bytes long. The stored name ends
+// at its '\0', so strncmp never reads past it.
+static inline int slot_holds(const frozen_gradebook_t *frozen, unsigned slot, const char *name,
+                             size_t len) {
+    const char *stored = frozen->names + frozen->entries[slot].name_off;
+    return strncmp(stored, name, len) == 0 && stored[len] == '\0';
+}
+
+// Every name of the book being frozen, with its hash, in the order
+// for_each_score visits them
+typedef struct {
+    frozen_gradebook_t *frozen;
+    uint64_t *hashes;
+    int *scores;
+    uint32_t *name_offs;
+    unsigned n;
+} frozen_keys_t;
+
+// Count the names and their bytes, '\0's included
+typedef struct {
+    unsigned n;
+    size_t names_len;
+} frozen_size_t;
+
+static void measure_key(const char *name, int score, void *arg) {
+    frozen_size_t *size = arg;
+    size->n++;
+    size->names_len += strlen(name) + 1;
+}
+
+static void add_key(const char *name, int score, void *arg) {
+    frozen_keys_t *keys = arg;
+    size_t len = strlen(name);
+    keys->hashes[keys->n] = hash_wy64(name, len);
+    keys->scores[keys->n] = score;
+    keys->name_offs[keys->n] = keys->frozen->names_len;
+    memcpy(keys->frozen->names + keys->frozen->names_len, name, len + 1);
+    keys->frozen->names_len += len + 1;
+    keys->n++;
+}
+
+// Find a pilot for every bucket and fill in the entries. keys is sorted
+// by bucket, with bucket b's keys from starts[b] up to starts[b + 1].
+// Returns 0, or -1 if some bucket has no pilot that fits (two names with
+// the same 64-bit hash, in practice) or no memory is available.
+static int place_buckets(frozen_gradebook_t *frozen, const frozen_keys_t *keys,
+                         const uint32_t *order, const unsigned *starts) {
+    unsigned num_buckets = frozen->num_buckets, size = frozen->size;
+    unsigned max_len = 0;
+    for (unsigned b = 0; b < num_buckets; b++) {
+        unsigned len = starts[b + 1] - starts[b];
+        max_len = len > max_len ? len : max_len;
+    }
+    // Buckets biggest first, by a counting sort on their length
+    unsigned *by_len = calloc(max_len + 2, sizeof(unsigned));
+    uint32_t *buckets = malloc(num_buckets * sizeof(uint32_t));
+    uint64_t *taken = calloc(size / 64 + 1, sizeof(uint64_t));
+    unsigned *slots = malloc((max_len + 1) * sizeof(unsigned));
+    int err = by_len == NULL || buckets == NULL || taken == NULL || slots == NULL;
+    for (unsigned b = 0; !err && b < num_buckets; b++) {
+        by_len[max_len - (starts[b + 1] - starts[b]) + 1]++;
+    }
+    for (unsigned len = 0; !err && len <= max_len; len++) {
+        by_len[len + 1] += by_len[len];
+    }
+    for (unsigned b = 0; !err && b < num_buckets; b++) {
+        buckets[by_len[max_len - (starts[b + 1] - starts[b])]++] = b;
+    }
+
+    unsigned next_free = 0;
+    for (unsigned i = 0; !err && i < num_buckets; i++) {
+        unsigned b = buckets[i];
+        const uint32_t *members = order + starts[b];
+        unsigned len = starts[b + 1] - starts[b];
+        if (len == 0) {
+            frozen->pilots[b] = 0;
+            continue;
+        }
+        if (len == 1) {
+            // Every bigger bucket is placed, so any free slot will do
+            while (taken[next_free / 64] >> next_free % 64 & 1) {
+                next_free++;
+            }
+            slots[0] = next_free;
+            frozen->pilots[b] = FROZEN_DIRECT | next_free;
+        } else {
+            uint32_t pilot;
+            for (pilot = 0; pilot < FROZEN_MAX_PILOT; pilot++) {
+                unsigned j;
+                for (j = 0; j < len; j++) {
+                    slots[j] = slot_of(keys->hashes[members[j]], pilot, size);
+                    if (taken[slots[j] / 64] >> slots[j] % 64 & 1) {
+                        break;
+                    }
+                    // Taken for now, so the bucket cannot collide with itself
+                    taken[slots[j] / 64] |= 1ULL << slots[j] % 64;
+                }
+                if (j == len) {
+                    break;
+                }
+                while (j-- > 0) {
+                    taken[slots[j] / 64] &= ~(1ULL << slots[j] % 64);
+                }
+            }
+            if (pilot == FROZEN_MAX_PILOT) {
+                err = 1;
+                break;
+            }
+            frozen->pilots[b] = pilot;
+        }
+        for (unsigned j = 0; j < len; j++) {
+            taken[slots[j] / 64] |= 1ULL << slots[j] % 64;
+            frozen->entries[slots[j]] = (frozen_entry_t) {keys->name_offs[members[j]],
+                                                          keys->scores[members[j]]};
+        }
+    }
+    free(by_len);
+    free(buckets);
+    free(taken);
+    free(slots);
+    return err ? -1 : 0;
+}
+
+frozen_gradebook_t *freeze_gradebook(gradebook_t *book) {
+    if (book == NULL) {
+        return NULL;
+    }
+    // Measure the names first; a lazy book is loaded by this first walk
+    frozen_size_t measured = {0, 0};
+    for_each_score(book, measure_key, &measured);
+    if (book->lazy.data != NULL) {
+        return NULL; // It could not be loaded
+    }
+    unsigned n = measured.n;
+    frozen_gradebook_t *frozen = calloc(1, sizeof(frozen_gradebook_t));
+    frozen_keys_t keys = {frozen};
+    if (frozen == NULL) {
+        return NULL;
+    }
+    strcpy(frozen->class_name, get_gradebook_name(book));
+    frozen->size = n;
+    frozen->num_buckets = n / FROZEN_BUCKET_SIZE + 1;
+    frozen->pilots = malloc(frozen->num_buckets * sizeof(uint32_t));
+    frozen->entries = malloc((n + 1) * sizeof(frozen_entry_t));
+    frozen->names = malloc(measured.names_len + 1);
+    keys.hashes = malloc((n + 1) * sizeof(uint64_t));
+    keys.scores = malloc((n + 1) * sizeof(int));
+    keys.name_offs = malloc((n + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc((n + 1) * sizeof(uint32_t));
+    unsigned *starts = calloc(frozen->num_buckets + 1, sizeof(unsigned));
+    int err = frozen->pilots == NULL || frozen->entries == NULL || frozen->names == NULL ||
+              keys.hashes == NULL || keys.scores == NULL || keys.name_offs == NULL ||
+              order == NULL || starts == NULL;
+    if (!err) {
+        for_each_score(book, add_key, &keys);
+        err = keys.n != n;
+    }
+    if (!err) {
+        // Sort the names by bucket
+        for (unsigned i = 0; i < n; i++) {
+            starts[bucket_of(keys.hashes[i], frozen->num_buckets) + 1]++;
+        }
+        for (unsigned b = 0; b < frozen->num_buckets; b++) {
+            starts[b + 1] += starts[b];
+        }
+        for (unsigned i = 0; i < n; i++) {
+            order[starts[bucket_of(keys.hashes[i], frozen->num_buckets)]++] = i;
+        }
+        for (unsigned b = frozen->num_buckets; b > 0; b--) {
+            starts[b] = starts[b - 1];
+        }
+        starts[0] = 0;
+        err = place_buckets(frozen, &keys, order, starts) != 0;
+    }
+    free(keys.hashes);
+    free(keys.scores);
+    free(keys.name_offs);
+    free(order);
+    free(starts);
+    if (err) {
+        free_frozen_gradebook(frozen);
+        return NULL;
+    }
+    return frozen;
+}
+
+int frozen_find_score(const frozen_gradebook_t *frozen, const char *name) {
+    if (frozen == NULL || name == NULL || frozen->size == 0) {
+        return -1;
+    }
+    size_t len = name_length(name);
+    uint64_t hash_val = hash_wy64(name, len);
+    uint32_t pilot = frozen->pilots[bucket_of(hash_val, frozen->num_buckets)];
+    unsigned slot = slot_in_bucket(frozen, hash_val, pilot);
+    return slot_holds(frozen, slot, name, len) ? frozen->entries[slot].score : -1;
+}
+
+// Batch lookups run a pipeline like find_scores_batch's: name
+// i + 2 * BATCH_DISTANCE is hashed and its pilot prefetched, the slot of
+// i + BATCH_DISTANCE is worked out and its entry prefetched, and name i
+// is compared.
+#define FROZEN_RING (4 * BATCH_DISTANCE)
+
+unsigned frozen_find_scores_batch(const frozen_gradebook_t *frozen, const char *const *names,
+                                  int *scores, unsigned n) {
+    if (frozen == NULL || names == NULL || scores == NULL) {
+        return 0;
+    }
+    if (frozen->size == 0) {
+        for (unsigned i = 0; i < n; i++) {
+            scores[i] = -1;
+        }
+        return 0;
+    }
+    size_t lens[FROZEN_RING];
+    uint64_t hashes[FROZEN_RING];
+    unsigned slots[FROZEN_RING];
+    unsigned num_found = 0;
+    for (long i = -2 * BATCH_DISTANCE; i < (long) n; i++) {
+        long ahead = i + 2 * BATCH_DISTANCE;
+        if (ahead < n) {
+            unsigned r = ahead % FROZEN_RING;
+            lens[r] = name_length(names[ahead]);
+            hashes[r] = hash_wy64(names[ahead], lens[r]);
+            __builtin_prefetch(&frozen->pilots[bucket_of(hashes[r], frozen->num_buckets)]);
+        }
+        ahead = i + BATCH_DISTANCE;
+        if (ahead >= 0 && ahead < n) {
+            unsigned r = ahead % FROZEN_RING;
+            uint32_t pilot = frozen->pilots[bucket_of(hashes[r], frozen->num_buckets)];
+            slots[r] = slot_in_bucket(frozen, hashes[r], pilot);
+            __builtin_prefetch(&frozen->entries[slots[r]]);
+        }
+        if (i >= 0) {
+            unsigned r = i % FROZEN_RING;
+            int found = slot_holds(frozen, slots[r], names[i], lens[r]);
+            scores[i] = found ? frozen->entries[slots[r]].score : -1;
+            num_found += found;
+        }
+    }
+    return num_found;
+}
+
+size_t frozen_memory_usage(const frozen_gradebook_t *frozen) {
+    return sizeof(frozen_gradebook_t) + frozen->num_buckets * sizeof(uint32_t) +
+           (frozen->size + 1) * sizeof(frozen_entry_t) + frozen->names_len + 1;
+}
+
+void free_frozen_gradebook(frozen_gradebook_t *frozen) {
+    if (frozen == NULL) {
+        return;
+    }
+    free(frozen->pilots);
+    free(frozen->entries);
+    free(frozen->names);
+    free(frozen);
+}
@@ -0,0 +1,69 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gradebook.h"
+
+#define FROZEN_BUCKET_SIZE 4       // Names per bucket of the perfect hash, on average
+#define FROZEN_MAX_PILOT (1 << 24) // Pilots tried for one bucket before freezing gives up
+#define FROZEN_DIRECT 0x80000000u  // Marks a pilot that is the slot of a one-name bucket
+
+// A read-only copy of a gradebook for books that are only looked up once
+// loaded. Its names are placed by a minimal perfect hash (hash and
+// displace, as in CHD): a name's 64-bit hash picks a bucket, and the
+// bucket's pilot scrambles the hash into a slot of its own in
+// [0, size). Pilots are found bucket by bucket, biggest buckets first,
+// while the slots are still mostly free; a one-name bucket stores its
+// slot directly. A lookup is one hash, one pilot, one slot and one name
+// compare, and nothing is ever probed.
+
+// A name's slot: where its name is and its score
+typedef struct {
+    uint32_t name_off; // Offset of the name in names
+    int score;
+} frozen_entry_t;
+
+typedef struct {
+    char class_name[MAX_NAME_LEN]; // Name of class for grades
+    uint32_t *pilots;              // Per bucket: a pilot, or FROZEN_DIRECT | slot
+    unsigned num_buckets;          // Buckets in pilots
+    frozen_entry_t *entries;       // Per slot, one for each name
+    unsigned size;                 // Names in the book
+    char *names;                   // Every name, '\0'-terminated, back to back
+    size_t names_len;              // Bytes in names
+} frozen_gradebook_t;
+
+// Build a frozen copy of a gradebook. The book's scores are not changed,
+// though a lazy book is loaded, and it can be freed once it is no longer
+// needed.
+// book: A pointer to the gradebook to copy
+// Returns: A pointer to the frozen copy
+//          or NULL if no memory is available or no perfect hash was found
+frozen_gradebook_t *freeze_gradebook(gradebook_t *book);
+
+// Search a frozen gradebook for a student's score
+// frozen: A pointer to a frozen gradebook
+// name: The student's name
+// Returns: The student's score if their name is found
+//          or -1 if it is not found
+int frozen_find_score(const frozen_gradebook_t *frozen, const char *name);
+
+// Look up n names at once, overlapping their memory accesses
+// frozen: A pointer to a frozen gradebook
+// names: The students' names
+// scores: Filled in with each student's score, or -1 if not found
+// n: Number of names
+// Returns: The number of names found
+unsigned frozen_find_scores_batch(const frozen_gradebook_t *frozen, const char *const *names,
+                                  int *scores, unsigned n);
+
+// Returns: Bytes of memory a frozen gradebook takes
+size_t frozen_memory_usage(const frozen_gradebook_t *frozen);
+
+// Free a frozen gradebook
+// frozen: A pointer to the frozen gradebook to free
+void free_frozen_gradebook(frozen_gradebook_t *frozen);
+
+#endif
@@ -1,162 +1,3602 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "gradebook.h"
 
-// This is the (somewhat famous) djb2 hash
-unsigned hash(const char *str) {
+// This is the (somewhat famous) djb2 hash. The full 32-bit value is
+// returned: the low 7 bits become the slot fingerprint and the rest pick
+// the group to start probing from.
+unsigned hash(const char *str, size_t len) {
     unsigned hash_val = 5381;
-    int i = 0;
-    while (str[i] != '\0') {
+    for (size_t i = 0; i < len; i++) {
         hash_val = ((hash_val << 5) + hash_val) + str[i];
-        i++;
     }
-    return hash_val % NUM_BUCKETS;
+    return hash_val;
 }
 
-gradebook_t* create_gradebook(const char* class_name) {
-    // TODO: craete a new book
+static inline uint64_t read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiply to 128 bits and fold the halves together
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+// Follows wyhash's final version: keys of up to 16 bytes are read as two
+// (possibly overlapping) words, longer ones 16 bytes per round
+uint64_t hash_wy64(const char *str, size_t len) {
+    static const uint64_t secret[] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                      0x8ebc6af09c88c6e3ull};
+    uint64_t seed = secret[0];
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = read32(str) << 32 | read32(str + mid);
+            b = read32(str + len - 4) << 32 | read32(str + len - 4 - mid);
+        } else if (len > 0) {
+            a = (uint64_t) (uint8_t) str[0] << 16 | (uint64_t) (uint8_t) str[len >> 1] << 8 |
+                (uint8_t) str[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        const char *p = str;
+        while (i > 16) {
+            seed = wymix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    return wymix(secret[1] ^ len, wymix(a ^ secret[1], b ^ seed));
+}
+
+unsigned hash_wy(const char *str, size_t len) {
+    uint64_t h = hash_wy64(str, len);
+    return (unsigned) (h ^ (h >> 32));
+}
+
+unsigned (*const hash_functions[HASH_KINDS])(const char *str, size_t len) = {
+    [HASH_WY] = hash_wy,
+    [HASH_DJB2] = hash,
+};
+
+static inline unsigned book_hash(const gradebook_t *book, const char *name, size_t len) {
+    return hash_functions[book->hash_kind](name, len);
+}
+
+// Names longer than MAX_NAME_LEN - 1 are cut short, as the fixed-size name
+// field used to do
+static inline size_t name_length(const char *name) {
+    return strnlen(name, MAX_NAME_LEN - 1);
+}
+
+static inline uint8_t fingerprint(unsigned hash_val) {
+    return hash_val & 0x7f;
+}
+
+static inline unsigned home_group(unsigned hash_val, unsigned capacity) {
+    return (hash_val >> 7) & (capacity / GROUP_SIZE - 1);
+}
+
+// Bit i of the result is set when ctrl[i] == byte
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *) ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        if (ctrl[i] == byte) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set when slot i of the group is empty
+static inline unsigned group_match_empty(const uint8_t *ctrl) {
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+// Bit i of the result is set when slot i of the group holds no entry
+static inline unsigned group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *) ctrl));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        if (ctrl[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static inline int slot_is_full(const table_t *table, unsigned slot) {
+    return (table->ctrl[slot] & 0x80) == 0;
+}
+
+// Allocate an empty table with the given number of slots
+static int alloc_table(table_t *table, unsigned capacity) {
+    uint8_t *ctrl = aligned_alloc(GROUP_SIZE, capacity);
+    // Zeroed so the ids of empty slots, which write_gradebook_to_bin
+    // writes out with the rest, are never stale heap bytes
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (ctrl == NULL || slots == NULL) {
+        free(ctrl);
+        free(slots);
+        return -1;
+    }
+    memset(ctrl, CTRL_EMPTY, capacity);
+    table->ctrl = ctrl;
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+static void release_table(table_t *table) {
+    free(table->ctrl);
+    free(table->slots);
+    table->ctrl = NULL;
+    table->slots = NULL;
+    table->capacity = 0;
+}
+
+static inline node_t *node_at(const gradebook_t *book, uint32_t id) {
+    return &book->nodes.slabs[id / SLAB_NODES][id % SLAB_NODES];
+}
+
+static inline const char *name_at(const gradebook_t *book, uint32_t name_off) {
+    return book->names.chunks[name_off / NAME_CHUNK_SIZE] + name_off % NAME_CHUNK_SIZE;
+}
+
+// Hand out a node id from the free list, or from the last slab, starting
+// a new slab when it is used up. Returns NO_NODE if no memory is available.
+static uint32_t alloc_node(node_pool_t *pool) {
+    if (pool->free_head != NO_NODE) {
+        uint32_t id = pool->free_head;
+        pool->free_head = pool->slabs[id / SLAB_NODES][id % SLAB_NODES].name_off;
+        return id;
+    }
+    if (pool->num_slabs == 0 || pool->used == SLAB_NODES) {
+        if (pool->num_slabs == UINT32_MAX / SLAB_NODES) {
+            return NO_NODE;
+        }
+        if (pool->num_slabs == pool->max_slabs) {
+            unsigned max_slabs = pool->max_slabs == 0 ? 4 : pool->max_slabs * 2;
+            node_t **slabs = realloc(pool->slabs, max_slabs * sizeof(node_t *));
+            if (slabs == NULL) {
+                return NO_NODE;
+            }
+            pool->slabs = slabs;
+            pool->max_slabs = max_slabs;
+        }
+        node_t *slab = malloc(SLAB_NODES * sizeof(node_t));
+        if (slab == NULL) {
+            return NO_NODE;
+        }
+        pool->slabs[pool->num_slabs++] = slab;
+        pool->used = 0;
+    }
+    return (pool->num_slabs - 1) * SLAB_NODES + pool->used++;
+}
+
+// Put a node back for reuse by a later alloc_node
+static void release_node(node_pool_t *pool, uint32_t id) {
+    pool->slabs[id / SLAB_NODES][id % SLAB_NODES].name_off = pool->free_head;
+    pool->free_head = id;
+}
+
+static void free_node_pool(node_pool_t *pool) {
+    for (unsigned i = 0; i < pool->num_slabs; i++) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+}
+
+// Copy a name of len bytes into the pool, starting a new chunk if it does
+// not fit in the last one. Returns 0 and the name's offset in *name_off,
+// or -1 if no memory is available.
+static int store_name(name_pool_t *pool, const char *name, size_t len, uint32_t *name_off) {
+    if (pool->num_chunks == 0 || pool->used + len + 1 > NAME_CHUNK_SIZE) {
+        if (pool->num_chunks == UINT32_MAX / NAME_CHUNK_SIZE) {
+            return -1;
+        }
+        if (pool->num_chunks == pool->max_chunks) {
+            unsigned max_chunks = pool->max_chunks == 0 ? 4 : pool->max_chunks * 2;
+            char **chunks = realloc(pool->chunks, max_chunks * sizeof(char *));
+            if (chunks == NULL) {
+                return -1;
+            }
+            pool->chunks = chunks;
+            pool->max_chunks = max_chunks;
+        }
+        char *chunk = malloc(NAME_CHUNK_SIZE);
+        if (chunk == NULL) {
+            return -1;
+        }
+        // The last chunk's unused tail is written to binary files too
+        if (pool->num_chunks > 0) {
+            memset(pool->chunks[pool->num_chunks - 1] + pool->used, 0,
+                   NAME_CHUNK_SIZE - pool->used);
+        }
+        pool->chunks[pool->num_chunks++] = chunk;
+        pool->used = 0;
+    }
+    char *dest = pool->chunks[pool->num_chunks - 1] + pool->used;
+    memcpy(dest, name, len);
+    dest[len] = '\0';
+    *name_off = (pool->num_chunks - 1) * NAME_CHUNK_SIZE + pool->used;
+    pool->used += len + 1;
+    return 0;
+}
+
+static void free_name_pool(name_pool_t *pool) {
+    for (unsigned i = 0; i < pool->num_chunks; i++) {
+        free(pool->chunks[i]);
+    }
+    free(pool->chunks);
+}
+
+// Returns the slot of table holding name, or -1 if the name is not there.
+// Probing walks whole groups linearly and stops at the first group that
+// still has an empty slot, since an insert would have used it.
+static long find_slot(const gradebook_t *book, const table_t *table, const char *name,
+                      size_t len, unsigned hash_val) {
+    if (table->capacity == 0) {
+        return -1;
+    }
+    unsigned group_mask = table->capacity / GROUP_SIZE - 1;
+    unsigned group = home_group(hash_val, table->capacity);
+    uint8_t fp = fingerprint(hash_val);
+    while (1) {
+        const uint8_t *ctrl = table->ctrl + group * GROUP_SIZE;
+        unsigned match = group_match(ctrl, fp);
+        while (match != 0) {
+            unsigned slot = group * GROUP_SIZE + __builtin_ctz(match);
+            const node_t *node = node_at(book, table->slots[slot]);
+            if (node->hash == hash_val && node->name_len == len &&
+                memcmp(name_at(book, node->name_off), name, len) == 0) {
+                return slot;
+            }
+            match &= match - 1;
+        }
+        if (group_match_empty(ctrl) != 0) {
+            return -1;
+        }
+        group = (group + 1) & group_mask;
+    }
+}
+
+// Place node in the first unused slot of its probe sequence. The caller
+// guarantees the name is not already present and the table is not full.
+static void insert_slot(table_t *table, uint32_t id, unsigned hash_val) {
+    unsigned group_mask = table->capacity / GROUP_SIZE - 1;
+    unsigned group = home_group(hash_val, table->capacity);
+    while (1) {
+        unsigned free_mask = group_match_free(table->ctrl + group * GROUP_SIZE);
+        if (free_mask != 0) {
+            unsigned slot = group * GROUP_SIZE + __builtin_ctz(free_mask);
+            table->ctrl[slot] = fingerprint(hash_val);
+            table->slots[slot] = id;
+            return;
+        }
+        group = (group + 1) & group_mask;
+    }
+}
+
+// Spread a name's 32-bit hash over 64 bits (MurmurHash3's finalizer), so
+// which filter bits it sets do not follow which table group it is in
+static inline uint64_t filter_mix(unsigned hash_val) {
+    uint64_t x = hash_val;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+#define FILTER_BLOCK_BITS (FILTER_BLOCK_WORDS * 64)
+
+// The block a mixed hash picks: its high half scaled to num_blocks
+static inline uint64_t *filter_block(const filter_t *filter, uint64_t mixed) {
+    return filter->blocks + ((mixed >> 32) * filter->num_blocks >> 32) * FILTER_BLOCK_WORDS;
+}
+
+// The bits within the block come from the top bits of an LCG seeded with
+// the mixed hash. Double hashing (bit + i * step) would give only 2^17
+// patterns in a 512-bit block, which caps how few false positives the
+// filter can get down to.
+static inline uint64_t filter_next(uint64_t *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *state >> (64 - __builtin_ctz(FILTER_BLOCK_BITS));
+}
+
+static void filter_add(filter_t *filter, unsigned hash_val) {
+    uint64_t mixed = filter_mix(hash_val);
+    uint64_t *block = filter_block(filter, mixed);
+    for (unsigned i = 0; i < filter->num_hashes; i++) {
+        uint64_t bit = filter_next(&mixed);
+        block[bit / 64] |= 1ULL << bit % 64;
+    }
+}
+
+// Returns: 0 if no name with this hash was ever added, 1 if one may have been
+static inline int filter_may_contain(const filter_t *filter, unsigned hash_val) {
+    uint64_t mixed = filter_mix(hash_val);
+    const uint64_t *block = filter_block(filter, mixed);
+    for (unsigned i = 0; i < filter->num_hashes; i++) {
+        uint64_t bit = filter_next(&mixed);
+        if ((block[bit / 64] & 1ULL << bit % 64) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// log2(x) for x >= 1, to within 0.09, which is close enough to size a
+// filter by
+static double approx_log2(double x) {
+    double whole = 0;
+    while (x >= 2) {
+        x /= 2;
+        whole++;
+    }
+    return whole + x - 1;
+}
+
+// Allocate an empty filter for up to max_names names at fp_rate. An
+// unblocked filter needs log2(1 / fp_rate) hashes and 1.44 bits per name
+// for each; names spread unevenly over blocks, so a blocked one gets
+// FILTER_BLOCK_SLACK times the bits to make up for the crowded blocks.
+#define FILTER_BLOCK_SLACK 1.2
+static int alloc_filter(filter_t *filter, unsigned max_names, double fp_rate) {
+    double bits = approx_log2(1 / fp_rate);
+    unsigned num_hashes = bits + 0.5;
+    num_hashes = num_hashes < 1 ? 1 : num_hashes > FILTER_MAX_HASHES ? FILTER_MAX_HASHES : num_hashes;
+    double num_blocks = max_names * bits * 1.4427 * FILTER_BLOCK_SLACK / FILTER_BLOCK_BITS + 1;
+    if (num_blocks > UINT32_MAX) {
+        return -1;
+    }
+    size_t bytes = (size_t) num_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    uint64_t *blocks = aligned_alloc(FILTER_BLOCK_WORDS * sizeof(uint64_t), bytes);
+    if (blocks == NULL) {
+        return -1;
+    }
+    memset(blocks, 0, bytes);
+    filter->blocks = blocks;
+    filter->num_blocks = num_blocks;
+    filter->num_hashes = num_hashes;
+    filter->fp_rate = fp_rate;
+    return 0;
+}
+
+// Replace the book's filter with one sized for its current table, filled
+// from every entry in either table. Returns 0, or -1 if no memory is
+// available, which leaves the old filter in place.
+static int rebuild_filter(gradebook_t *book, double fp_rate) {
+    filter_t filter;
+    unsigned max_names = (unsigned long long) book->table.capacity * MAX_LOAD_NUM / MAX_LOAD_DEN;
+    if (alloc_filter(&filter, max_names, fp_rate) != 0) {
+        return -1;
+    }
+    const table_t *tables[2] = {&book->table, &book->old};
+    for (unsigned t = 0; t < 2; t++) {
+        for (unsigned slot = 0; slot < tables[t]->capacity; slot++) {
+            if (slot_is_full(tables[t], slot)) {
+                filter_add(&filter, node_at(book, tables[t]->slots[slot])->hash);
+            }
+        }
+    }
+    free(book->filter.blocks);
+    book->filter = filter;
+    return 0;
+}
+
+// Move up to max_groups groups of the old table into the current one,
+// releasing the old table once it is drained
+static void migrate_groups(gradebook_t *book, unsigned max_groups) {
+    unsigned num_groups = book->old.capacity / GROUP_SIZE;
+    while (max_groups > 0 && book->migrate_pos < num_groups) {
+        unsigned first = book->migrate_pos * GROUP_SIZE;
+        for (unsigned slot = first; slot < first + GROUP_SIZE; slot++) {
+            if (slot_is_full(&book->old, slot)) {
+                uint32_t id = book->old.slots[slot];
+                insert_slot(&book->table, id, node_at(book, id)->hash);
+                book->old.ctrl[slot] = CTRL_MOVED;
+            }
+        }
+        book->migrate_pos++;
+        max_groups--;
+    }
+    if (book->migrate_pos == num_groups) {
+        release_table(&book->old);
+    }
+}
+
+// Start moving everything into a table twice the size. Any earlier
+// migration is finished first; with MIGRATE_GROUPS per operation that only
+// happens if the book was pre-sized far too small.
+static int start_growth(gradebook_t *book) {
+    if (book->old.capacity != 0) {
+        migrate_groups(book, book->old.capacity / GROUP_SIZE);
+    }
+    table_t bigger;
+    if (alloc_table(&bigger, book->table.capacity * 2) != 0) {
+        return -1;
+    }
+    book->old = book->table;
+    book->table = bigger;
+    book->migrate_pos = 0;
+    // If the filter cannot grow, the old one still answers correctly; it
+    // only lets more absent names through as it fills
+    if (book->filter.blocks != NULL) {
+        rebuild_filter(book, book->filter.fp_rate);
+    }
+    return 0;
+}
+
+// Look name up in both tables without changing either. Returns its node
+// id, or NO_NODE if not present.
+static uint32_t lookup_id(const gradebook_t *book, const char *name, size_t len,
+                          unsigned hash_val) {
+    if (book->filter.blocks != NULL && !filter_may_contain(&book->filter, hash_val)) {
+        return NO_NODE;
+    }
+    if (book->old.capacity != 0) {
+        long slot = find_slot(book, &book->old, name, len, hash_val);
+        if (slot >= 0) {
+            return book->old.slots[slot];
+        }
+    }
+    long slot = find_slot(book, &book->table, name, len, hash_val);
+    if (slot < 0) {
+        return NO_NODE;
+    }
+    return book->table.slots[slot];
+}
+
+// As lookup_id, but returns the node itself, or NULL
+static node_t *lookup(const gradebook_t *book, const char *name, size_t len, unsigned hash_val) {
+    uint32_t id = lookup_id(book, name, len, hash_val);
+    return id == NO_NODE ? NULL : node_at(book, id);
+}
+
+// Pull the home group of hash_val and its slot ids toward the cache
+static void prefetch_group(const table_t *table, unsigned hash_val) {
+    if (table->capacity != 0) {
+        unsigned slot = home_group(hash_val, table->capacity) * GROUP_SIZE;
+        __builtin_prefetch(table->ctrl + slot);
+        __builtin_prefetch(table->slots + slot);
+    }
+}
+
+// Prefetch the node behind the first fingerprint match in the home group,
+// or its name once the node itself is cached (want_name)
+static void prefetch_candidate(const gradebook_t *book, const table_t *table, unsigned hash_val,
+                               int want_name) {
+    if (table->capacity == 0) {
+        return;
+    }
+    unsigned group = home_group(hash_val, table->capacity);
+    unsigned match = group_match(table->ctrl + group * GROUP_SIZE, fingerprint(hash_val));
+    if (match != 0) {
+        const node_t *node = node_at(book, table->slots[group * GROUP_SIZE + __builtin_ctz(match)]);
+        if (want_name) {
+            __builtin_prefetch(name_at(book, node->name_off));
+        } else {
+            __builtin_prefetch(node);
+        }
+    }
+}
+
+// Batch calls run a software pipeline. While name i is resolved, the
+// candidate name of i + BATCH_DISTANCE / 2 and the candidate node of
+// i + BATCH_DISTANCE are prefetched, name i + 2 * BATCH_DISTANCE is hashed
+// and its home groups prefetched, and the string of i + 3 * BATCH_DISTANCE
+// is pulled in, so several misses of each kind are always in flight.
+#define BATCH_RING (4 * BATCH_DISTANCE)
+
+typedef struct {
+    size_t lens[BATCH_RING];     // Name lengths, by index % BATCH_RING
+    unsigned hashes[BATCH_RING]; // Name hashes, likewise
+} batch_t;
+
+// Run every pipeline stage but resolving for step i, which starts at
+// -3 * BATCH_DISTANCE so the stages fill before the first name resolves
+static void batch_prefetch(const gradebook_t *book, const char *const *names, unsigned n,
+                           long i, batch_t *batch) {
+    long ahead = i + 3 * BATCH_DISTANCE;
+    if (ahead < n) {
+        __builtin_prefetch(names[ahead]);
+    }
+    ahead = i + 2 * BATCH_DISTANCE;
+    if (ahead >= 0 && ahead < n) {
+        unsigned r = ahead % BATCH_RING;
+        batch->lens[r] = name_length(names[ahead]);
+        batch->hashes[r] = book_hash(book, names[ahead], batch->lens[r]);
+        prefetch_group(&book->table, batch->hashes[r]);
+        prefetch_group(&book->old, batch->hashes[r]);
+        if (book->filter.blocks != NULL) {
+            __builtin_prefetch(filter_block(&book->filter, filter_mix(batch->hashes[r])));
+        }
+    }
+    ahead = i + BATCH_DISTANCE;
+    if (ahead >= 0 && ahead < n) {
+        prefetch_candidate(book, &book->table, batch->hashes[ahead % BATCH_RING], 0);
+    }
+    ahead = i + BATCH_DISTANCE / 2;
+    if (ahead >= 0 && ahead < n) {
+        prefetch_candidate(book, &book->table, batch->hashes[ahead % BATCH_RING], 1);
+    }
+}
+
+// Index entry for node id, whose name is len bytes long
+static index_entry_t index_entry(const char *name, size_t len, uint32_t id) {
+    index_entry_t entry = {{0, 0}, id};
+    for (size_t i = 0; i < 8; i++) {
+        uint32_t byte = i < len ? (uint8_t) name[i] : 0;
+        entry.key[i / 4] |= byte << (24 - 8 * (i % 4));
+    }
+    return entry;
+}
+
+// Whether a's name sorts before b's, as strcmp would order them. The
+// names are only compared when both share their first eight bytes.
+static int entry_before(const gradebook_t *book, const index_entry_t *a,
+                        const index_entry_t *b) {
+    uint64_t key_a = (uint64_t) a->key[0] << 32 | a->key[1];
+    uint64_t key_b = (uint64_t) b->key[0] << 32 | b->key[1];
+    if (key_a != key_b) {
+        return key_a < key_b;
+    }
+    const node_t *x = node_at(book, a->id);
+    const node_t *y = node_at(book, b->id);
+    size_t len = x->name_len < y->name_len ? x->name_len : y->name_len;
+    int cmp = memcmp(name_at(book, x->name_off), name_at(book, y->name_off), len);
+    return cmp != 0 ? cmp < 0 : x->name_len < y->name_len;
+}
+
+// Merge sort entries by name, using scratch (room for n / 2) as a buffer
+static void merge_sort_entries(const gradebook_t *book, index_entry_t *entries, unsigned n,
+                               index_entry_t *scratch) {
+    if (n < 2) {
+        return;
+    }
+    unsigned half = n / 2;
+    merge_sort_entries(book, entries, half, scratch);
+    merge_sort_entries(book, entries + half, n - half, scratch);
+    memcpy(scratch, entries, half * sizeof(index_entry_t));
+    unsigned i = 0, j = half, k = 0;
+    // Both merges step without branching on the comparison, which is a
+    // coin flip for random names
+    while (i < half && j < n) {
+        int take_right = entry_before(book, &entries[j], &scratch[i]);
+        entries[k++] = take_right ? entries[j] : scratch[i];
+        j += take_right;
+        i += !take_right;
+    }
+    while (i < half) {
+        entries[k++] = scratch[i++];
+    }
+}
+
+// Sort entries by name, using scratch (room for n) as a buffer. A least
+// significant byte first radix sort orders the keys, skipping bytes that
+// every key shares; runs of equal keys, from names sharing their first
+// eight bytes, are then merge sorted on the full names.
+static void sort_entries(const gradebook_t *book, index_entry_t *entries, unsigned n,
+                         index_entry_t *scratch) {
+    if (n < 2) {
+        return;
+    }
+    index_entry_t *from = entries, *to = scratch;
+    for (int byte = 7; byte >= 0; byte--) {
+        int word = byte / 4, shift = 24 - 8 * (byte % 4);
+        unsigned counts[256] = {0};
+        for (unsigned i = 0; i < n; i++) {
+            counts[(from[i].key[word] >> shift) & 0xff]++;
+        }
+        if (counts[(from[0].key[word] >> shift) & 0xff] == n) {
+            continue;
+        }
+        unsigned pos = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            unsigned count = counts[digit];
+            counts[digit] = pos;
+            pos += count;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            to[counts[(from[i].key[word] >> shift) & 0xff]++] = from[i];
+        }
+        index_entry_t *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != entries) {
+        memcpy(entries, from, n * sizeof(index_entry_t));
+    }
+    for (unsigned start = 0, end; start < n; start = end) {
+        for (end = start + 1; end < n && entries[end].key[0] == entries[start].key[0] &&
+                              entries[end].key[1] == entries[start].key[1]; end++) {
+        }
+        merge_sort_entries(book, entries + start, end - start, scratch);
+    }
+}
+
+// Merge the sorted entries of pending into run, which has room for both,
+// back to front so nothing in run is overwritten before it is moved
+static void merge_sorted(const gradebook_t *book, index_entry_t *run, unsigned run_len,
+                         const index_entry_t *pending, unsigned pending_len) {
+    unsigned i = run_len, j = pending_len, k = run_len + pending_len;
+    while (i > 0 && j > 0) {
+        int take_run = entry_before(book, &pending[j - 1], &run[i - 1]);
+        run[--k] = take_run ? run[i - 1] : pending[j - 1];
+        i -= take_run;
+        j -= !take_run;
+    }
+    memcpy(run, pending, j * sizeof(index_entry_t));
+}
+
+// Keep buf for the book's snapshot to free, now that the book has
+// replaced it. snapshot_gradebook made room for every buffer it shares.
+static void retire(gradebook_snapshot_t *snapshot, void *buf) {
+    snapshot->retired[snapshot->num_retired++] = buf;
+}
+
+// Give the book its own copy of any index array its snapshot still
+// reads, before the book changes it. Returns 0, or -1 if no memory is
+// available.
+static int unshare_index(gradebook_t *book) {
+    gradebook_snapshot_t *snapshot = book->snapshot;
+    name_index_t *order = &book->order;
+    if (order->run != NULL && order->run == snapshot->shared_run) {
+        index_entry_t *run = malloc(order->run_cap * sizeof(index_entry_t));
+        if (run == NULL) {
+            return -1;
+        }
+        memcpy(run, order->run, order->run_len * sizeof(index_entry_t));
+        retire(snapshot, order->run);
+        order->run = run;
+    }
+    if (order->pending != NULL && order->pending == snapshot->shared_pending) {
+        index_entry_t *pending = malloc(order->pending_cap * sizeof(index_entry_t));
+        if (pending == NULL) {
+            return -1;
+        }
+        memcpy(pending, order->pending, order->pending_len * sizeof(index_entry_t));
+        retire(snapshot, order->pending);
+        order->pending = pending;
+    }
+    return 0;
+}
+
+// Give the book its own copy of a slab its snapshot still reads, before
+// the book changes a node in it. Returns 0, or -1 if no memory is
+// available.
+static int unshare_slab(gradebook_t *book, unsigned slab) {
+    gradebook_snapshot_t *snapshot = book->snapshot;
+    if (slab >= snapshot->view.nodes.num_slabs ||
+        book->nodes.slabs[slab] != snapshot->view.nodes.slabs[slab]) {
+        return 0;
+    }
+    node_t *copy = malloc(SLAB_NODES * sizeof(node_t));
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, book->nodes.slabs[slab], SLAB_NODES * sizeof(node_t));
+    retire(snapshot, book->nodes.slabs[slab]);
+    book->nodes.slabs[slab] = copy;
+    return 0;
+}
+
+// Sort the merge buffer and merge it into the run, back to front so the
+// run can be merged in place. Returns 0, or -1 if no memory is available.
+static int merge_pending(gradebook_t *book) {
+    name_index_t *order = &book->order;
+    if (order->pending_len == 0) {
+        return 0;
+    }
+    if (book->snapshot != NULL && unshare_index(book) != 0) {
+        return -1;
+    }
+    unsigned total = order->run_len + order->pending_len;
+    if (total > order->run_cap) {
+        unsigned run_cap = order->run_cap < MIN_PENDING ? MIN_PENDING : order->run_cap;
+        while (run_cap < total) {
+            run_cap *= 2;
+        }
+        index_entry_t *run = realloc(order->run, run_cap * sizeof(index_entry_t));
+        if (run == NULL) {
+            return -1;
+        }
+        order->run = run;
+        order->run_cap = run_cap;
+    }
+    index_entry_t *scratch = malloc(order->pending_len * sizeof(index_entry_t));
+    if (scratch == NULL) {
+        return -1;
+    }
+    sort_entries(book, order->pending, order->pending_len, scratch);
+    free(scratch);
+    merge_sorted(book, order->run, order->run_len, order->pending, order->pending_len);
+    order->run_len = total;
+    order->pending_len = 0;
+    return 0;
+}
+
+// Make room for one more id in the merge buffer, merging it first once it
+// has reached its limit. Returns 0, or -1 if no memory is available.
+static int reserve_pending(gradebook_t *book) {
+    name_index_t *order = &book->order;
+    unsigned limit = order->run_len > MIN_PENDING ? order->run_len : MIN_PENDING;
+    if (order->pending_len >= limit && merge_pending(book) != 0) {
+        return -1;
+    }
+    if (order->pending_len == order->pending_cap) {
+        if (book->snapshot != NULL && unshare_index(book) != 0) {
+            return -1;
+        }
+        unsigned pending_cap = order->pending_cap == 0 ? MIN_PENDING : order->pending_cap * 2;
+        index_entry_t *pending = realloc(order->pending, pending_cap * sizeof(index_entry_t));
+        if (pending == NULL) {
+            return -1;
+        }
+        order->pending = pending;
+        order->pending_cap = pending_cap;
+    }
+    return 0;
+}
+
+// Smallest table that holds capacity entries below the load limit
+static unsigned table_capacity_for(unsigned capacity) {
+    unsigned slots = INITIAL_CAPACITY;
+    while ((unsigned long long) slots * MAX_LOAD_NUM < (unsigned long long) capacity * MAX_LOAD_DEN) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+gradebook_t* create_gradebook(const char* class_name, unsigned capacity) {
     gradebook_t* book = malloc(sizeof(gradebook_t));
     if (book == NULL) {
         return NULL;
     }
-    // initialize the gradebook
-    for (int i = 0; i < NUM_BUCKETS; i++) {
-        book->buckets[i] = NULL;
+    // initialize the gradebook
+    if (alloc_table(&book->table, table_capacity_for(capacity)) != 0) {
+        free(book);
+        return NULL;
+    }
+    book->old.ctrl = NULL;
+    book->old.slots = NULL;
+    book->old.capacity = 0;
+    book->migrate_pos = 0;
+    memset(&book->nodes, 0, sizeof(node_pool_t));
+    book->nodes.free_head = NO_NODE;
+    memset(&book->names, 0, sizeof(name_pool_t));
+    memset(&book->order, 0, sizeof(name_index_t));
+    book->mapping = NULL;
+    book->mapping_len = 0;
+    book->size = 0;
+    book->hash_kind = HASH_WY;
+    memset(&book->stats, 0, sizeof(score_stats_t));
+    book->stats.valid = 1;
+    book->stats.min = INT_MAX;
+    book->stats.max = INT_MIN;
+    memset(&book->by_score, 0, sizeof(score_index_t));
+    book->snapshot = NULL;
+    memset(&book->lazy, 0, sizeof(lazy_text_t));
+    memset(&book->filter, 0, sizeof(filter_t));
+    // strcpy book->class_name
+    strcpy(book->class_name, class_name);
+    return book;
+}
+
+const char* get_gradebook_name(const gradebook_t* book) {
+    return book->class_name;
+}
+
+int set_gradebook_hash(gradebook_t *book, hash_kind_t kind) {
+    if (book == NULL || book->size != 0 || book->lazy.data != NULL || kind < 0 ||
+        kind >= HASH_KINDS) {
+        return -1;
+    }
+    book->hash_kind = kind;
+    return 0;
+}
+
+int set_gradebook_filter(gradebook_t *book, double fp_rate) {
+    if (book == NULL || !(fp_rate >= 0 && fp_rate < 1)) {
+        return -1;
+    }
+    if (fp_rate == 0) {
+        free(book->filter.blocks);
+        memset(&book->filter, 0, sizeof(filter_t));
+        return 0;
+    }
+    if (book->lazy.data != NULL) {
+        // Lookups search the file until it is loaded; load_lazy builds it
+        free(book->filter.blocks);
+        memset(&book->filter, 0, sizeof(filter_t));
+        book->filter.fp_rate = fp_rate;
+        return 0;
+    }
+    return rebuild_filter(book, fp_rate);
+}
+
+void gradebook_filter_stats(const gradebook_t *book, filter_stats_t *stats) {
+    memset(stats, 0, sizeof(filter_stats_t));
+    const filter_t *filter = &book->filter;
+    if (filter->blocks == NULL) {
+        return;
+    }
+    stats->bytes = (size_t) filter->num_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    stats->num_hashes = filter->num_hashes;
+    stats->bits_per_name = book->size == 0 ? 0 : stats->bytes * 8.0 / book->size;
+    // An absent name lands in a block at random and gets through if all
+    // of its bits there are set
+    double sum = 0;
+    for (unsigned b = 0; b < filter->num_blocks; b++) {
+        unsigned set = 0;
+        for (unsigned w = 0; w < FILTER_BLOCK_WORDS; w++) {
+            set += __builtin_popcountll(filter->blocks[b * FILTER_BLOCK_WORDS + w]);
+        }
+        double pass = 1;
+        for (unsigned i = 0; i < filter->num_hashes; i++) {
+            pass *= (double) set / FILTER_BLOCK_BITS;
+        }
+        sum += pass;
+    }
+    stats->fp_rate = sum / filter->num_blocks;
+}
+
+// Defined with the text reader below
+static int load_lazy(gradebook_t *book);
+static int lazy_find(const lazy_text_t *lazy, const char *name, size_t len);
+
+// Load a book opened by read_gradebook_from_text_lazy, if it is still
+// only a file. Returns 0, or -1 if it could not be loaded.
+static int ensure_loaded(gradebook_t *book) {
+    return book->lazy.data == NULL ? 0 : load_lazy(book);
+}
+
+// Copy a book loaded by read_gradebook_from_bin out of its mapping so it
+// can be modified, then drop the mapping
+static int materialize(gradebook_t *book) {
+    gradebook_t copy = *book;
+    uint32_t num_nodes = book->nodes.num_slabs == 0 ? 0 :
+        (book->nodes.num_slabs - 1) * SLAB_NODES + book->nodes.used;
+    memset(&copy.nodes, 0, sizeof(node_pool_t));
+    copy.nodes.free_head = NO_NODE;
+    memset(&copy.names, 0, sizeof(name_pool_t));
+    if (alloc_table(&copy.table, book->table.capacity) != 0) {
+        return -1;
+    }
+    memcpy(copy.table.ctrl, book->table.ctrl, book->table.capacity);
+    memcpy(copy.table.slots, book->table.slots, book->table.capacity * sizeof(uint32_t));
+    for (uint32_t id = 0; id < num_nodes; id++) {
+        if (alloc_node(&copy.nodes) == NO_NODE) {
+            goto fail;
+        }
+    }
+    for (unsigned i = 0; i < copy.nodes.num_slabs; i++) {
+        unsigned count = i + 1 < copy.nodes.num_slabs ? SLAB_NODES : copy.nodes.used;
+        memcpy(copy.nodes.slabs[i], book->nodes.slabs[i], count * sizeof(node_t));
+    }
+    copy.names.chunks = malloc(book->names.num_chunks * sizeof(char *));
+    if (book->names.num_chunks > 0 && copy.names.chunks == NULL) {
+        goto fail;
+    }
+    copy.names.max_chunks = book->names.num_chunks;
+    for (unsigned i = 0; i < book->names.num_chunks; i++) {
+        unsigned bytes = i + 1 < book->names.num_chunks ? NAME_CHUNK_SIZE : book->names.used;
+        char *chunk = malloc(NAME_CHUNK_SIZE);
+        if (chunk == NULL) {
+            goto fail;
+        }
+        memcpy(chunk, book->names.chunks[i], bytes);
+        copy.names.chunks[copy.names.num_chunks++] = chunk;
+    }
+    copy.names.used = book->names.used;
+    copy.order.run = malloc(book->order.run_len * sizeof(index_entry_t));
+    if (book->order.run_len > 0 && copy.order.run == NULL) {
+        goto fail;
+    }
+    memcpy(copy.order.run, book->order.run, book->order.run_len * sizeof(index_entry_t));
+    copy.order.run_cap = book->order.run_len;
+    if (book->snapshot != NULL) {
+        // The snapshot still reads the mapped nodes, names and run
+        book->snapshot->retired_mapping = book->mapping;
+        book->snapshot->retired_mapping_len = book->mapping_len;
+    } else {
+        munmap(book->mapping, book->mapping_len);
+    }
+    free(book->nodes.slabs);
+    free(book->names.chunks);
+    copy.mapping = NULL;
+    copy.mapping_len = 0;
+    *book = copy;
+    return 0;
+
+fail:
+    release_table(&copy.table);
+    free_node_pool(&copy.nodes);
+    free_name_pool(&copy.names);
+    if (copy.order.run != book->order.run) {
+        free(copy.order.run);
+    }
+    return -1;
+}
+
+// Histogram bucket of score: the positive half starts at
+// STATS_HALF_GROUPS groups in, and score < 0 is bucketed by ~score
+// mirrored below it
+static unsigned stats_bucket(int score) {
+    unsigned magnitude = score < 0 ? ~(unsigned) score : (unsigned) score;
+    unsigned index = magnitude;
+    if (magnitude >= 2 * STATS_SUB) {
+        unsigned shift = 31 - __builtin_clz(magnitude) - STATS_SUB_BITS;
+        index = shift * STATS_SUB + (magnitude >> shift);
+    }
+    unsigned half = STATS_HALF_GROUPS * STATS_SUB;
+    return score < 0 ? half - 1 - index : half + index;
+}
+
+// Lowest score that falls in bucket; width is set to how many scores do
+static int bucket_low(unsigned bucket, unsigned *width) {
+    unsigned half = STATS_HALF_GROUPS * STATS_SUB;
+    unsigned index = bucket >= half ? bucket - half : half - 1 - bucket;
+    unsigned low = index;
+    *width = 1;
+    if (index >= 2 * STATS_SUB) {
+        unsigned shift = index / STATS_SUB - 1;
+        low = (index - shift * STATS_SUB) << shift;
+        *width = 1u << shift;
+    }
+    return bucket >= half ? (int) low : (int) ~(low + *width - 1);
+}
+
+// Add delta to score's bucket. Returns 0, or -1 if its group could not
+// be allocated.
+static int stats_count(score_stats_t *stats, int score, int delta) {
+    unsigned bucket = stats_bucket(score);
+    unsigned group = bucket / STATS_SUB;
+    if (stats->groups[group] == NULL) {
+        stats->groups[group] = calloc(STATS_SUB, sizeof(unsigned));
+        if (stats->groups[group] == NULL) {
+            return -1;
+        }
+    }
+    stats->groups[group][bucket % STATS_SUB] += delta;
+    stats->group_counts[group] += delta;
+    return 0;
+}
+
+// First nonempty bucket from bucket on, stepping by dir (1 or -1), or -1
+static long next_bucket(const score_stats_t *stats, long bucket, int dir) {
+    while (bucket >= 0 && bucket < STATS_GROUPS * STATS_SUB) {
+        unsigned group = bucket / STATS_SUB;
+        if (stats->group_counts[group] == 0) {
+            bucket = dir > 0 ? (long) (group + 1) * STATS_SUB : (long) group * STATS_SUB - 1;
+        } else if (stats->groups[group][bucket % STATS_SUB] != 0) {
+            return bucket;
+        } else {
+            bucket += dir;
+        }
+    }
+    return -1;
+}
+
+static void stats_insert(score_stats_t *stats, int score) {
+    if (stats_count(stats, score, 1) != 0) {
+        stats->valid = 0;
+        return;
+    }
+    stats->sum += score;
+    if (score <= stats->min) {
+        stats->min_count = score == stats->min ? stats->min_count + 1 : 1;
+        stats->min = score;
+    }
+    if (score >= stats->max) {
+        stats->max_count = score == stats->max ? stats->max_count + 1 : 1;
+        stats->max = score;
+    }
+}
+
+// Take score out of the aggregates. Once the last min or max goes, the
+// next nonempty bucket only pins down the new one if it is one score wide.
+static void stats_remove(score_stats_t *stats, int score) {
+    stats_count(stats, score, -1);
+    stats->sum -= score;
+    int *extremes[] = {&stats->min, &stats->max};
+    unsigned *counts[] = {&stats->min_count, &stats->max_count};
+    int empty[] = {INT_MAX, INT_MIN};
+    for (int i = 0; i < 2; i++) {
+        if (score != *extremes[i] || --*counts[i] > 0) {
+            continue;
+        }
+        long bucket = next_bucket(stats, stats_bucket(score), i == 0 ? 1 : -1);
+        unsigned width = 1;
+        if (bucket < 0) {
+            *extremes[i] = empty[i];
+        } else {
+            *extremes[i] = bucket_low(bucket, &width);
+            *counts[i] = stats->groups[bucket / STATS_SUB][bucket % STATS_SUB];
+        }
+        stats->valid = stats->valid && width == 1;
+    }
+}
+
+// Whether node id with score ranks above entry: a higher score, or the
+// same score and an earlier name
+static int ranks_above(const gradebook_t *book, uint32_t id, int score, const top_entry_t *entry) {
+    if (score != entry->score) {
+        return score > entry->score;
+    }
+    return strcmp(name_at(book, node_at(book, id)->name_off),
+                  name_at(book, node_at(book, entry->id)->name_off)) < 0;
+}
+
+// Rank id among the top entries, pushing out the lowest if they are full
+static void top_insert(gradebook_t *book, uint32_t id, int score) {
+    score_stats_t *stats = &book->stats;
+    unsigned lo = 0, hi = stats->top_len;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (ranks_above(book, id, score, &stats->top[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if (lo == STATS_TOP_K) {
+        return;
+    }
+    unsigned len = stats->top_len < STATS_TOP_K ? stats->top_len : STATS_TOP_K - 1;
+    memmove(&stats->top[lo + 1], &stats->top[lo], (len - lo) * sizeof(top_entry_t));
+    stats->top[lo].score = score;
+    stats->top[lo].id = id;
+    stats->top_len = len + 1;
+}
+
+// Consider id, which is not among the top entries, for them. outside
+// counts the other entries not in top, all of which rank below it.
+static void top_offer(gradebook_t *book, uint32_t id, int score, unsigned outside) {
+    score_stats_t *stats = &book->stats;
+    if ((stats->top_len < STATS_TOP_K && outside == 0) ||
+        (stats->top_len > 0 && ranks_above(book, id, score, &stats->top[stats->top_len - 1]))) {
+        top_insert(book, id, score);
+    }
+}
+
+// Re-rank id after its score changed from old_score
+static void top_update(gradebook_t *book, uint32_t id, int old_score, int score) {
+    score_stats_t *stats = &book->stats;
+    unsigned pos = stats->top_len;
+    // Members rank at or above the last one, so a lower score was not one
+    if (stats->top_len > 0 && old_score >= stats->top[stats->top_len - 1].score) {
+        for (pos = 0; pos < stats->top_len && stats->top[pos].id != id; pos++) {
+        }
+    }
+    unsigned outside = book->size - stats->top_len;
+    if (pos == stats->top_len) {
+        top_offer(book, id, score, outside - 1);
+        return;
+    }
+    stats->top_len--;
+    memmove(&stats->top[pos], &stats->top[pos + 1], (stats->top_len - pos) * sizeof(top_entry_t));
+    // A lower score may now rank below entries outside, unless it still
+    // ranks above a remaining member; if not, top stays one short
+    if (score > old_score || outside == 0 ||
+        (stats->top_len > 0 && ranks_above(book, id, score, &stats->top[stats->top_len - 1]))) {
+        top_insert(book, id, score);
+    }
+}
+
+// Recompute the aggregates from every node. Returns 0, or -1 if a bucket
+// group could not be allocated.
+static int rebuild_stats(gradebook_t *book) {
+    score_stats_t *stats = &book->stats;
+    for (unsigned group = 0; group < STATS_GROUPS; group++) {
+        if (stats->groups[group] != NULL) {
+            memset(stats->groups[group], 0, STATS_SUB * sizeof(unsigned));
+        }
+        stats->group_counts[group] = 0;
+    }
+    stats->valid = 1;
+    stats->sum = 0;
+    stats->min = INT_MAX;
+    stats->max = INT_MIN;
+    stats->min_count = 0;
+    stats->max_count = 0;
+    stats->top_len = 0;
+    unsigned seen = 0;
+    const table_t *tables[] = {&book->old, &book->table};
+    for (int t = 0; t < 2; t++) {
+        for (unsigned i = 0; i < tables[t]->capacity; i++) {
+            if (!slot_is_full(tables[t], i)) {
+                continue;
+            }
+            uint32_t id = tables[t]->slots[i];
+            int score = node_at(book, id)->score;
+            stats_insert(stats, score);
+            if (!stats->valid) {
+                return -1;
+            }
+            top_offer(book, id, score, seen - stats->top_len);
+            seen++;
+        }
+    }
+    return 0;
+}
+
+static void free_stats(score_stats_t *stats) {
+    for (unsigned group = 0; group < STATS_GROUPS; group++) {
+        free(stats->groups[group]);
+    }
+}
+
+// Whether a sorts before b in the score index
+static int score_before(const gradebook_t *book, const score_entry_t *a, const score_entry_t *b) {
+    if (a->score != b->score) {
+        return a->score < b->score;
+    }
+    return entry_before(book, &a->entry, &b->entry);
+}
+
+static score_node_t *alloc_score_node(gradebook_t *book, int leaf) {
+    score_node_t *node = malloc(sizeof(score_node_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->len = 0;
+    node->count = 0;
+    node->leaf = leaf;
+    node->prev = NULL;
+    node->next = NULL;
+    book->by_score.num_nodes++;
+    return node;
+}
+
+static void free_score_node(gradebook_t *book, score_node_t *node) {
+    if (!node->leaf) {
+        for (unsigned i = 0; i < node->len; i++) {
+            free_score_node(book, node->inner.children[i]);
+        }
+    }
+    free(node);
+    book->by_score.num_nodes--;
+}
+
+static void drop_score_index(gradebook_t *book) {
+    if (book->by_score.root != NULL) {
+        free_score_node(book, book->by_score.root);
+        book->by_score.root = NULL;
+    }
+}
+
+// Lowest entry that can be in node
+static const score_entry_t *score_node_low(const score_node_t *node) {
+    return node->leaf ? &node->entries[0] : &node->inner.low[0];
+}
+
+// Child of inner node whose range holds entry: the last one whose low
+// bound is not above it
+static unsigned score_child(const gradebook_t *book, const score_node_t *node,
+                            const score_entry_t *entry) {
+    unsigned lo = 1, hi = node->len;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (score_before(book, entry, &node->inner.low[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo - 1;
+}
+
+// Move the upper half of parent's full child i into a new node after it.
+// Returns 0, or -1 if no memory is available.
+static int split_score_child(gradebook_t *book, score_node_t *parent, unsigned i) {
+    score_node_t *child = parent->inner.children[i];
+    score_node_t *sibling = alloc_score_node(book, child->leaf);
+    if (sibling == NULL) {
+        return -1;
+    }
+    unsigned half = SCORE_NODE_SIZE / 2;
+    sibling->len = SCORE_NODE_SIZE - half;
+    if (child->leaf) {
+        memcpy(sibling->entries, child->entries + half, sibling->len * sizeof(score_entry_t));
+        sibling->count = sibling->len;
+        sibling->prev = child;
+        sibling->next = child->next;
+        if (child->next != NULL) {
+            child->next->prev = sibling;
+        }
+        child->next = sibling;
+    } else {
+        memcpy(sibling->inner.low, child->inner.low + half, sibling->len * sizeof(score_entry_t));
+        memcpy(sibling->inner.children, child->inner.children + half,
+               sibling->len * sizeof(score_node_t *));
+        for (unsigned j = 0; j < sibling->len; j++) {
+            sibling->count += sibling->inner.children[j]->count;
+        }
+    }
+    child->len = half;
+    child->count -= sibling->count;
+    memmove(parent->inner.low + i + 2, parent->inner.low + i + 1,
+            (parent->len - i - 1) * sizeof(score_entry_t));
+    memmove(parent->inner.children + i + 2, parent->inner.children + i + 1,
+            (parent->len - i - 1) * sizeof(score_node_t *));
+    parent->inner.low[i + 1] = *score_node_low(sibling);
+    parent->inner.children[i + 1] = sibling;
+    parent->len++;
+    return 0;
+}
+
+// Add entry to the score index, splitting full nodes on the way down so
+// the leaf always has room. Returns 0, or -1 if no memory is available,
+// which leaves the counts on the path wrong.
+static int score_index_insert(gradebook_t *book, const score_entry_t *entry) {
+    score_node_t *node = book->by_score.root;
+    if (node->len == SCORE_NODE_SIZE) {
+        score_node_t *root = alloc_score_node(book, 0);
+        if (root == NULL) {
+            return -1;
+        }
+        root->len = 1;
+        root->count = node->count;
+        root->inner.low[0] = *score_node_low(node);
+        root->inner.children[0] = node;
+        book->by_score.root = root;
+        node = root;
+        if (split_score_child(book, root, 0) != 0) {
+            return -1;
+        }
+    }
+    while (!node->leaf) {
+        unsigned i = score_child(book, node, entry);
+        if (node->inner.children[i]->len == SCORE_NODE_SIZE) {
+            if (split_score_child(book, node, i) != 0) {
+                return -1;
+            }
+            i += !score_before(book, entry, &node->inner.low[i + 1]);
+        }
+        node->count++;
+        node = node->inner.children[i];
+    }
+    unsigned pos = 0;
+    while (pos < node->len && score_before(book, &node->entries[pos], entry)) {
+        pos++;
+    }
+    memmove(node->entries + pos + 1, node->entries + pos, (node->len - pos) * sizeof(score_entry_t));
+    node->entries[pos] = *entry;
+    node->len++;
+    node->count++;
+    return 0;
+}
+
+// Take entry, which must be present, out of the score index. An emptied
+// leaf is unlinked, as is any inner node left without children, and a
+// root with a single child is replaced by it.
+static void score_index_remove(gradebook_t *book, const score_entry_t *entry) {
+    score_node_t *path[32];
+    unsigned slots[32];
+    unsigned depth = 0;
+    score_node_t *node = book->by_score.root;
+    while (!node->leaf) {
+        unsigned i = score_child(book, node, entry);
+        node->count--;
+        path[depth] = node;
+        slots[depth++] = i;
+        node = node->inner.children[i];
+    }
+    unsigned pos = 0;
+    while (node->entries[pos].entry.id != entry->entry.id) {
+        pos++;
+    }
+    node->len--;
+    node->count--;
+    memmove(node->entries + pos, node->entries + pos + 1, (node->len - pos) * sizeof(score_entry_t));
+    if (node->len == 0 && depth > 0) {
+        if (node->prev != NULL) {
+            node->prev->next = node->next;
+        }
+        if (node->next != NULL) {
+            node->next->prev = node->prev;
+        }
+    }
+    while (node->len == 0 && depth > 0) {
+        free(node);
+        book->by_score.num_nodes--;
+        node = path[--depth];
+        unsigned i = slots[depth];
+        node->len--;
+        memmove(node->inner.low + i, node->inner.low + i + 1,
+                (node->len - i) * sizeof(score_entry_t));
+        memmove(node->inner.children + i, node->inner.children + i + 1,
+                (node->len - i) * sizeof(score_node_t *));
+    }
+    while (!book->by_score.root->leaf && book->by_score.root->len == 1) {
+        score_node_t *root = book->by_score.root;
+        book->by_score.root = root->inner.children[0];
+        free(root);
+        book->by_score.num_nodes--;
+    }
+}
+
+// Build the score index from scratch: sort every entry by name (the name
+// index already is), then stably by score, and pack the result into
+// nodes 3/4 full, leaving room for inserts. Returns 0, or -1 if no memory
+// is available.
+static int build_score_index(gradebook_t *book) {
+    if (merge_pending(book) != 0) {
+        return -1;
+    }
+    unsigned n = book->order.run_len;
+    unsigned fill = SCORE_NODE_SIZE * 3 / 4;
+    unsigned num_leaves = n == 0 ? 1 : (n + fill - 1) / fill;
+    score_entry_t *entries = malloc((n + 1) * sizeof(score_entry_t));
+    score_entry_t *scratch = malloc((n + 1) * sizeof(score_entry_t));
+    score_node_t **level = malloc(num_leaves * sizeof(score_node_t *));
+    unsigned level_len = 0;
+    int err = entries == NULL || scratch == NULL || level == NULL;
+    for (unsigned i = 0; !err && i < n; i++) {
+        entries[i].score = node_at(book, book->order.run[i].id)->score;
+        entries[i].entry = book->order.run[i];
+    }
+    // LSD radix sort on the score with its sign bit flipped, skipping
+    // bytes every score shares
+    score_entry_t *from = entries, *to = scratch;
+    for (int shift = 0; !err && n > 1 && shift < 32; shift += 8) {
+        unsigned counts[256] = {0};
+        for (unsigned i = 0; i < n; i++) {
+            counts[(((uint32_t) from[i].score ^ 0x80000000u) >> shift) & 0xff]++;
+        }
+        if (counts[(((uint32_t) from[0].score ^ 0x80000000u) >> shift) & 0xff] == n) {
+            continue;
+        }
+        unsigned pos = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            unsigned count = counts[digit];
+            counts[digit] = pos;
+            pos += count;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            to[counts[(((uint32_t) from[i].score ^ 0x80000000u) >> shift) & 0xff]++] = from[i];
+        }
+        score_entry_t *swap = from;
+        from = to;
+        to = swap;
+    }
+    for (unsigned i = 0; !err && i < num_leaves; i++) {
+        score_node_t *leaf = alloc_score_node(book, 1);
+        if (leaf == NULL) {
+            err = 1;
+            break;
+        }
+        leaf->len = i + 1 < num_leaves ? fill : n - i * fill;
+        leaf->count = leaf->len;
+        memcpy(leaf->entries, from + i * fill, leaf->len * sizeof(score_entry_t));
+        if (level_len > 0) {
+            leaf->prev = level[level_len - 1];
+            leaf->prev->next = leaf;
+        }
+        level[level_len++] = leaf;
+    }
+    // Each pass groups the level's nodes under new parents, in place
+    while (!err && level_len > 1) {
+        unsigned parents = (level_len + fill - 1) / fill;
+        for (unsigned p = 0; p < parents; p++) {
+            score_node_t *parent = alloc_score_node(book, 0);
+            if (parent == NULL) {
+                // Parents so far own their children; the rest are loose
+                for (unsigned q = 0; q < p; q++) {
+                    free_score_node(book, level[q]);
+                }
+                for (unsigned j = p * fill; j < level_len; j++) {
+                    free_score_node(book, level[j]);
+                }
+                level_len = 0;
+                err = 1;
+                break;
+            }
+            for (unsigned j = p * fill; j < level_len && j < (p + 1) * fill; j++) {
+                parent->inner.low[parent->len] = *score_node_low(level[j]);
+                parent->inner.children[parent->len++] = level[j];
+                parent->count += level[j]->count;
+            }
+            level[p] = parent;
+        }
+        level_len = err ? 0 : parents;
+    }
+    if (err) {
+        for (unsigned j = 0; j < level_len; j++) {
+            free_score_node(book, level[j]);
+        }
+    } else {
+        book->by_score.root = level[0];
+    }
+    free(entries);
+    free(scratch);
+    free(level);
+    return err ? -1 : 0;
+}
+
+// Move name's entry in the score index, if the index is built, from
+// old_score to its node's current score (a new name has no old_score).
+// Should that fail, the index is dropped.
+static void update_score_index(gradebook_t *book, const char *name, size_t len, uint32_t id,
+                               int is_new, int old_score) {
+    if (book->by_score.root == NULL) {
+        return;
+    }
+    score_entry_t entry = {old_score, index_entry(name, len, id)};
+    if (!is_new) {
+        score_index_remove(book, &entry);
+    }
+    entry.score = node_at(book, id)->score;
+    if (score_index_insert(book, &entry) != 0) {
+        drop_score_index(book);
+    }
+}
+
+// Change the score of node id, whose name is len bytes long, keeping the
+// aggregates and score index in step. Returns 0 or -1.
+static int set_score(gradebook_t *book, uint32_t id, const char *name, size_t len, int score) {
+    int old_score = node_at(book, id)->score;
+    if (score == old_score) {
+        return 0;
+    }
+    if (book->snapshot != NULL && unshare_slab(book, id / SLAB_NODES) != 0) {
+        return -1;
+    }
+    node_at(book, id)->score = score;
+    if (book->stats.valid) {
+        stats_remove(&book->stats, old_score);
+        stats_insert(&book->stats, score);
+        if (book->stats.valid) {
+            top_update(book, id, old_score, score);
+        }
+    }
+    update_score_index(book, name, len, id, 0, old_score);
+    return 0;
+}
+
+// Add name, already measured and hashed, which is not in the book.
+// Returns 0 or -1.
+static int insert_new(gradebook_t *book, const char *name, size_t len, unsigned hash_val,
+                      int score) {
+    if (reserve_pending(book) != 0) {
+        return -1;
+    }
+    uint32_t id = alloc_node(&book->nodes);
+    if (id == NO_NODE) {
+        return -1;
+    }
+    // The current table holds everything once migration finishes, so it
+    // alone must stay under the load limit
+    if ((unsigned long long) (book->size + 1) * MAX_LOAD_DEN >
+        (unsigned long long) book->table.capacity * MAX_LOAD_NUM) {
+        if (start_growth(book) != 0) {
+            release_node(&book->nodes, id);
+            return -1;
+        }
+    }
+    node_t* new_node = node_at(book, id);
+    if (store_name(&book->names, name, len, &new_node->name_off) != 0) {
+        release_node(&book->nodes, id);
+        return -1;
+    }
+    new_node->hash = hash_val;
+    new_node->name_len = len;
+    new_node->score = score;
+    insert_slot(&book->table, id, hash_val);
+    if (book->filter.blocks != NULL) {
+        filter_add(&book->filter, hash_val);
+    }
+    book->order.pending[book->order.pending_len++] = index_entry(name, len, id);
+    book->size++;
+    if (book->stats.valid) {
+        stats_insert(&book->stats, score);
+        top_offer(book, id, score, book->size - 1 - book->stats.top_len);
+    }
+    update_score_index(book, name, len, id, 1, 0);
+    return 0;
+}
+
+// Add or update name, already measured and hashed. Returns 0 or -1.
+static int add_hashed(gradebook_t *book, const char *name, size_t len, unsigned hash_val,
+                      int score) {
+    // Adds, not lookups, move the growing table along
+    if (book->old.capacity != 0) {
+        migrate_groups(book, MIGRATE_GROUPS);
+    }
+    uint32_t found = lookup_id(book, name, len, hash_val);
+    if (found != NO_NODE) {
+        return set_score(book, found, name, len, score);
+    }
+    return insert_new(book, name, len, hash_val, score);
+}
+
+int add_score(gradebook_t* book, const char* name, int score) {
+    if (book == NULL || name == NULL || ensure_loaded(book) != 0) {
+        return -1;
+    }
+    if (book->mapping != NULL && materialize(book) != 0) {
+        return -1;
+    }
+    size_t len = name_length(name);
+    return add_hashed(book, name, len, book_hash(book, name, len), score);
+}
+
+unsigned add_scores_batch(gradebook_t *book, const char *const *names, const int *scores,
+                          unsigned n) {
+    if (book == NULL || names == NULL || scores == NULL || ensure_loaded(book) != 0) {
+        return 0;
+    }
+    if (book->mapping != NULL && materialize(book) != 0) {
+        return 0;
+    }
+    batch_t batch;
+    for (long i = -3 * BATCH_DISTANCE; i < (long) n; i++) {
+        // An add that grows the table only makes the prefetches miss
+        batch_prefetch(book, names, n, i, &batch);
+        if (i >= 0 && add_hashed(book, names[i], batch.lens[i % BATCH_RING],
+                                 batch.hashes[i % BATCH_RING], scores[i]) != 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+
+int find_score(const gradebook_t* book, const char* name) {
+    if (book == NULL || name == NULL) {
+        return -1;
+    }
+    if (book->lazy.data != NULL) {
+        return lazy_find(&book->lazy, name, name_length(name));
+    }
+
+    size_t len = name_length(name);
+    node_t* found = lookup(book, name, len, book_hash(book, name, len));
+    if (found == NULL) {
+        return -1;
+    }
+    return found->score;
+}
+
+unsigned find_scores_batch(const gradebook_t *book, const char *const *names, int *scores,
+                           unsigned n) {
+    if (book == NULL || names == NULL || scores == NULL) {
+        return 0;
+    }
+    unsigned num_found = 0;
+    if (book->lazy.data != NULL) {
+        // Each search is a chain of dependent probes, so there is nothing
+        // to overlap
+        for (unsigned i = 0; i < n; i++) {
+            scores[i] = lazy_find(&book->lazy, names[i], name_length(names[i]));
+            num_found += scores[i] != -1;
+        }
+        return num_found;
+    }
+    batch_t batch;
+    for (long i = -3 * BATCH_DISTANCE; i < (long) n; i++) {
+        batch_prefetch(book, names, n, i, &batch);
+        if (i >= 0) {
+            node_t *found = lookup(book, names[i], batch.lens[i % BATCH_RING],
+                                   batch.hashes[i % BATCH_RING]);
+            scores[i] = found == NULL ? -1 : found->score;
+            num_found += found != NULL;
+        }
+    }
+    return num_found;
+}
+
+// Run work on each of num_args arguments, laid out arg_size bytes apart,
+// each on its own thread but the first, which runs on this one. An
+// argument whose thread cannot be started is worked on here too.
+static void run_threads(void *(*work)(void *), void *args, size_t arg_size, unsigned num_args) {
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS];
+    for (unsigned t = 1; t < num_args; t++) {
+        started[t] = pthread_create(&threads[t], NULL, work, (char *) args + t * arg_size) == 0;
+    }
+    work(args);
+    for (unsigned t = 1; t < num_args; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            work((char *) args + t * arg_size);
+        }
+    }
+}
+
+// Rehash every entry into a table of at least capacity slots at once,
+// rather than doubling a few groups at a time. Returns 0, or -1 if no
+// memory is available.
+static int resize_table(gradebook_t *book, unsigned capacity) {
+    if (book->old.capacity != 0) {
+        migrate_groups(book, book->old.capacity / GROUP_SIZE);
+    }
+    if (capacity <= book->table.capacity) {
+        return 0;
+    }
+    table_t bigger;
+    if (alloc_table(&bigger, capacity) != 0) {
+        return -1;
+    }
+    for (unsigned slot = 0; slot < book->table.capacity; slot++) {
+        if (slot_is_full(&book->table, slot)) {
+            uint32_t id = book->table.slots[slot];
+            insert_slot(&bigger, id, node_at(book, id)->hash);
+        }
+    }
+    release_table(&book->table);
+    book->table = bigger;
+    if (book->filter.blocks != NULL) {
+        rebuild_filter(book, book->filter.fp_rate);
+    }
+    return 0;
+}
+
+// A student of the source book in a merge, and where it is in the
+// destination
+typedef struct {
+    uint32_t src_id; // Node of the source book
+    uint32_t hash;   // Hash of the name under the destination's hash
+    int score;       // Source score, copied in case the books are one
+    uint32_t dst_id; // Node of the destination book, or NO_NODE
+} join_entry_t;
+
+// One probe thread's share of a merge: a run of whole partitions
+typedef struct {
+    const gradebook_t *dst;
+    const gradebook_t *src;
+    join_entry_t *entries;
+    unsigned num_entries;
+} join_probe_t;
+
+// Look each entry up in the destination. Nothing is migrating and
+// nothing is written but the entries, so probes can run side by side.
+static void *probe_entries(void *arg) {
+    join_probe_t *probe = arg;
+    for (unsigned i = 0; i < probe->num_entries; i++) {
+        join_entry_t *entry = &probe->entries[i];
+        const node_t *node = node_at(probe->src, entry->src_id);
+        if (probe->dst->filter.blocks != NULL &&
+            !filter_may_contain(&probe->dst->filter, entry->hash)) {
+            entry->dst_id = NO_NODE;
+            continue;
+        }
+        long slot = find_slot(probe->dst, &probe->dst->table, name_at(probe->src, node->name_off),
+                              node->name_len, entry->hash);
+        entry->dst_id = slot < 0 ? NO_NODE : probe->dst->table.slots[slot];
+    }
+    return NULL;
+}
+
+static int merged_score(merge_policy_t policy, int old_score, int score) {
+    if (policy == MERGE_MAX) {
+        return score > old_score ? score : old_score;
+    } else if (policy == MERGE_LATEST) {
+        return score;
+    }
+    long long sum = (long long) old_score + score;
+    return sum > INT_MAX ? INT_MAX : sum < INT_MIN ? INT_MIN : sum;
+}
+
+// The source's entries, split by the top bits of their home group in the
+// destination, so each partition's probes stay within one stretch of its
+// table. Returns them, or NULL if no memory is available.
+static join_entry_t *partition_entries(const gradebook_t *dst, const gradebook_t *src) {
+    join_entry_t *entries = malloc(src->size * sizeof(join_entry_t));
+    join_entry_t *sorted = malloc(src->size * sizeof(join_entry_t));
+    if (src->size > 0 && (entries == NULL || sorted == NULL)) {
+        free(entries);
+        free(sorted);
+        return NULL;
+    }
+    unsigned group_bits = __builtin_ctz(dst->table.capacity / GROUP_SIZE);
+    unsigned shift = group_bits > MERGE_PARTITION_BITS ? group_bits - MERGE_PARTITION_BITS : 0;
+    unsigned starts[(1 << MERGE_PARTITION_BITS) + 1] = {0};
+    unsigned n = 0;
+    const table_t *tables[] = {&src->old, &src->table};
+    for (int t = 0; t < 2; t++) {
+        for (unsigned i = 0; i < tables[t]->capacity; i++) {
+            if (!slot_is_full(tables[t], i)) {
+                continue;
+            }
+            uint32_t id = tables[t]->slots[i];
+            const node_t *node = node_at(src, id);
+            unsigned hash_val = src->hash_kind == dst->hash_kind ? node->hash :
+                book_hash(dst, name_at(src, node->name_off), node->name_len);
+            entries[n++] = (join_entry_t) {id, hash_val, node->score, NO_NODE};
+            starts[(home_group(hash_val, dst->table.capacity) >> shift) + 1]++;
+        }
+    }
+    for (unsigned p = 0; p < (1 << MERGE_PARTITION_BITS); p++) {
+        starts[p + 1] += starts[p];
+    }
+    for (unsigned i = 0; i < n; i++) {
+        sorted[starts[home_group(entries[i].hash, dst->table.capacity) >> shift]++] = entries[i];
+    }
+    free(entries);
+    return sorted;
+}
+
+long merge_gradebooks(gradebook_t *dst, gradebook_t *src, merge_policy_t policy) {
+    if (dst == NULL || src == NULL || policy < 0 || policy >= MERGE_POLICIES ||
+        ensure_loaded(dst) != 0 || ensure_loaded(src) != 0) {
+        return -1;
+    }
+    if (dst->mapping != NULL && materialize(dst) != 0) {
+        return -1;
+    }
+    // Sized so that no add during the merge grows the table
+    unsigned long long most = (unsigned long long) dst->size + (dst == src ? 0 : src->size);
+    if (most > UINT32_MAX / MAX_LOAD_DEN ||
+        resize_table(dst, table_capacity_for(most)) != 0) {
+        return -1;
+    }
+    // Finish any migration of the source too, so probes only read it
+    if (src->old.capacity != 0) {
+        migrate_groups(src, src->old.capacity / GROUP_SIZE);
+    }
+    unsigned n = src->size;
+    join_entry_t *entries = partition_entries(dst, src);
+    if (n > 0 && entries == NULL) {
+        return -1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned num_threads = n / MERGE_MIN_THREAD_ENTRIES + 1;
+    num_threads = cores > 0 && num_threads > cores ? cores : num_threads;
+    num_threads = num_threads < PARALLEL_MAX_THREADS ? num_threads : PARALLEL_MAX_THREADS;
+    join_probe_t probes[PARALLEL_MAX_THREADS];
+    for (unsigned t = 0; t < num_threads; t++) {
+        unsigned first = (unsigned long long) n * t / num_threads;
+        unsigned end = (unsigned long long) n * (t + 1) / num_threads;
+        probes[t] = (join_probe_t) {dst, src, entries + first, end - first};
+    }
+    run_threads(probe_entries, probes, sizeof(join_probe_t), num_threads);
+
+    long added = 0;
+    for (unsigned i = 0; i < n; i++) {
+        const join_entry_t *entry = &entries[i];
+        const node_t *node = node_at(src, entry->src_id);
+        const char *name = name_at(src, node->name_off);
+        int ok;
+        if (entry->dst_id != NO_NODE) {
+            int score = merged_score(policy, node_at(dst, entry->dst_id)->score, entry->score);
+            ok = set_score(dst, entry->dst_id, name, node->name_len, score) == 0;
+        } else {
+            ok = insert_new(dst, name, node->name_len, entry->hash, entry->score) == 0;
+            added += ok;
+        }
+        if (!ok) {
+            free(entries);
+            return -1;
+        }
+    }
+    free(entries);
+    return added;
+}
+
+// Calls visit on every entry in name order. Pending names are merged into
+// the run first; should that fail for lack of memory, they are visited
+// unsorted after it.
+static void for_each_sorted(gradebook_t *book,
+                            void (*visit)(const char *name, node_t *node, void *arg), void *arg) {
+    merge_pending(book);
+    const name_index_t *order = &book->order;
+    for (unsigned i = 0; i < order->run_len; i++) {
+        node_t *node = node_at(book, order->run[i].id);
+        visit(name_at(book, node->name_off), node, arg);
+    }
+    for (unsigned i = 0; i < order->pending_len; i++) {
+        node_t *node = node_at(book, order->pending[i].id);
+        visit(name_at(book, node->name_off), node, arg);
+    }
+}
+
+void for_each_score(gradebook_t *book,
+                    void (*visit)(const char *name, int score, void *arg), void *arg) {
+    if (ensure_loaded(book) != 0) {
+        return;
+    }
+    const table_t *tables[] = {&book->old, &book->table};
+    for (int t = 0; t < 2; t++) {
+        for (unsigned i = 0; i < tables[t]->capacity; i++) {
+            if (slot_is_full(tables[t], i)) {
+                const node_t *node = node_at(book, tables[t]->slots[i]);
+                visit(name_at(book, node->name_off), node->score, arg);
+            }
+        }
+    }
+}
+
+// Whether entry's name starts with prefix, whose index entry is key.
+// Prefixes of up to eight bytes are settled by the keys alone.
+static int has_prefix(const gradebook_t *book, const index_entry_t *entry,
+                      const index_entry_t *key, const char *prefix, size_t len) {
+    uint64_t mask = len >= 8 ? UINT64_MAX : ~(UINT64_MAX >> (8 * len));
+    uint64_t a = (uint64_t) entry->key[0] << 32 | entry->key[1];
+    uint64_t b = (uint64_t) key->key[0] << 32 | key->key[1];
+    if (((a ^ b) & mask) != 0) {
+        return 0;
+    }
+    const node_t *node = node_at(book, entry->id);
+    return len <= 8 || (node->name_len >= len &&
+                        memcmp(name_at(book, node->name_off), prefix, len) == 0);
+}
+
+// Whether entry's name sorts before prefix
+static int before_prefix(const gradebook_t *book, const index_entry_t *entry,
+                         const index_entry_t *key, const char *prefix, size_t len) {
+    uint64_t a = (uint64_t) entry->key[0] << 32 | entry->key[1];
+    uint64_t b = (uint64_t) key->key[0] << 32 | key->key[1];
+    if (a != b || len <= 8) {
+        return a < b;
+    }
+    const node_t *node = node_at(book, entry->id);
+    size_t common = node->name_len < len ? node->name_len : len;
+    int cmp = memcmp(name_at(book, node->name_off), prefix, common);
+    return cmp != 0 ? cmp < 0 : node->name_len < len;
+}
+
+static void visit_entry(const gradebook_t *book, const index_entry_t *entry,
+                        void (*visit)(const char *name, int score, void *arg), void *arg) {
+    const node_t *node = node_at(book, entry->id);
+    visit(name_at(book, node->name_off), node->score, arg);
+}
+
+unsigned for_each_with_prefix(gradebook_t *book, const char *prefix,
+                              void (*visit)(const char *name, int score, void *arg), void *arg) {
+    if (book == NULL || prefix == NULL || visit == NULL || ensure_loaded(book) != 0) {
+        return 0;
+    }
+    // Merging costs O(n), so it waits until scanning the merge buffer
+    // would cost more than sqrt(n); until then queries between adds stay
+    // O(log n + sqrt(n) + k)
+    const name_index_t *order = &book->order;
+    if (order->pending_len >= MIN_PENDING &&
+        (unsigned long long) order->pending_len * order->pending_len >= order->run_len) {
+        merge_pending(book);
+    }
+    size_t len = name_length(prefix);
+    index_entry_t key = index_entry(prefix, len, NO_NODE);
+    unsigned lo = 0, hi = order->run_len;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (before_prefix(book, &order->run[mid], &key, prefix, len)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    // Matches in the merge buffer are sorted on their own and merged in
+    index_entry_t *matches = malloc((2 * order->pending_len + 1) * sizeof(index_entry_t));
+    unsigned num_matches = 0;
+    for (unsigned i = 0; i < order->pending_len; i++) {
+        if (has_prefix(book, &order->pending[i], &key, prefix, len)) {
+            if (matches == NULL) {
+                // No memory to sort them: they go first, unsorted
+                visit_entry(book, &order->pending[i], visit, arg);
+            } else {
+                matches[num_matches] = order->pending[i];
+            }
+            num_matches++;
+        }
+    }
+    unsigned sorted = matches == NULL ? 0 : num_matches;
+    if (sorted > 0) {
+        sort_entries(book, matches, sorted, matches + sorted);
+    }
+    unsigned visited = num_matches - sorted, m = 0;
+    for (unsigned i = lo; i < order->run_len && has_prefix(book, &order->run[i], &key, prefix, len);
+         i++) {
+        while (m < sorted && entry_before(book, &matches[m], &order->run[i])) {
+            visit_entry(book, &matches[m++], visit, arg);
+        }
+        visit_entry(book, &order->run[i], visit, arg);
+        visited++;
+    }
+    while (m < sorted) {
+        visit_entry(book, &matches[m++], visit, arg);
+    }
+    free(matches);
+    return visited + sorted;
+}
+
+// What for_each_not_in passes for_each_sorted
+typedef struct {
+    const gradebook_t *book;
+    const gradebook_t *other;
+    void (*visit)(const char *name, int score, void *arg);
+    void *arg;
+    unsigned visited;
+} anti_join_t;
+
+static void visit_if_missing(const char *name, node_t *node, void *arg) {
+    anti_join_t *join = arg;
+    const gradebook_t *other = join->other;
+    size_t len = node->name_len;
+    unsigned hash_val = other->hash_kind == join->book->hash_kind ? node->hash :
+                        book_hash(other, name, len);
+    if (lookup_id(other, name, len, hash_val) == NO_NODE) {
+        join->visit(name, node->score, join->arg);
+        join->visited++;
+    }
+}
+
+unsigned for_each_not_in(gradebook_t *book, gradebook_t *other,
+                         void (*visit)(const char *name, int score, void *arg), void *arg) {
+    if (book == NULL || other == NULL || visit == NULL || ensure_loaded(book) != 0 ||
+        ensure_loaded(other) != 0) {
+        return 0;
+    }
+    anti_join_t join = {book, other, visit, arg, 0};
+    for_each_sorted(book, visit_if_missing, &join);
+    return join.visited;
+}
+
+// Add the probe length of every entry in table, and its groups, to stats
+static void measure_table(const gradebook_t *book, const table_t *table, probe_stats_t *stats,
+                          unsigned long long *total, unsigned *entries) {
+    unsigned num_groups = table->capacity / GROUP_SIZE;
+    stats->num_groups += num_groups;
+    for (unsigned group = 0; group < num_groups; group++) {
+        stats->full_groups += group_match_empty(table->ctrl + group * GROUP_SIZE) == 0;
+    }
+    for (unsigned slot = 0; slot < table->capacity; slot++) {
+        if (!slot_is_full(table, slot)) {
+            continue;
+        }
+        unsigned home = home_group(node_at(book, table->slots[slot])->hash, table->capacity);
+        unsigned probe = ((slot / GROUP_SIZE - home) & (num_groups - 1)) + 1;
+        stats->histogram[probe < PROBE_HISTOGRAM_SIZE ? probe - 1 : PROBE_HISTOGRAM_SIZE - 1]++;
+        stats->max_probe = probe > stats->max_probe ? probe : stats->max_probe;
+        *total += probe;
+        (*entries)++;
+    }
+}
+
+void gradebook_probe_stats(const gradebook_t *book, probe_stats_t *stats) {
+    memset(stats, 0, sizeof(probe_stats_t));
+    if (book->lazy.data != NULL) {
+        return;
+    }
+    // Each entry is measured in whichever table it is in, so a growing
+    // table is measured as it stands rather than migrated first
+    unsigned long long total = 0;
+    unsigned entries = 0;
+    measure_table(book, &book->old, stats, &total, &entries);
+    measure_table(book, &book->table, stats, &total, &entries);
+    stats->mean_probe = entries == 0 ? 0 : (double) total / entries;
+}
+
+// Load the book and rebuild its aggregates if they are out of date
+static int current_stats(gradebook_t *book) {
+    if (ensure_loaded(book) != 0) {
+        return -1;
+    }
+    return book->stats.valid ? 0 : rebuild_stats(book);
+}
+
+int gradebook_stats(gradebook_t *book, score_summary_t *summary) {
+    if (book == NULL || summary == NULL || current_stats(book) != 0) {
+        return -1;
+    }
+    summary->count = book->size;
+    summary->sum = book->stats.sum;
+    summary->mean = book->size == 0 ? 0 : (double) book->stats.sum / book->size;
+    summary->min = book->size == 0 ? 0 : book->stats.min;
+    summary->max = book->size == 0 ? 0 : book->stats.max;
+    return 0;
+}
+
+int score_percentile(gradebook_t *book, double percent, int *score) {
+    if (book == NULL || score == NULL || !(percent >= 0 && percent <= 100) ||
+        current_stats(book) != 0 || book->size == 0) {
+        return -1;
+    }
+    const score_stats_t *stats = &book->stats;
+    // Nearest rank: the smallest score at least percent% of scores are <=
+    unsigned long long rank = (unsigned long long) (percent / 100 * book->size);
+    rank += rank < percent / 100 * book->size || rank == 0;
+    unsigned group = 0;
+    while (rank > stats->group_counts[group]) {
+        rank -= stats->group_counts[group++];
+    }
+    unsigned bucket = 0;
+    while (rank > stats->groups[group][bucket]) {
+        rank -= stats->groups[group][bucket++];
+    }
+    unsigned width;
+    int low = bucket_low(group * STATS_SUB + bucket, &width);
+    *score = low < stats->min ? stats->min : low > stats->max ? stats->max : low;
+    return 0;
+}
+
+unsigned top_scores(gradebook_t *book, unsigned k, const char **names, int *scores) {
+    if (book == NULL || names == NULL || scores == NULL || current_stats(book) != 0) {
+        return 0;
+    }
+    k = k < STATS_TOP_K ? k : STATS_TOP_K;
+    k = k < book->size ? k : book->size;
+    // Members that dropped out left top short
+    if (book->stats.top_len < k && rebuild_stats(book) != 0) {
+        return 0;
+    }
+    for (unsigned i = 0; i < k; i++) {
+        names[i] = name_at(book, node_at(book, book->stats.top[i].id)->name_off);
+        scores[i] = book->stats.top[i].score;
+    }
+    return k;
+}
+
+// Leaf and position of the first entry scoring at least score, or a NULL
+// leaf if there is none; *below is set to the number of entries before it
+static score_node_t *score_lower_bound(const gradebook_t *book, int score, unsigned *pos,
+                                       unsigned long *below) {
+    score_node_t *node = book->by_score.root;
+    *below = 0;
+    while (!node->leaf) {
+        unsigned i = 0;
+        while (i + 1 < node->len && node->inner.low[i + 1].score < score) {
+            *below += node->inner.children[i++]->count;
+        }
+        node = node->inner.children[i];
+    }
+    *pos = 0;
+    while (*pos < node->len && node->entries[*pos].score < score) {
+        (*pos)++;
+    }
+    *below += *pos;
+    // Past the end of this leaf, the next one starts at or above score
+    if (*pos == node->len) {
+        node = node->next;
+        *pos = 0;
+    }
+    return node;
+}
+
+// Load the book and build its score index if it has none
+static int current_score_index(gradebook_t *book) {
+    if (ensure_loaded(book) != 0) {
+        return -1;
+    }
+    return book->by_score.root != NULL ? 0 : build_score_index(book);
+}
+
+long for_each_in_range(gradebook_t *book, int lo, int hi,
+                       void (*visit)(const char *name, int score, void *arg), void *arg) {
+    if (book == NULL || visit == NULL || current_score_index(book) != 0) {
+        return -1;
+    }
+    unsigned pos;
+    unsigned long below;
+    long visited = 0;
+    for (score_node_t *leaf = score_lower_bound(book, lo, &pos, &below); leaf != NULL;
+         leaf = leaf->next, pos = 0) {
+        for (; pos < leaf->len; pos++) {
+            const score_entry_t *entry = &leaf->entries[pos];
+            if (entry->score > hi) {
+                return visited;
+            }
+            const node_t *node = node_at(book, entry->entry.id);
+            visit(name_at(book, node->name_off), entry->score, arg);
+            visited++;
+        }
+    }
+    return visited;
+}
+
+long count_range(gradebook_t *book, int lo, int hi) {
+    if (book == NULL || current_score_index(book) != 0) {
+        return -1;
+    }
+    if (lo > hi) {
+        return 0;
+    }
+    unsigned pos;
+    unsigned long below_lo, below_hi = book->by_score.root->count;
+    score_lower_bound(book, lo, &pos, &below_lo);
+    if (hi < INT_MAX) {
+        score_lower_bound(book, hi + 1, &pos, &below_hi);
+    }
+    return below_hi - below_lo;
+}
+
+// Entries are formatted into one large buffer and handed to write(2) a
+// WRITE_BUFFER_SIZE block at a time, skipping printf and stdio locking
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    const char *separator; // Between name and score: ": " or " "
+    size_t separator_len;
+    int err;               // Set once a write fails
+    uint64_t flushed;      // Bytes written out before buf
+    uint64_t *marks;       // If not NULL, where every LAZY_INDEX_STRIDE-th line starts
+    unsigned num_lines;    // Entries written so far
+} out_buffer_t;
+
+static void out_flush(out_buffer_t *out) {
+    size_t done = 0;
+    while (!out->err && done < out->len) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+        if (n < 0 && errno != EINTR) {
+            out->err = 1;
+        } else if (n > 0) {
+            done += n;
+        }
+    }
+    out->flushed += out->len;
+    out->len = 0;
+}
+
+static inline void out_append(out_buffer_t *out, const char *data, size_t len) {
+    if (out->len + len > WRITE_BUFFER_SIZE) {
+        out_flush(out);
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+}
+
+// Appends value in decimal, written backwards into a scratch buffer
+static inline void out_uint(out_buffer_t *out, unsigned long long value) {
+    char digits[20];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    out_append(out, digits + i, sizeof(digits) - i);
+}
+
+static inline void out_int(out_buffer_t *out, int value) {
+    if (value < 0) {
+        out_append(out, "-", 1);
+        out_uint(out, -(long long) value);
+    } else {
+        out_uint(out, value);
+    }
+}
+
+static void out_entry(const char *name, node_t *node, void *arg) {
+    out_buffer_t *out = arg;
+    if (out->marks != NULL && out->num_lines % LAZY_INDEX_STRIDE == 0) {
+        out->marks[out->num_lines / LAZY_INDEX_STRIDE] = out->flushed + out->len;
+    }
+    out->num_lines++;
+    out_append(out, name, node->name_len);
+    out_append(out, out->separator, out->separator_len);
+    out_int(out, node->score);
+    out_append(out, "\n", 1);
+}
+
+// Write every entry as "<name><separator><score>" lines to fd, recording
+// the offset of every LAZY_INDEX_STRIDE-th line in marks unless it is NULL.
+// Returns 0, or -1 if a write fails.
+static int write_entries(gradebook_t *book, int fd, const char *header, const char *separator,
+                         uint64_t *marks) {
+    out_buffer_t out = {.fd = fd, .buf = malloc(WRITE_BUFFER_SIZE), .separator = separator,
+                        .separator_len = strlen(separator), .marks = marks};
+    if (out.buf == NULL) {
+        return -1;
+    }
+    if (header != NULL) {
+        out_append(&out, header, strlen(header));
+    }
+    for_each_sorted(book, out_entry, &out);
+    out_flush(&out);
+    free(out.buf);
+    return out.err ? -1 : 0;
+}
+
+void print_gradebook(gradebook_t *book) {
+    if (ensure_loaded(book) != 0) {
+        return;
+    }
+    // Anything already printf'd has to reach the terminal first
+    fflush(stdout);
+    write_entries(book, STDOUT_FILENO, NULL, ": ", NULL);
+}
+
+size_t gradebook_memory_usage(const gradebook_t *book) {
+    size_t bytes = sizeof(gradebook_t);
+    bytes += (size_t) book->filter.num_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    for (unsigned group = 0; group < STATS_GROUPS; group++) {
+        bytes += book->stats.groups[group] == NULL ? 0 : STATS_SUB * sizeof(unsigned);
+    }
+    bytes += (size_t) book->by_score.num_nodes * sizeof(score_node_t);
+    bytes += (size_t) book->lazy.num_marks * sizeof(uint64_t);
+    if (book->mapping != NULL) {
+        // Only the directories are allocated; the rest is the mapped file
+        return bytes + book->nodes.max_slabs * sizeof(node_t *) +
+               book->names.max_chunks * sizeof(char *);
+    }
+    bytes += (size_t) (book->order.run_cap + book->order.pending_cap) * sizeof(index_entry_t);
+    bytes += (size_t) book->table.capacity * (sizeof(uint8_t) + sizeof(uint32_t));
+    bytes += (size_t) book->old.capacity * (sizeof(uint8_t) + sizeof(uint32_t));
+    bytes += (size_t) book->nodes.max_slabs * sizeof(node_t *);
+    bytes += (size_t) book->nodes.num_slabs * SLAB_NODES * sizeof(node_t);
+    bytes += (size_t) book->names.max_chunks * sizeof(char *);
+    bytes += (size_t) book->names.num_chunks * NAME_CHUNK_SIZE;
+    return bytes;
+}
+
+void free_gradebook(gradebook_t *book) {
+    if (book == NULL) {
+        return;
+    }
+    free_stats(&book->stats);
+    drop_score_index(book);
+    free(book->filter.blocks);
+    if (book->lazy.data != NULL) {
+        munmap((void *) book->lazy.data, book->lazy.len);
+        free(book->lazy.marks);
+    }
+    if (book->mapping != NULL) {
+        munmap(book->mapping, book->mapping_len);
+        free(book->nodes.slabs);
+        free(book->names.chunks);
+        free(book);
+        return;
+    }
+    free_node_pool(&book->nodes);
+    free_name_pool(&book->names);
+    free(book->order.run);
+    free(book->order.pending);
+    release_table(&book->table);
+    release_table(&book->old);
+    free(book);
+}
+
+// Saves are written to <file>.tmp and only renamed over <file> once fully
+// written and synced, so a crash mid-save leaves the previous file intact.
+// ok says whether writing and closing the temp file succeeded.
+static int replace_file(const char *tmp_name, const char *file_name, int ok) {
+    if (ok && rename(tmp_name, file_name) == 0) {
+        return 0;
+    }
+    unlink(tmp_name);
+    return -1;
+}
+
+// A text file written by write_gradebook_to_text has an index beside it,
+// <file>.idx: this header, then the offset of every LAZY_INDEX_STRIDE-th
+// line. The header holds the text file's size, inode and modification
+// time, so an index left behind by an older version of the file, or one
+// edited since, is ignored.
+#define LAZY_INDEX_MAGIC "GBTXIDX"
+#define LAZY_INDEX_VERSION 1
+
+typedef struct {
+    char magic[8];       // LAZY_INDEX_MAGIC, '\0'-terminated
+    uint32_t version;    // LAZY_INDEX_VERSION
+    uint32_t stride;     // LAZY_INDEX_STRIDE
+    uint32_t count;      // Entries in the text file
+    uint32_t num_marks;  // Offsets following the header
+    uint64_t text_size;  // The text file as it was written
+    uint64_t text_ino;
+    int64_t text_mtime_sec;
+    int64_t text_mtime_nsec;
+} lazy_index_header_t;
+
+static unsigned lazy_index_marks(unsigned count) {
+    return (count + LAZY_INDEX_STRIDE - 1) / LAZY_INDEX_STRIDE;
+}
+
+// Check an index header against the text file it sits beside
+static int valid_lazy_index(const lazy_index_header_t *header, const struct stat *st,
+                            unsigned count) {
+    return memcmp(header->magic, LAZY_INDEX_MAGIC, sizeof(LAZY_INDEX_MAGIC)) == 0 &&
+           header->version == LAZY_INDEX_VERSION && header->stride == LAZY_INDEX_STRIDE &&
+           header->count == count && header->num_marks == lazy_index_marks(count) &&
+           header->text_size == (uint64_t) st->st_size && header->text_ino == st->st_ino &&
+           header->text_mtime_sec == st->st_mtim.tv_sec &&
+           header->text_mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+// Write the index of the text file just written to file_name. If it
+// cannot be written, any index left from before is removed so it is not
+// mistaken for this file's.
+static void write_lazy_index(const char *file_name, unsigned count, const uint64_t *marks) {
+    char index_name[PATH_MAX], tmp_name[PATH_MAX];
+    if (snprintf(index_name, sizeof(index_name), "%s.idx", file_name) >= (int) sizeof(index_name) ||
+        snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", index_name) >= (int) sizeof(tmp_name)) {
+        return;
+    }
+    lazy_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, LAZY_INDEX_MAGIC);
+    header.version = LAZY_INDEX_VERSION;
+    header.stride = LAZY_INDEX_STRIDE;
+    header.count = count;
+    header.num_marks = lazy_index_marks(count);
+    struct stat st;
+    FILE *f = NULL;
+    if (marks != NULL && stat(file_name, &st) == 0) {
+        header.text_size = st.st_size;
+        header.text_ino = st.st_ino;
+        header.text_mtime_sec = st.st_mtim.tv_sec;
+        header.text_mtime_nsec = st.st_mtim.tv_nsec;
+        f = fopen(tmp_name, "wb");
+    }
+    if (f == NULL) {
+        unlink(index_name);
+        return;
+    }
+    // Not synced: after a crash a missing or short index only means the
+    // next lazy open loads the file
+    int err = fwrite(&header, sizeof(header), 1, f) != 1 ||
+              fwrite(marks, sizeof(uint64_t), header.num_marks, f) != header.num_marks;
+    err = fclose(f) != 0 || err;
+    if (replace_file(tmp_name, index_name, !err) != 0) {
+        unlink(index_name);
+    }
+}
+
+int write_gradebook_to_text(gradebook_t *book) {
+    if (ensure_loaded(book) != 0) {
+        return -1;
+    }
+    char file_name[MAX_NAME_LEN + strlen(".txt")];
+    char tmp_name[MAX_NAME_LEN + strlen(".txt.tmp")];
+    strcpy(file_name, book->class_name);
+    strcat(file_name, ".txt");
+    strcpy(tmp_name, file_name);
+    strcat(tmp_name, ".tmp");
+    int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char header[16];
+    snprintf(header, sizeof(header), "%u\n", book->size);
+    // Without memory for the index the file is still written; it just
+    // cannot be opened lazily
+    uint64_t *marks = malloc((lazy_index_marks(book->size) + 1) * sizeof(uint64_t));
+    int ok = write_entries(book, fd, header, " ", marks) == 0 && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (replace_file(tmp_name, file_name, ok) != 0) {
+        free(marks);
+        return -1;
+    }
+    // Entries that could not be merged into the sorted run were written
+    // after it unsorted, and such a file cannot be searched
+    write_lazy_index(file_name, book->size,
+                     book->order.pending_len == 0 ? marks : NULL);
+    free(marks);
+    return 0;
+}
+
+gradebook_snapshot_t *snapshot_gradebook(gradebook_t *book) {
+    if (book == NULL || book->snapshot != NULL || ensure_loaded(book) != 0) {
+        return NULL;
+    }
+    gradebook_snapshot_t *snapshot = calloc(1, sizeof(gradebook_snapshot_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    gradebook_t *view = &snapshot->view;
+    strcpy(view->class_name, book->class_name);
+    view->size = book->size;
+    view->hash_kind = book->hash_kind;
+    view->nodes = book->nodes;
+    view->nodes.max_slabs = book->nodes.num_slabs;
+    view->nodes.slabs = malloc((book->nodes.num_slabs + 1) * sizeof(node_t *));
+    view->names = book->names;
+    view->names.max_chunks = book->names.num_chunks;
+    view->names.chunks = malloc((book->names.num_chunks + 1) * sizeof(char *));
+    // Every slab, the run and the merge buffer can each be retired once
+    snapshot->retired = malloc((book->nodes.num_slabs + 2) * sizeof(void *));
+    if (view->nodes.slabs == NULL || view->names.chunks == NULL || snapshot->retired == NULL) {
+        free(view->nodes.slabs);
+        free(view->names.chunks);
+        free(snapshot->retired);
+        free(snapshot);
+        return NULL;
+    }
+    // An empty book has no directories yet, and memcpy must not see NULL
+    if (book->nodes.num_slabs > 0) {
+        memcpy(view->nodes.slabs, book->nodes.slabs, book->nodes.num_slabs * sizeof(node_t *));
+    }
+    if (book->names.num_chunks > 0) {
+        memcpy(view->names.chunks, book->names.chunks, book->names.num_chunks * sizeof(char *));
+    }
+    // Capacities equal to the lengths, so nothing is ever appended in place
+    view->order = book->order;
+    view->order.run_cap = book->order.run_len;
+    view->order.pending_cap = book->order.pending_len;
+    view->stats.min = INT_MAX;
+    view->stats.max = INT_MIN;
+    snapshot->book = book;
+    snapshot->shared_run = book->order.run;
+    snapshot->shared_pending = book->order.pending;
+    book->snapshot = snapshot;
+    return snapshot;
+}
+
+// Sort a snapshot's merge buffer into a run of its own, leaving the
+// shared arrays untouched. Returns 0, or -1 if no memory is available.
+static int sort_snapshot(gradebook_snapshot_t *snapshot) {
+    name_index_t *order = &snapshot->view.order;
+    if (order->pending_len == 0) {
+        return 0;
+    }
+    unsigned total = order->run_len + order->pending_len;
+    index_entry_t *run = malloc(total * sizeof(index_entry_t));
+    index_entry_t *pending = malloc(2 * order->pending_len * sizeof(index_entry_t));
+    if (run == NULL || pending == NULL) {
+        free(run);
+        free(pending);
+        return -1;
+    }
+    // A book whose names are all still pending has no run yet
+    if (order->run_len > 0) {
+        memcpy(run, order->run, order->run_len * sizeof(index_entry_t));
+    }
+    memcpy(pending, order->pending, order->pending_len * sizeof(index_entry_t));
+    sort_entries(&snapshot->view, pending, order->pending_len, pending + order->pending_len);
+    merge_sorted(&snapshot->view, run, order->run_len, pending, order->pending_len);
+    free(pending);
+    order->run = run;
+    order->run_len = total;
+    order->run_cap = total;
+    order->pending = NULL;
+    order->pending_len = 0;
+    order->pending_cap = 0;
+    return 0;
+}
+
+int write_snapshot_to_text(gradebook_snapshot_t *snapshot) {
+    if (snapshot == NULL || sort_snapshot(snapshot) != 0) {
+        return -1;
+    }
+    return write_gradebook_to_text(&snapshot->view);
+}
+
+void release_snapshot(gradebook_snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+    for (unsigned i = 0; i < snapshot->num_retired; i++) {
+        free(snapshot->retired[i]);
+    }
+    if (snapshot->retired_mapping != NULL) {
+        munmap(snapshot->retired_mapping, snapshot->retired_mapping_len);
+    }
+    if (snapshot->view.order.run != snapshot->shared_run) {
+        free(snapshot->view.order.run);
+    }
+    free(snapshot->view.nodes.slabs);
+    free(snapshot->view.names.chunks);
+    free(snapshot->retired);
+    snapshot->book->snapshot = NULL;
+    free(snapshot);
+}
+
+// Class name for a file: the file name without its extension. Returns 0,
+// or -1 if the name is too short or the class name would not fit.
+static int class_name_from_file(const char *file_name, const char *ext, char *class_name) {
+    size_t len = strlen(file_name);
+    if (len < strlen(ext) || len - strlen(ext) >= MAX_NAME_LEN) {
+        return -1;
+    }
+    memcpy(class_name, file_name, len - strlen(ext));
+    // remember to append '\0' at the end of class_name
+    class_name[len - strlen(ext)] = '\0';
+    return 0;
+}
+
+// Reads a text file in READ_BLOCK_SIZE blocks and splits it into
+// whitespace-separated tokens without going through stdio
+typedef struct {
+    int fd;
+    char *buf;  // READ_BLOCK_SIZE bytes
+    size_t pos; // Next unread byte in buf
+    size_t len; // Bytes of buf holding file data
+    int eof;    // Set once read() has returned 0
+} text_reader_t;
+
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Move the unread tail to the front of the buffer and read more after it.
+// Returns the number of bytes read, 0 at end of file or -1 on error.
+// A reader over a whole mapped file starts out at end of file, so its
+// buffer is never written.
+static long refill(text_reader_t *reader) {
+    if (reader->eof) {
+        return 0;
+    }
+    memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+    reader->len -= reader->pos;
+    reader->pos = 0;
+    if (reader->len == READ_BLOCK_SIZE) {
+        return 0;
+    }
+    long got = read(reader->fd, reader->buf + reader->len, READ_BLOCK_SIZE - reader->len);
+    if (got == 0) {
+        reader->eof = 1;
+    } else if (got > 0) {
+        reader->len += got;
+    }
+    return got;
+}
+
+// Find the next token, refilling as needed so it is whole in the buffer.
+// Returns its length (pointer in *token), 0 at end of file, or -1 on a
+// read error or a token longer than max_len.
+static long next_token(text_reader_t *reader, const char **token, size_t max_len) {
+    while (1) {
+        while (reader->pos < reader->len && is_space(reader->buf[reader->pos])) {
+            reader->pos++;
+        }
+        if (reader->pos < reader->len) {
+            break;
+        }
+        long got = refill(reader);
+        if (got <= 0) {
+            return got;
+        }
+    }
+    size_t end = reader->pos;
+    while (1) {
+        while (end < reader->len && !is_space(reader->buf[end])) {
+            end++;
+        }
+        if (end - reader->pos > max_len) {
+            return -1;
+        }
+        if (end < reader->len || reader->eof) {
+            break;
+        }
+        size_t scanned = end - reader->pos;
+        long got = refill(reader);
+        if (got < 0 || (got == 0 && !reader->eof)) {
+            return -1;
+        }
+        end = reader->pos + scanned;
+    }
+    *token = reader->buf + reader->pos;
+    reader->pos = end;
+    return end - (*token - reader->buf);
+}
+
+// Parse a token of decimal digits, with an optional leading '-', into an
+// int. Returns 0, or -1 if it is not a number that fits.
+static int parse_int(const char *token, size_t len, long long max, long long *value) {
+    int negative = len > 0 && token[0] == '-';
+    size_t i = negative;
+    if (i == len) {
+        return -1;
+    }
+    long long result = 0;
+    for (; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9') {
+            return -1;
+        }
+        result = result * 10 + (token[i] - '0');
+        if (result > max) {
+            return -1;
+        }
+    }
+    *value = negative ? -result : result;
+    return 0;
+}
+
+// Parse a whole text file into a new book named book_name, file_size
+// bytes long. Returns the book, or NULL if the file is malformed or
+// memory runs out.
+static gradebook_t *parse_text(text_reader_t *reader, const char *book_name, size_t file_size) {
+    gradebook_t *new_book = NULL;
+    const char *token;
+    long long count = 0, loaded = 0, score;
+    long len = next_token(reader, &token, 20);
+    if (len > 0 && parse_int(token, len, UINT32_MAX, &count) == 0 && count >= 0) {
+        // Every entry takes at least four bytes ("a 0\n"), which bounds how
+        // far a bogus header can make us pre-size
+        long long max_entries = file_size / 4;
+        new_book = create_gradebook(book_name, count < max_entries ? count : max_entries);
+    }
+    while (new_book != NULL && loaded < count) {
+        char name[MAX_NAME_LEN];
+        len = next_token(reader, &token, MAX_NAME_LEN - 1);
+        if (len <= 0) {
+            break;
+        }
+        memcpy(name, token, len);
+        name[len] = '\0';
+        len = next_token(reader, &token, 20);
+        if (len <= 0 || parse_int(token, len, INT32_MAX, &score) != 0 ||
+            add_score(new_book, name, score) != 0) {
+            break;
+        }
+        loaded++;
+    }
+    // The header's entry count must match the file exactly
+    if (new_book != NULL && (loaded != count || next_token(reader, &token, MAX_NAME_LEN) != 0)) {
+        free_gradebook(new_book);
+        return NULL;
+    }
+    return new_book;
+}
+
+gradebook_t *read_gradebook_from_text(const char *file_name) {
+    char book_name[MAX_NAME_LEN];
+    if (class_name_from_file(file_name, ".txt", book_name) != 0) {
+        return NULL;
     }
-    // strcpy book->class_name
-    strcpy(book->class_name, class_name);
-    return book;
+    text_reader_t reader = {.fd = open(file_name, O_RDONLY)};
+    // read failed
+    if (reader.fd < 0) {
+        return NULL;
+    }
+    reader.buf = malloc(READ_BLOCK_SIZE);
+    struct stat st;
+    gradebook_t *new_book = NULL;
+    if (reader.buf != NULL && fstat(reader.fd, &st) == 0) {
+        new_book = parse_text(&reader, book_name, st.st_size);
+    }
+    free(reader.buf);
+    close(reader.fd);
+    return new_book;
 }
 
-const char* get_gradebook_name(const gradebook_t* book) {
-    return book->class_name;
+// A reader over the whole of a lazy book's file
+static text_reader_t lazy_reader(const lazy_text_t *lazy) {
+    text_reader_t reader = {.fd = -1, .buf = (char *) lazy->data, .len = lazy->len, .eof = 1};
+    return reader;
+}
+
+// Parse the "<name> <score>" line starting at pos in the len bytes of a
+// mapped text file into *name, *name_len and *score. Returns the offset
+// of the next line, or 0 if this one is malformed.
+static size_t text_line(const char *data, size_t len, size_t pos, const char **name,
+                        size_t *name_len, int *score) {
+    const char *line = data + pos;
+    const char *eol = memchr(line, '\n', len - pos);
+    size_t line_len = eol == NULL ? len - pos : (size_t) (eol - line);
+    size_t end = 0;
+    while (end < line_len && !is_space(line[end])) {
+        end++;
+    }
+    size_t score_pos = end;
+    while (score_pos < line_len && is_space(line[score_pos])) {
+        score_pos++;
+    }
+    size_t score_end = score_pos;
+    while (score_end < line_len && !is_space(line[score_end])) {
+        score_end++;
+    }
+    long long value;
+    if (end == 0 || end >= MAX_NAME_LEN ||
+        parse_int(line + score_pos, score_end - score_pos, INT32_MAX, &value) != 0) {
+        return 0;
+    }
+    *name = line;
+    *name_len = end;
+    *score = value;
+    return pos + line_len + (eol != NULL);
 }
 
+// Compare a name from the file with the len-byte name being looked for,
+// as strcmp would
+static int lazy_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return cmp != 0 ? cmp : (a_len > b_len) - (a_len < b_len);
+}
 
-int add_score(gradebook_t* book, const char* name, int score) {
-    if (book == NULL || name == NULL) {
+// Binary search the index for the last marked line not after name, then
+// scan the lines from there up to the next mark. Returns the score, or -1
+// if the name is not found.
+static int lazy_find(const lazy_text_t *lazy, const char *name, size_t len) {
+    unsigned lo = 0, hi = lazy->num_marks;
+    const char *line_name;
+    size_t line_len;
+    int score;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (text_line(lazy->data, lazy->len, lazy->marks[mid], &line_name, &line_len,
+                      &score) == 0) {
+            return -1;
+        }
+        if (lazy_compare(line_name, line_len, name, len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
         return -1;
     }
+    size_t pos = lazy->marks[lo - 1];
+    for (unsigned i = 0; i < LAZY_INDEX_STRIDE && pos < lazy->len; i++) {
+        size_t next = text_line(lazy->data, lazy->len, pos, &line_name, &line_len, &score);
+        if (next == 0) {
+            return -1;
+        }
+        int cmp = lazy_compare(line_name, line_len, name, len);
+        if (cmp >= 0) {
+            return cmp == 0 ? score : -1;
+        }
+        pos = next;
+    }
+    return -1;
+}
 
-    unsigned idx = hash(name);
-    node_t* curr = book->buckets[idx];
+// Read the index write_gradebook_to_text left beside file_name into
+// lazy->marks, checking that it was written for the file as it is now (st)
+// and that its offsets start at the first entry and stay inside the file.
+// Returns 0, or -1 if there is no such index (or no memory is available).
+static int read_lazy_index(lazy_text_t *lazy, const char *file_name, const struct stat *st,
+                           size_t start, unsigned count) {
+    char index_name[PATH_MAX];
+    if (snprintf(index_name, sizeof(index_name), "%s.idx", file_name) >= (int) sizeof(index_name)) {
+        return -1;
+    }
+    FILE *f = fopen(index_name, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    lazy_index_header_t header;
+    unsigned num_marks = lazy_index_marks(count);
+    uint64_t *marks = NULL;
+    if (fread(&header, sizeof(header), 1, f) == 1 && valid_lazy_index(&header, st, count)) {
+        marks = malloc((num_marks + 1) * sizeof(uint64_t));
+    }
+    int ok = marks != NULL && fread(marks, sizeof(uint64_t), num_marks, f) == num_marks;
+    fclose(f);
+    for (unsigned i = 0; ok && i < num_marks; i++) {
+        ok = marks[i] < lazy->len && (i == 0 ? marks[0] == start : marks[i] > marks[i - 1]);
+    }
+    if (!ok) {
+        free(marks);
+        return -1;
+    }
+    lazy->marks = marks;
+    lazy->num_marks = num_marks;
+    return 0;
+}
 
-    while (curr != NULL) {
-        if (strcmp(curr->name, name) == 0) {
-            curr->score = score;
-            return 0;
+// Parse a lazy book's file into it and unmap the file. On failure the
+// book is left as it was.
+static int load_lazy(gradebook_t *book) {
+    text_reader_t reader = lazy_reader(&book->lazy);
+    gradebook_t *loaded = parse_text(&reader, book->class_name, book->lazy.len);
+    if (loaded == NULL) {
+        return -1;
+    }
+    munmap((void *) book->lazy.data, book->lazy.len);
+    free(book->lazy.marks);
+    memset(&book->lazy, 0, sizeof(lazy_text_t));
+    // Trade places so the caller's pointer holds the entries and the empty
+    // book left over is freed
+    gradebook_t empty = *book;
+    *book = *loaded;
+    *loaded = empty;
+    free_gradebook(loaded);
+    // A filter asked for while the book was lazy is built now; without
+    // memory for it the book simply has none
+    if (empty.filter.fp_rate != 0) {
+        rebuild_filter(book, empty.filter.fp_rate);
+    }
+    return 0;
+}
+
+gradebook_t *read_gradebook_from_text_lazy(const char *file_name) {
+    char book_name[MAX_NAME_LEN];
+    if (class_name_from_file(file_name, ".txt", book_name) != 0) {
+        return NULL;
+    }
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    lazy_text_t lazy = {.data = mapping, .len = st.st_size};
+    text_reader_t reader = lazy_reader(&lazy);
+    const char *token;
+    long long count;
+    long len = next_token(&reader, &token, 20);
+    gradebook_t *book = NULL;
+    if (len > 0 && parse_int(token, len, UINT32_MAX, &count) == 0 && count >= 0) {
+        book = create_gradebook(book_name, 0);
+    }
+    if (book == NULL) {
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+    // Entries start on the line after the count
+    const char *eol = memchr(token + len, '\n', lazy.len - (token + len - lazy.data));
+    size_t start = eol == NULL ? lazy.len : (size_t) (eol - lazy.data) + 1;
+    int indexed = read_lazy_index(&lazy, file_name, &st, start, count) == 0;
+    book->lazy = lazy;
+    if (!indexed && load_lazy(book) != 0) {
+        free_gradebook(book);
+        return NULL;
+    }
+    return book;
+}
+
+// A line read by a parallel load, its name still in the mapped file
+typedef struct {
+    const char *name; // Not '\0'-terminated
+    uint32_t len;
+    uint32_t hash;
+    int score;
+} parsed_line_t;
+
+struct parallel_load;
+
+// One thread's chunk of the file. Its lines are parsed in file order and
+// then grouped by partition, keeping file order within each partition.
+typedef struct {
+    struct parallel_load *load;
+    size_t begin;         // Offset of the chunk's first line
+    size_t end;           // Offset just past its last line
+    parsed_line_t *lines; // The chunk's lines, grouped by partition
+    unsigned num_lines;
+    unsigned *part_start; // lines[part_start[p]] starts partition p (num_parts + 1 of them)
+    size_t *part_bytes;   // Bytes of names in each partition, counting their '\0's
+    int failed;           // Set if a line is malformed or memory ran out
+} load_chunk_t;
+
+// One partition: the groups of the table it fills, and the node ids and
+// name chunks set aside for it
+typedef struct {
+    unsigned end_group;       // One past its last group
+    uint32_t first_id;        // Node ids from first_id to end_id are its own
+    uint32_t next_id;         // Next of its ids to hand out
+    uint32_t end_id;
+    uint32_t shift;           // How far down compact_nodes moved its ids
+    unsigned next_chunk;      // Name chunk being filled
+    unsigned end_chunk;       // One past its last name chunk
+    unsigned chunk_used;      // Bytes used in next_chunk
+    parsed_line_t *spilled;   // Lines whose probe ran past end_group, in file order
+    unsigned num_spilled;
+    unsigned spilled_cap;
+    int failed;               // Set if memory ran out
+} load_part_t;
+
+typedef struct parallel_load {
+    gradebook_t *book;
+    const char *data;     // The mapped file
+    size_t len;
+    unsigned num_threads; // Chunks, and threads in each phase
+    unsigned num_parts;   // Partitions, a power of two
+    unsigned part_shift;  // A home group shifted right this far is its partition
+    load_chunk_t *chunks;
+    load_part_t *parts;
+} parallel_load_t;
+
+static inline unsigned partition_of(const parallel_load_t *load, unsigned hash_val) {
+    return home_group(hash_val, load->book->table.capacity) >> load->part_shift;
+}
+
+// Phase one: parse and hash a chunk's lines, then group them by partition
+static void *parse_chunk(void *arg) {
+    load_chunk_t *chunk = arg;
+    const parallel_load_t *load = chunk->load;
+    unsigned lines_cap = 0;
+    parsed_line_t *lines = NULL;
+    for (size_t pos = chunk->begin; pos < chunk->end;) {
+        const char *name;
+        size_t len;
+        int score;
+        size_t next = text_line(load->data, load->len, pos, &name, &len, &score);
+        if (next == 0) {
+            chunk->failed = 1;
+            break;
+        }
+        if (chunk->num_lines == lines_cap) {
+            lines_cap = lines_cap == 0 ? 1024 : lines_cap * 2;
+            parsed_line_t *grown = realloc(lines, lines_cap * sizeof(parsed_line_t));
+            if (grown == NULL) {
+                chunk->failed = 1;
+                break;
+            }
+            lines = grown;
+        }
+        lines[chunk->num_lines++] = (parsed_line_t) {
+            name, len, book_hash(load->book, name, len), score};
+        pos = next;
+    }
+    chunk->part_start = calloc(load->num_parts + 1, sizeof(unsigned));
+    chunk->part_bytes = calloc(load->num_parts, sizeof(size_t));
+    chunk->lines = malloc(chunk->num_lines * sizeof(parsed_line_t));
+    if (chunk->part_start == NULL || chunk->part_bytes == NULL ||
+        (chunk->num_lines > 0 && chunk->lines == NULL)) {
+        chunk->failed = 1;
+    }
+    if (chunk->failed) {
+        free(lines);
+        return NULL;
+    }
+    // Counting sort by partition: count, turn counts into starts, place,
+    // which leaves each start where the next partition begins
+    for (unsigned i = 0; i < chunk->num_lines; i++) {
+        unsigned part = partition_of(load, lines[i].hash);
+        chunk->part_start[part + 1]++;
+        chunk->part_bytes[part] += lines[i].len + 1;
+    }
+    for (unsigned p = 0; p < load->num_parts; p++) {
+        chunk->part_start[p + 1] += chunk->part_start[p];
+    }
+    for (unsigned i = 0; i < chunk->num_lines; i++) {
+        chunk->lines[chunk->part_start[partition_of(load, lines[i].hash)]++] = lines[i];
+    }
+    memmove(chunk->part_start + 1, chunk->part_start, load->num_parts * sizeof(unsigned));
+    chunk->part_start[0] = 0;
+    free(lines);
+    return NULL;
+}
+
+// Add or update a line within its partition's groups. Everything it
+// touches belongs to the partition, so no other thread looks at it. A
+// line whose probe would leave the partition is kept for later.
+static void place_line(parallel_load_t *load, load_part_t *part, const parsed_line_t *line) {
+    gradebook_t *book = load->book;
+    table_t *table = &book->table;
+    uint8_t fp = fingerprint(line->hash);
+    for (unsigned group = home_group(line->hash, table->capacity); group < part->end_group;
+         group++) {
+        const uint8_t *ctrl = table->ctrl + group * GROUP_SIZE;
+        unsigned match = group_match(ctrl, fp);
+        while (match != 0) {
+            node_t *node = node_at(book, table->slots[group * GROUP_SIZE + __builtin_ctz(match)]);
+            if (node->hash == line->hash && node->name_len == line->len &&
+                memcmp(name_at(book, node->name_off), line->name, line->len) == 0) {
+                node->score = line->score;
+                return;
+            }
+            match &= match - 1;
+        }
+        unsigned free_mask = group_match_empty(ctrl);
+        if (free_mask != 0) {
+            // The chunks set aside always fit the partition's names
+            if (part->chunk_used + line->len + 1 > NAME_CHUNK_SIZE) {
+                part->next_chunk++;
+                part->chunk_used = 0;
+            }
+            char *dest = book->names.chunks[part->next_chunk] + part->chunk_used;
+            memcpy(dest, line->name, line->len);
+            dest[line->len] = '\0';
+            uint32_t id = part->next_id++;
+            node_t *node = node_at(book, id);
+            node->hash = line->hash;
+            node->name_off = part->next_chunk * NAME_CHUNK_SIZE + part->chunk_used;
+            node->name_len = line->len;
+            node->score = line->score;
+            part->chunk_used += line->len + 1;
+            unsigned slot = group * GROUP_SIZE + __builtin_ctz(free_mask);
+            table->ctrl[slot] = fp;
+            table->slots[slot] = id;
+            book->order.pending[id] = index_entry(line->name, line->len, id);
+            return;
+        }
+    }
+    if (part->num_spilled == part->spilled_cap) {
+        unsigned cap = part->spilled_cap == 0 ? 64 : part->spilled_cap * 2;
+        parsed_line_t *spilled = realloc(part->spilled, cap * sizeof(parsed_line_t));
+        if (spilled == NULL) {
+            part->failed = 1;
+            return;
+        }
+        part->spilled = spilled;
+        part->spilled_cap = cap;
+    }
+    part->spilled[part->num_spilled++] = *line;
+}
+
+// Phase two: fill every num_threads-th partition, starting from this
+// chunk's index, with the lines of every chunk in file order
+static void *fill_partitions(void *arg) {
+    load_chunk_t *chunk = arg;
+    parallel_load_t *load = chunk->load;
+    char **chunks = load->book->names.chunks;
+    for (unsigned p = chunk - load->chunks; p < load->num_parts; p += load->num_threads) {
+        load_part_t *part = &load->parts[p];
+        for (unsigned c = part->next_chunk; c < part->end_chunk; c++) {
+            chunks[c] = malloc(NAME_CHUNK_SIZE);
+            part->failed |= chunks[c] == NULL;
+        }
+        for (unsigned t = 0; t < load->num_threads && !part->failed; t++) {
+            const load_chunk_t *from = &load->chunks[t];
+            for (unsigned i = from->part_start[p]; i < from->part_start[p + 1]; i++) {
+                place_line(load, part, &from->lines[i]);
+            }
         }
-        curr = curr->next;
     }
-    
-    node_t* new_node = malloc(sizeof(node_t));
-    if (new_node == NULL) {
+    return NULL;
+}
+
+// Add a spilled line once the partitions are filled, like add_score but
+// with room for it already made. Returns 0, or -1 if no memory is
+// available.
+static int place_spilled(gradebook_t *book, const parsed_line_t *line) {
+    uint32_t found = lookup_id(book, line->name, line->len, line->hash);
+    if (found != NO_NODE) {
+        node_at(book, found)->score = line->score;
+        return 0;
+    }
+    // Spilled lines take the ids after the partitions' own
+    uint32_t id = alloc_node(&book->nodes);
+    if (id == NO_NODE) {
         return -1;
     }
-    strncpy(new_node->name, name, MAX_NAME_LEN - 1);
-    new_node->name[MAX_NAME_LEN - 1] = '\0';
-    new_node->score = score;
-    new_node->next = book->buckets[idx];
-    book->buckets[idx] = new_node;
+    node_t *node = node_at(book, id);
+    if (store_name(&book->names, line->name, line->len, &node->name_off) != 0) {
+        release_node(&book->nodes, id);
+        return -1;
+    }
+    node->hash = line->hash;
+    node->name_len = line->len;
+    node->score = line->score;
+    insert_slot(&book->table, id, line->hash);
+    book->order.pending[book->order.pending_len++] = index_entry(line->name, line->len, id);
     book->size++;
     return 0;
 }
 
-
-int find_score(const gradebook_t* book, const char* name) {
-    if (book == NULL || name == NULL) {
+// Set aside node ids, name chunks and node slabs for every partition once
+// the chunks are parsed. Returns 0, or -1 if no memory is available.
+static int reserve_partitions(parallel_load_t *load, uint32_t num_lines) {
+    gradebook_t *book = load->book;
+    unsigned groups_per_part = book->table.capacity / GROUP_SIZE / load->num_parts;
+    uint32_t id = 0;
+    unsigned chunk = 0;
+    for (unsigned p = 0; p < load->num_parts; p++) {
+        load_part_t *part = &load->parts[p];
+        size_t bytes = 0;
+        part->first_id = id;
+        for (unsigned t = 0; t < load->num_threads; t++) {
+            const load_chunk_t *from = &load->chunks[t];
+            id += from->part_start[p + 1] - from->part_start[p];
+            bytes += from->part_bytes[p];
+        }
+        part->next_id = part->first_id;
+        part->end_id = id;
+        part->end_group = (p + 1) * groups_per_part;
+        // Every chunk is filled to within MAX_NAME_LEN bytes of its end
+        part->next_chunk = chunk;
+        chunk += bytes == 0 ? 0 : bytes / (NAME_CHUNK_SIZE - MAX_NAME_LEN) + 1;
+        part->end_chunk = chunk;
+    }
+    book->order.pending = malloc(num_lines * sizeof(index_entry_t));
+    book->order.pending_cap = num_lines;
+    book->names.chunks = calloc(chunk, sizeof(char *));
+    node_pool_t *nodes = &book->nodes;
+    nodes->slabs = calloc((num_lines + SLAB_NODES - 1) / SLAB_NODES, sizeof(node_t *));
+    if ((num_lines > 0 && (book->order.pending == NULL || nodes->slabs == NULL)) ||
+        (chunk > 0 && book->names.chunks == NULL)) {
         return -1;
     }
-    
-    unsigned idx = hash(name);
-    node_t* curr = book->buckets[idx];
+    // Chunks are allocated by the partitions' threads; until then they
+    // are NULL, which free_gradebook can free
+    book->names.num_chunks = chunk;
+    book->names.max_chunks = chunk;
+    nodes->max_slabs = (num_lines + SLAB_NODES - 1) / SLAB_NODES;
+    while (nodes->num_slabs < nodes->max_slabs) {
+        node_t *slab = malloc(SLAB_NODES * sizeof(node_t));
+        if (slab == NULL) {
+            return -1;
+        }
+        nodes->slabs[nodes->num_slabs++] = slab;
+    }
+    nodes->used = num_lines - (nodes->num_slabs == 0 ? 0 : (nodes->num_slabs - 1) * SLAB_NODES);
+    return 0;
+}
 
-    while (curr != NULL) {
-        if (strcmp(curr->name, name) == 0) {
-            return curr->score;
+// Renumber the partitions' nodes so their ids run from 0 with no gaps,
+// fixing the table's slots and the name index to match, and free the
+// slabs left over. Partitions are sized by lines, so with repeated names
+// most of what was set aside goes unused.
+static void compact_nodes(parallel_load_t *load) {
+    gradebook_t *book = load->book;
+    name_index_t *order = &book->order;
+    table_t *table = &book->table;
+    for (unsigned p = 0; p < load->num_parts; p++) {
+        load_part_t *part = &load->parts[p];
+        uint32_t first = order->pending_len, used = part->next_id - part->first_id;
+        for (uint32_t i = 0; i < used; i++) {
+            // Ids only move down, so nothing is overwritten before it moves
+            *node_at(book, first + i) = *node_at(book, part->first_id + i);
+            order->pending[first + i] = order->pending[part->first_id + i];
+            order->pending[first + i].id = first + i;
         }
-        curr = curr->next;
+        order->pending_len += used;
+        part->shift = part->first_id - first;
     }
-    return -1;
+    // A partition's nodes are only ever placed in its own groups
+    for (unsigned slot = 0; slot < table->capacity; slot++) {
+        if (slot_is_full(table, slot)) {
+            table->slots[slot] -= load->parts[slot / GROUP_SIZE >> load->part_shift].shift;
+        }
+    }
+    node_pool_t *nodes = &book->nodes;
+    unsigned keep = (order->pending_len + SLAB_NODES - 1) / SLAB_NODES;
+    while (nodes->num_slabs > keep) {
+        free(nodes->slabs[--nodes->num_slabs]);
+    }
+    nodes->used = order->pending_len - (keep == 0 ? 0 : (keep - 1) * SLAB_NODES);
+}
+
+// Pack the names of nodes 0 to n - 1 into the fewest chunks, as store_name
+// would have, and free the chunks left over. Nodes were numbered in the
+// order their names were stored, so each name only moves down. The bytes
+// past the last name of each chunk are zeroed, so no stale bytes of the
+// chunks end up in a binary file.
+static void pack_names(gradebook_t *book, uint32_t n) {
+    name_pool_t *names = &book->names;
+    unsigned chunk = 0, used = 0;
+    for (uint32_t id = 0; id < n; id++) {
+        node_t *node = node_at(book, id);
+        if (used + node->name_len + 1 > NAME_CHUNK_SIZE) {
+            memset(names->chunks[chunk] + used, 0, NAME_CHUNK_SIZE - used);
+            chunk++;
+            used = 0;
+        }
+        memmove(names->chunks[chunk] + used, name_at(book, node->name_off), node->name_len + 1);
+        node->name_off = chunk * NAME_CHUNK_SIZE + used;
+        used += node->name_len + 1;
+    }
+    unsigned keep = n == 0 ? 0 : chunk + 1;
+    if (keep > 0) {
+        memset(names->chunks[chunk] + used, 0, NAME_CHUNK_SIZE - used);
+    }
+    while (names->num_chunks > keep) {
+        free(names->chunks[--names->num_chunks]);
+    }
+    names->used = used;
 }
 
+// Once the partitions are filled, close the gaps they left in the node
+// ids, name chunks and name index, and add the spilled lines. Returns 0,
+// or -1 if no memory is available.
+static int finish_partitions(parallel_load_t *load) {
+    gradebook_t *book = load->book;
+    name_index_t *order = &book->order;
+    compact_nodes(load);
+    pack_names(book, order->pending_len);
+    book->size = order->pending_len;
+    for (unsigned p = 0; p < load->num_parts; p++) {
+        const load_part_t *part = &load->parts[p];
+        for (unsigned i = 0; i < part->num_spilled; i++) {
+            if (place_spilled(book, &part->spilled[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
 
-void print_gradebook(const gradebook_t *book) {
-    // printf("%s\n", book->class_name);
-    for (int i = 0; i < NUM_BUCKETS; i++) {
-        node_t* curr = book->buckets[i];
-        while (curr != NULL) {
-            printf("%s: %d\n", curr->name, curr->score);
-            curr = curr->next;
+// Cut the file after its count into num_threads chunks of whole lines,
+// parse them, and fill the book's partitions. Returns 0, or -1 if the
+// file is not one well-formed line per entry or no memory is available.
+static int load_in_parallel(parallel_load_t *load, size_t start, long long count) {
+    for (unsigned t = 0; t < load->num_threads; t++) {
+        size_t pos = start + (load->len - start) / load->num_threads * t;
+        if (t > 0 && load->data[pos - 1] != '\n') {
+            const char *eol = memchr(load->data + pos, '\n', load->len - pos);
+            pos = eol == NULL ? load->len : (size_t) (eol - load->data) + 1;
+        }
+        load->chunks[t].load = load;
+        load->chunks[t].begin = pos;
+        if (t > 0) {
+            load->chunks[t - 1].end = pos;
+        }
+    }
+    load->chunks[load->num_threads - 1].end = load->len;
+    run_threads(parse_chunk, load->chunks, sizeof(load_chunk_t), load->num_threads);
+    long long num_lines = 0;
+    for (unsigned t = 0; t < load->num_threads; t++) {
+        if (load->chunks[t].failed) {
+            return -1;
+        }
+        num_lines += load->chunks[t].num_lines;
+    }
+    // The header's entry count must match the file exactly
+    if (num_lines != count || reserve_partitions(load, num_lines) != 0) {
+        return -1;
+    }
+    run_threads(fill_partitions, load->chunks, sizeof(load_chunk_t), load->num_threads);
+    for (unsigned p = 0; p < load->num_parts; p++) {
+        if (load->parts[p].failed) {
+            return -1;
         }
     }
+    return finish_partitions(load);
 }
 
+gradebook_t *read_gradebook_from_text_parallel(const char *file_name, unsigned num_threads) {
+    char book_name[MAX_NAME_LEN];
+    if (class_name_from_file(file_name, ".txt", book_name) != 0) {
+        return NULL;
+    }
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    lazy_text_t file = {.data = mapping, .len = st.st_size};
+    text_reader_t reader = lazy_reader(&file);
+    const char *token;
+    long long count = 0;
+    long len = next_token(&reader, &token, 20);
+    if (len <= 0 || parse_int(token, len, UINT32_MAX, &count) != 0 || count < 0 ||
+        count > st.st_size / 4) {
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+    // Entries start on the line after the count
+    const char *eol = memchr(token + len, '\n', st.st_size - (token + len - file.data));
+    size_t start = eol == NULL ? st.st_size : (size_t) (eol - file.data) + 1;
 
-void free_gradebook(gradebook_t *book) {
+    if (num_threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = online > 0 ? online : 1;
+    }
+    size_t max_threads = (st.st_size - start) / PARALLEL_MIN_CHUNK + 1;
+    num_threads = num_threads < max_threads ? num_threads : max_threads;
+    num_threads = num_threads < PARALLEL_MAX_THREADS ? num_threads : PARALLEL_MAX_THREADS;
+    parallel_load_t load = {
+        .book = create_gradebook(book_name, count), .data = mapping, .len = st.st_size,
+        .num_threads = num_threads, .num_parts = 1};
+    gradebook_t *book = load.book;
     if (book == NULL) {
-        return;
+        munmap(mapping, st.st_size);
+        return NULL;
     }
-    for (int i = 0; i < NUM_BUCKETS; i++) {
-        node_t* curr = book->buckets[i];
-        while (curr != NULL) {
-            node_t* temp = curr;
-            curr = curr->next;
-            free(temp);
-        }
+    // Enough partitions for every thread, but never fewer than one group each
+    while (load.num_parts < num_threads && load.num_parts < book->table.capacity / GROUP_SIZE) {
+        load.num_parts *= 2;
     }
-    free(book);
+    load.part_shift = __builtin_ctz(book->table.capacity / GROUP_SIZE / load.num_parts);
+    load.chunks = calloc(num_threads, sizeof(load_chunk_t));
+    load.parts = calloc(load.num_parts, sizeof(load_part_t));
+    int ok = load.chunks != NULL && load.parts != NULL &&
+             load_in_parallel(&load, start, count) == 0;
+    for (unsigned t = 0; load.chunks != NULL && t < num_threads; t++) {
+        free(load.chunks[t].lines);
+        free(load.chunks[t].part_start);
+        free(load.chunks[t].part_bytes);
+    }
+    for (unsigned p = 0; load.parts != NULL && p < load.num_parts; p++) {
+        free(load.parts[p].spilled);
+    }
+    free(load.chunks);
+    free(load.parts);
+    if (ok) {
+        // The aggregates are rebuilt by the first query that needs them
+        book->stats.valid = 0;
+    } else {
+        // Any other layout is up to the one-thread reader to accept or not
+        free_gradebook(book);
+        reader = lazy_reader(&file);
+        book = parse_text(&reader, book_name, st.st_size);
+    }
+    munmap(mapping, st.st_size);
+    return book;
 }
 
-int write_gradebook_to_text(const gradebook_t *book) {
-    char file_name[MAX_NAME_LEN + strlen(".txt")];
+// Binary gradebook files hold the in-memory structures verbatim (native
+// byte order), each section starting on a BIN_ALIGN boundary:
+//   header | ctrl[capacity] | slots[capacity] | nodes[num_nodes] | names |
+//   order[size]
+// The names section is a copy of the name chunks, each chunk starting
+// NAME_CHUNK_SIZE bytes after the previous one, so node name offsets stay
+// valid and the slab and chunk directories can point into the mapping.
+// The order section is the sorted name run, so a mapped book prints
+// without sorting.
+#define BIN_MAGIC "GRADEBK"
+#define BIN_VERSION 3
+#define BIN_ALIGN 64
+
+typedef struct {
+    char magic[8];        // BIN_MAGIC, '\0'-terminated
+    uint32_t version;     // BIN_VERSION
+    uint32_t size;        // Number of entries
+    uint32_t capacity;    // Table slots
+    uint32_t num_nodes;   // Node records; every slot id is below this
+    uint32_t hash_kind;   // hash_kind_t the node hashes were made with
+    uint32_t reserved;    // Zero
+    uint64_t names_bytes; // Length of the names section
+    uint64_t ctrl_off;    // File offsets of each section
+    uint64_t slots_off;
+    uint64_t nodes_off;
+    uint64_t names_off;
+    uint64_t order_off;
+} bin_header_t;
+
+static uint64_t bin_align(uint64_t off) {
+    return (off + BIN_ALIGN - 1) / BIN_ALIGN * BIN_ALIGN;
+}
+
+// Write len bytes at off, zero-filling any gap since the last section
+static int write_section(FILE *f, uint64_t off, const void *data, size_t len) {
+    static const char zeros[BIN_ALIGN];
+    long pos = ftell(f);
+    if (pos < 0 || (uint64_t) pos > off || fwrite(zeros, 1, off - pos, f) != off - pos) {
+        return -1;
+    }
+    return fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+int write_gradebook_to_bin(gradebook_t *book) {
+    if (book == NULL) {
+        return -1;
+    }
+    char file_name[MAX_NAME_LEN + strlen(".bin")];
     strcpy(file_name, book->class_name);
-    strcat(file_name, ".txt");
-    FILE *f = fopen(file_name, "w");
+    strcat(file_name, ".bin");
+    return write_gradebook_to_bin_file(book, file_name);
+}
+
+int write_gradebook_to_bin_file(gradebook_t *book, const char *file_name) {
+    if (book == NULL || file_name == NULL || ensure_loaded(book) != 0) {
+        return -1;
+    }
+    // Everything must be in the one table and the one sorted run that get
+    // written out
+    if (book->old.capacity != 0) {
+        migrate_groups(book, book->old.capacity / GROUP_SIZE);
+    }
+    if (merge_pending(book) != 0) {
+        return -1;
+    }
+    char tmp_name[PATH_MAX];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name) >= (int) sizeof(tmp_name)) {
+        return -1;
+    }
+
+    const node_pool_t *nodes = &book->nodes;
+    const name_pool_t *names = &book->names;
+    bin_header_t header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, BIN_MAGIC);
+    header.version = BIN_VERSION;
+    header.hash_kind = book->hash_kind;
+    header.capacity = book->table.capacity;
+    for (unsigned i = 0; i < book->table.capacity; i++) {
+        header.size += slot_is_full(&book->table, i);
+    }
+    header.num_nodes = nodes->num_slabs == 0 ? 0 : (nodes->num_slabs - 1) * SLAB_NODES + nodes->used;
+    header.names_bytes = names->num_chunks == 0 ? 0 :
+        (uint64_t) (names->num_chunks - 1) * NAME_CHUNK_SIZE + names->used;
+    header.ctrl_off = bin_align(sizeof(header));
+    header.slots_off = bin_align(header.ctrl_off + header.capacity);
+    header.nodes_off = bin_align(header.slots_off + (uint64_t) header.capacity * sizeof(uint32_t));
+    header.names_off = bin_align(header.nodes_off + (uint64_t) header.num_nodes * sizeof(node_t));
+    header.order_off = bin_align(header.names_off + header.names_bytes);
+
+    FILE *f = fopen(tmp_name, "wb");
     if (f == NULL) {
         return -1;
     }
+    int err = write_section(f, 0, &header, sizeof(header));
+    err = err || write_section(f, header.ctrl_off, book->table.ctrl, header.capacity);
+    err = err || write_section(f, header.slots_off, book->table.slots,
+                               header.capacity * sizeof(uint32_t));
+    for (unsigned i = 0; !err && i < nodes->num_slabs; i++) {
+        unsigned count = i + 1 < nodes->num_slabs ? SLAB_NODES : nodes->used;
+        err = write_section(f, header.nodes_off + (uint64_t) i * SLAB_NODES * sizeof(node_t),
+                            nodes->slabs[i], count * sizeof(node_t));
+    }
+    for (unsigned i = 0; !err && i < names->num_chunks; i++) {
+        unsigned bytes = i + 1 < names->num_chunks ? NAME_CHUNK_SIZE : names->used;
+        err = write_section(f, header.names_off + (uint64_t) i * NAME_CHUNK_SIZE,
+                            names->chunks[i], bytes);
+    }
+    err = err || header.size != book->order.run_len ||
+          write_section(f, header.order_off, book->order.run, header.size * sizeof(index_entry_t));
+    err = err || fflush(f) != 0 || fsync(fileno(f)) != 0;
+    err = fclose(f) != 0 || err;
+    return replace_file(tmp_name, file_name, !err);
+}
+
+// Check that the header describes sections that fit in a file of len bytes
+static int valid_bin_header(const bin_header_t *header, size_t len) {
+    if (len < sizeof(bin_header_t) || memcmp(header->magic, BIN_MAGIC, sizeof(BIN_MAGIC)) != 0 ||
+        header->version != BIN_VERSION) {
+        return 0;
+    }
+    if (header->capacity < GROUP_SIZE || (header->capacity & (header->capacity - 1)) != 0 ||
+        header->size > header->capacity || header->size > header->num_nodes ||
+        header->hash_kind >= HASH_KINDS) {
+        return 0;
+    }
+    return header->ctrl_off % BIN_ALIGN == 0 && header->slots_off % BIN_ALIGN == 0 &&
+           header->nodes_off % BIN_ALIGN == 0 && header->names_off % BIN_ALIGN == 0 &&
+           header->order_off % BIN_ALIGN == 0 &&
+           header->ctrl_off + header->capacity <= len &&
+           header->slots_off + (uint64_t) header->capacity * sizeof(uint32_t) <= len &&
+           header->nodes_off + (uint64_t) header->num_nodes * sizeof(node_t) <= len &&
+           header->names_off + header->names_bytes <= len &&
+           header->order_off + (uint64_t) header->size * sizeof(index_entry_t) <= len &&
+           header->names_bytes <= (uint64_t) UINT32_MAX + 1;
+}
+
+// Check that a node id from the file names a node whose name lies in the
+// names section, within one chunk, and ends in '\0'
+static int valid_bin_node(const bin_header_t *header, const char *base, uint32_t id) {
+    if (id >= header->num_nodes) {
+        return 0;
+    }
+    const node_t *node = (const node_t *) (base + header->nodes_off) + id;
+    const char *names = base + header->names_off;
+    return node->name_len < MAX_NAME_LEN &&
+           (uint64_t) node->name_off + node->name_len < header->names_bytes &&
+           node->name_off % NAME_CHUNK_SIZE + node->name_len < NAME_CHUNK_SIZE &&
+           names[node->name_off + node->name_len] == '\0';
+}
 
-    fprintf(f, "%u\n", book->size);
-    for (int i = 0; i < NUM_BUCKETS; i++) {
-        node_t *current = book->buckets[i];
-        while (current != NULL) {
-            fprintf(f, "%s %d\n", current->name, current->score);
-            current = current->next;
+// Check, in one pass over the table and the order section, everything
+// lookups and walks will follow: each slot is full or CTRL_EMPTY, header
+// size slots are full and at least one is empty so probes end, and every
+// node id in a slot or in the order leads to a valid node
+static int valid_bin_body(const bin_header_t *header, const char *base) {
+    const uint8_t *ctrl = (const uint8_t *) (base + header->ctrl_off);
+    const uint32_t *slots = (const uint32_t *) (base + header->slots_off);
+    unsigned full = 0;
+    for (unsigned i = 0; i < header->capacity; i++) {
+        if ((ctrl[i] & 0x80) == 0) {
+            if (!valid_bin_node(header, base, slots[i])) {
+                return 0;
+            }
+            full++;
+        } else if (ctrl[i] != CTRL_EMPTY) {
+            return 0;
         }
     }
-    fclose(f);
-    return 0;
+    if (full != header->size || full == header->capacity) {
+        return 0;
+    }
+    const index_entry_t *order = (const index_entry_t *) (base + header->order_off);
+    for (unsigned i = 0; i < header->size; i++) {
+        if (!valid_bin_node(header, base, order[i].id)) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-gradebook_t *read_gradebook_from_text(const char *file_name) {
+gradebook_t *read_gradebook_from_bin(const char *file_name) {
     char book_name[MAX_NAME_LEN];
-    strncpy(book_name, file_name, strlen(file_name) - strlen(".txt"));
-    // remember to append '\0' at the end of book_name
-    book_name[strlen(file_name) - strlen(".txt")] = '\0';
-    gradebook_t *new_book = create_gradebook(book_name);
-    // malloc failed
-    if (new_book == NULL) {
+    if (class_name_from_file(file_name, ".bin", book_name) != 0) {
         return NULL;
     }
-    
-    FILE *pf = fopen(file_name, "r");
-    // read failed
-    if (pf == NULL) {
-        // remember to free new_book
-        free(new_book);
+    return read_gradebook_from_bin_file(file_name, book_name);
+}
+
+gradebook_t *read_gradebook_from_bin_file(const char *file_name, const char *class_name) {
+    if (file_name == NULL || class_name == NULL || strlen(class_name) >= MAX_NAME_LEN) {
         return NULL;
     }
-    fscanf(pf, "%d", &(new_book->size));
-    char name[MAX_NAME_LEN] = {0};
-    int score = -1;
-    for (int i = 0; i < new_book->size; i++) {	
-        fscanf(pf, "%s %d", name, &score);
-        add_score(new_book, name, score);
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
     }
-    fclose(pf);
-    pf = NULL;
-    return new_book;
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    const bin_header_t *header = mapping;
+    gradebook_t *book = malloc(sizeof(gradebook_t));
+    if (book == NULL || !valid_bin_header(header, st.st_size) ||
+        !valid_bin_body(header, mapping)) {
+        free(book);
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+    char *base = mapping;
+    strcpy(book->class_name, class_name);
+    book->table.ctrl = (uint8_t *) (base + header->ctrl_off);
+    book->table.slots = (uint32_t *) (base + header->slots_off);
+    book->table.capacity = header->capacity;
+    memset(&book->old, 0, sizeof(table_t));
+    book->migrate_pos = 0;
+    book->size = header->size;
+    book->hash_kind = header->hash_kind;
+    // The aggregates are rebuilt by the first query that needs them
+    memset(&book->stats, 0, sizeof(score_stats_t));
+    memset(&book->by_score, 0, sizeof(score_index_t));
+    book->snapshot = NULL;
+    memset(&book->lazy, 0, sizeof(lazy_text_t));
+    memset(&book->filter, 0, sizeof(filter_t));
+    book->mapping = mapping;
+    book->mapping_len = st.st_size;
+    memset(&book->order, 0, sizeof(name_index_t));
+    book->order.run = (index_entry_t *) (base + header->order_off);
+    book->order.run_len = header->size;
+    book->order.run_cap = header->size;
+
+    // Only the directories are allocated: one pointer per slab and chunk
+    memset(&book->nodes, 0, sizeof(node_pool_t));
+    book->nodes.free_head = NO_NODE;
+    book->nodes.num_slabs = (header->num_nodes + SLAB_NODES - 1) / SLAB_NODES;
+    book->nodes.max_slabs = book->nodes.num_slabs;
+    book->nodes.used = header->num_nodes - (book->nodes.num_slabs == 0 ? 0 :
+                                            (book->nodes.num_slabs - 1) * SLAB_NODES);
+    book->nodes.slabs = malloc(book->nodes.num_slabs * sizeof(node_t *));
+    memset(&book->names, 0, sizeof(name_pool_t));
+    book->names.num_chunks = (header->names_bytes + NAME_CHUNK_SIZE - 1) / NAME_CHUNK_SIZE;
+    book->names.max_chunks = book->names.num_chunks;
+    book->names.used = header->names_bytes - (book->names.num_chunks == 0 ? 0 :
+                       (uint64_t) (book->names.num_chunks - 1) * NAME_CHUNK_SIZE);
+    book->names.chunks = malloc(book->names.num_chunks * sizeof(char *));
+    if ((book->nodes.num_slabs > 0 && book->nodes.slabs == NULL) ||
+        (book->names.num_chunks > 0 && book->names.chunks == NULL)) {
+        free_gradebook(book);
+        return NULL;
+    }
+    for (unsigned i = 0; i < book->nodes.num_slabs; i++) {
+        book->nodes.slabs[i] = (node_t *) (base + header->nodes_off) + (size_t) i * SLAB_NODES;
+    }
+    for (unsigned i = 0; i < book->names.num_chunks; i++) {
+        book->names.chunks[i] = base + header->names_off + (size_t) i * NAME_CHUNK_SIZE;
+    }
+    return book;
 }
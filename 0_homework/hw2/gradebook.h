@@ -1,26 +1,358 @@
+#ifndef GRADEBOOK_H
+#define GRADEBOOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
 #define MAX_NAME_LEN 64
-#define NUM_BUCKETS 1741
 
-// Data type for elements in each hash bucket
+// The table is probed one group of control bytes at a time; a group is
+// exactly one 16-byte SSE2 register and always lies within one cache line
+#define GROUP_SIZE 16
+#define INITIAL_CAPACITY 128 // Slots in a fresh gradebook (multiple of GROUP_SIZE)
+#define MAX_LOAD_NUM 7       // Grow once size exceeds 7/8 of capacity
+#define MAX_LOAD_DEN 8
+#define MIGRATE_GROUPS 4     // Groups moved to the new table per add while growing
+#define SLAB_NODES 1024      // Nodes carved out of each slab allocation
+#define NAME_CHUNK_SIZE 65536 // Bytes per name pool chunk (a power of two)
+#define BATCH_DISTANCE 8     // Names between prefetch stages in batch calls
+#define MIN_PENDING 256      // Names the sorted index buffers before its first merge
+#define NO_NODE UINT32_MAX   // Node id meaning "none"
+#define READ_BLOCK_SIZE (1 << 20) // Bytes read at a time when loading text files
+#define WRITE_BUFFER_SIZE (1 << 20) // Bytes formatted before each write when saving
+#define STATS_SUB_BITS 6     // Score histogram has 2^STATS_SUB_BITS buckets per power of two
+#define STATS_TOP_K 64       // Best scores a book keeps ranked
+#define SCORE_NODE_SIZE 32   // Entries per score index leaf, children per inner node
+#define LAZY_INDEX_STRIDE 64 // Lines of a text file per entry of its lazy index
+#define PARALLEL_MAX_THREADS 64 // Most threads a parallel text load uses
+#define PARALLEL_MIN_CHUNK 4096 // Fewest bytes of a text file worth a thread of their own
+#define MERGE_PARTITION_BITS 8 // A merge probes in 2^8 partitions of the destination table
+#define MERGE_MIN_THREAD_ENTRIES 65536 // Fewest merged entries worth a probe thread
+#define FILTER_BLOCK_WORDS 8 // A filter block is one 64-byte cache line of bits
+#define FILTER_MAX_HASHES 16 // Most bits a name sets in its filter block
+
+// Control bytes for slots without an entry; used slots hold a 7-bit
+// fingerprint of the name's hash, so the high bit tells used from unused.
+// CTRL_MOVED marks a slot whose entry was migrated out of the old table:
+// probes keep walking past it, but stop at CTRL_EMPTY.
+#define CTRL_EMPTY 0x80
+#define CTRL_MOVED 0xfe
+
+// Data type for the entry stored in each used slot. The name itself lives
+// in the book's name pool; lookups compare hash and length first and only
+// then memcmp the pooled bytes.
 typedef struct node {
-    char name[MAX_NAME_LEN]; // Student's Name
-    int score;               // Student's Assignment Score
-    struct node *next;       // Next node in list, or NULL if no next node
+    uint32_t hash;     // Full hash of the student's name
+    uint32_t name_off; // Offset of the name in the name pool
+    uint32_t name_len; // Length of the name, not counting its '\0'
+    int score;         // Student's Assignment Score
 } node_t;
 
-// Gradebook data type
+// Nodes are carved out of SLAB_NODES-sized slabs owned by the gradebook,
+// so adding a score does not call malloc and freeing the book releases
+// whole slabs. Nodes are named by a 32-bit id: slab id / SLAB_NODES, index
+// id % SLAB_NODES. A released node is threaded onto free_head through its
+// name_off field and handed out again before the slabs are touched.
+typedef struct {
+    node_t **slabs;     // Slab directory
+    unsigned num_slabs; // Slabs allocated so far
+    unsigned max_slabs; // Room in the slab directory
+    unsigned used;      // Nodes handed out from the last slab
+    uint32_t free_head; // First released node, or NO_NODE
+} node_pool_t;
+
+// Names are packed back to back, '\0'-terminated, into fixed-size chunks
+// that never move. An offset is chunk * NAME_CHUNK_SIZE + position; a name
+// never straddles two chunks.
+typedef struct {
+    char **chunks;       // Chunk directory
+    unsigned num_chunks; // Chunks allocated so far
+    unsigned max_chunks; // Room in the chunk directory
+    unsigned used;       // Bytes used in the last chunk
+} name_pool_t;
+
+// A node id with the first eight bytes of its name, big-endian and
+// zero-padded, so most comparisons never touch the node or its name
+typedef struct {
+    uint32_t key[2]; // Name bytes 0-3 and 4-7
+    uint32_t id;     // Node id
+} index_entry_t;
+
+// Node ids in name order, so print and write_text can stream entries
+// sorted without sorting the whole book each time. New names go into an
+// unsorted merge buffer, which is sorted and merged into the run before
+// each sorted walk, or once it holds as many entries as the run (and at
+// least MIN_PENDING), so every entry is merged O(1) times on average.
+typedef struct {
+    index_entry_t *run;     // Entries sorted by name
+    unsigned run_len;       // Entries in run
+    unsigned run_cap;       // Room in run
+    index_entry_t *pending; // Entries for names added since the last merge
+    unsigned pending_len;   // Entries in pending
+    unsigned pending_cap;   // Room in pending
+} name_index_t;
+
+// Hash functions a book can use. The kind is stored in binary files,
+// since node hashes are saved with the nodes.
+typedef enum {
+    HASH_WY,     // wyhash-style, a word at a time (the default)
+    HASH_DJB2,   // djb2, a byte at a time
+    HASH_KINDS   // Number of kinds
+} hash_kind_t;
+
+// Score histogram layout. Scores from 0 to 2 * STATS_SUB - 1 are counted
+// one value per bucket; above that every power of two is split into
+// STATS_SUB buckets, so a bucket is never wider than 1/STATS_SUB of the
+// scores in it. Negative scores mirror the positive buckets below them.
+// Buckets come in groups of STATS_SUB, allocated the first time a score
+// lands in them, so a class whose scores span 0-100 uses two groups.
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_HALF_GROUPS (32 - STATS_SUB_BITS) // Groups for scores >= 0
+#define STATS_GROUPS (2 * STATS_HALF_GROUPS)
+
+// Score aggregates, updated by every add and score change so they can be
+// read without walking the book. When an update cannot be followed
+// exactly (the last entry with the min or max score changing while the
+// next lowest or highest score is in a bucket wider than one score, or no
+// memory for a new bucket group), valid is cleared and the whole thing is
+// rebuilt from the nodes by the next query. Books loaded from binary
+// files start out invalid.
+//
+// top holds the STATS_TOP_K highest-ranked entries in rank order:
+// highest score first, ties by name. Every entry outside it ranks below
+// every entry in it. A member whose score drops below that line leaves,
+// and top holds fewer than STATS_TOP_K entries until a query needing more
+// rebuilds it.
+typedef struct {
+    int score;   // Copy of the node's score
+    uint32_t id; // Node id
+} top_entry_t;
+
+typedef struct {
+    int valid;                           // 0 if everything below must be rebuilt
+    int64_t sum;                         // Sum of all scores
+    int min;                             // Lowest score (INT_MAX if empty)
+    int max;                             // Highest score (INT_MIN if empty)
+    unsigned min_count;                  // Entries scoring min
+    unsigned max_count;                  // Entries scoring max
+    unsigned group_counts[STATS_GROUPS]; // Scores in each bucket group
+    unsigned *groups[STATS_GROUPS];      // STATS_SUB bucket counts, or NULL if all zero
+    top_entry_t top[STATS_TOP_K];        // Highest-ranked entries, best first
+    unsigned top_len;                    // Entries in top
+} score_stats_t;
+
+// An entry of the score index: a score and the name index entry of the
+// node holding it. Entries are ordered by score, then by name.
+typedef struct {
+    int score;
+    index_entry_t entry;
+} score_entry_t;
+
+// A node of the score index, a B+-tree over every entry. Each node counts
+// the entries beneath it, so ranks and range sizes are found in one
+// descent, and leaves are linked in order for range walks.
+typedef struct score_node {
+    unsigned len;               // Entries in a leaf, children in an inner node
+    unsigned count;             // Entries in this subtree
+    int leaf;                   // Whether this is a leaf
+    struct score_node *prev;    // Neighbouring leaves (leaves only)
+    struct score_node *next;
+    union {
+        score_entry_t entries[SCORE_NODE_SIZE]; // Leaf entries in order
+        struct {
+            score_entry_t low[SCORE_NODE_SIZE]; // At or below every entry of children[i]
+            struct score_node *children[SCORE_NODE_SIZE];
+        } inner;
+    };
+} score_node_t;
+
+// Every score, ordered by score and then name, for range queries. The
+// tree is built by the first query that needs it and kept in step with
+// every add from then on, so books that are never range-queried pay
+// nothing for it. Scores move but entries are never removed from a book,
+// so nodes are split but never merged; a leaf left empty is unlinked.
+// Should an update fail for lack of memory, the tree is dropped and
+// rebuilt by the next query.
+typedef struct {
+    score_node_t *root; // NULL until built
+    unsigned num_nodes; // Nodes allocated
+} score_index_t;
+
+// The text file behind a book opened with read_gradebook_from_text_lazy.
+// It stays mapped, answering lookups, until something needs the entries
+// themselves; then they are all loaded and the file is unmapped.
+typedef struct {
+    const char *data;   // Mapped file, or NULL if the book is loaded
+    size_t len;         // Length of data in bytes
+    uint64_t *marks;    // Offset of every LAZY_INDEX_STRIDE-th line, from the index
+    unsigned num_marks;
+} lazy_text_t;
+
+// An open-addressing hash table. ctrl[i] describes slots[i]; lookups
+// compare 16 fingerprints at once and only look at nodes whose
+// fingerprint matches.
+typedef struct {
+    uint8_t *ctrl;     // Control bytes, one per slot (16-byte aligned)
+    uint32_t *slots;   // Node ids, valid where ctrl is a fingerprint
+    unsigned capacity; // Number of slots, a power of two (0 if unallocated)
+} table_t;
+
+// An optional blocked Bloom filter in front of the table. Each name sets
+// num_hashes bits, all in one block picked by its hash, so a lookup that
+// finds any of them clear knows the name is absent after one cache miss
+// and never probes the table. The filter is sized for the most entries
+// the current table takes and is rebuilt when the table grows. It works
+// from the names' 32-bit hashes, so around size / 2^32 of absent names
+// get through however low fp_rate is.
+typedef struct {
+    uint64_t *blocks;    // num_blocks blocks of FILTER_BLOCK_WORDS words, or NULL
+    unsigned num_blocks; // Blocks in the filter
+    unsigned num_hashes; // Bits each name sets in its block
+    double fp_rate;      // False positive rate asked for, or 0 if the book has no filter
+} filter_t;
+
+// Gradebook data type. Growing allocates a table twice the size and then
+// moves MIGRATE_GROUPS groups of the old table over on every add_score, so
+// no single call pays for the whole rehash. While old has slots, an entry
+// may live in either table; lookups search both and never move anything.
+//
+// A book loaded with read_gradebook_from_bin has its table, slabs, name
+// chunks and sorted run pointing straight into the mapped file. It is
+// copied to the heap the first time it is modified.
+//
+// While a snapshot is live, the book copies a slab before changing a
+// score in it, and copies the index arrays before merging or growing
+// them, whenever the snapshot still shares them.
+//
+// A book opened with read_gradebook_from_text_lazy starts out empty with
+// its file in lazy. find_score and find_scores_batch search the file;
+// every other call loads it into the book first.
+//
+// A book with a filter answers most lookups of absent names from it.
 typedef struct {
     char class_name[MAX_NAME_LEN]; // Name of class for grades
-    node_t *buckets[NUM_BUCKETS];  // Hash table buckets (linked list heads)
+    table_t table;                 // Current table; new entries always go here
+    table_t old;                   // Table being drained, or capacity 0
+    unsigned migrate_pos;          // Next group of old to move into table
+    node_pool_t nodes;             // Storage for every node in the book
+    name_pool_t names;             // Storage for every student name
+    name_index_t order;            // Every node, sorted by name
+    void *mapping;                 // File the arrays above point into, or NULL
+    size_t mapping_len;            // Length of mapping in bytes
     unsigned size;                 // Total number of entries in gradebook
+    hash_kind_t hash_kind;         // Hash used for every name in the book
+    score_stats_t stats;           // Aggregates over every score
+    score_index_t by_score;        // Every entry, sorted by score
+    struct gradebook_snapshot *snapshot; // Live snapshot sharing this book's memory, or NULL
+    lazy_text_t lazy;              // Text file not loaded yet
+    filter_t filter;               // Filter for absent names, or none
 } gradebook_t;
 
+// A read-only view of a book as it was when snapshot_gradebook was
+// called. view shares the book's slabs, name chunks and index arrays;
+// only the slab and chunk directories are copied. Nodes added afterwards
+// go where the view never looks (past its directories or index), and
+// anything the book would change in place is copied first, with the
+// original kept on the retired list until the snapshot is released.
+typedef struct gradebook_snapshot {
+    gradebook_t view;              // The book's nodes, names and index as they were;
+                                   // it has no table, so it cannot be searched
+    gradebook_t *book;             // The book the snapshot was taken of
+    index_entry_t *shared_run;     // The book's run when the snapshot was taken
+    index_entry_t *shared_pending; // The book's merge buffer when the snapshot was taken
+    void **retired;                // Buffers the book replaced instead of changing
+    unsigned num_retired;          // Buffers in retired
+    void *retired_mapping;         // The book's mapping, if it was copied to the heap since
+    size_t retired_mapping_len;    // Length of retired_mapping
+} gradebook_snapshot_t;
+
+// Probe lengths of a book's table, from gradebook_probe_stats. A probe
+// length is the number of groups looked at to find an entry.
+#define PROBE_HISTOGRAM_SIZE 16
+typedef struct {
+    unsigned histogram[PROBE_HISTOGRAM_SIZE]; // Entries by probe length; the
+                                              // last bucket holds longer ones
+    unsigned max_probe;     // Longest probe for any entry
+    double mean_probe;      // Average probe over all entries
+    unsigned full_groups;   // Groups without an empty slot, which misses probe past
+    unsigned num_groups;    // Groups in the table, and in the old one while growing
+} probe_stats_t;
+
+// Size and expected accuracy of a book's filter, from gradebook_filter_stats
+typedef struct {
+    size_t bytes;           // Memory the filter's blocks take, or 0 if there is no filter
+    unsigned num_hashes;    // Bits each name sets
+    double bits_per_name;   // Filter bits per entry in the book
+    double fp_rate;         // Expected share of absent names that get past the filter now
+} filter_stats_t;
+
+// How merge_gradebooks combines the scores of a student in both books
+typedef enum {
+    MERGE_MAX,      // The higher score
+    MERGE_LATEST,   // The source book's score
+    MERGE_SUM,      // Both scores added, saturating at INT_MIN and INT_MAX
+    MERGE_POLICIES  // Number of policies
+} merge_policy_t;
+
+// Summary of a book's scores, from gradebook_stats
+typedef struct {
+    unsigned count; // Number of scores
+    int64_t sum;    // Sum of the scores
+    double mean;    // sum / count, or 0 if there are no scores
+    int min;        // Lowest score, or 0 if there are none
+    int max;        // Highest score, or 0 if there are none
+} score_summary_t;
+
+// djb2 hash of the first len bytes of str
+unsigned hash(const char *str, size_t len);
+
+// wyhash-style hash of the first len bytes of str, mixing eight bytes at
+// a time with 64x64->128-bit multiplies
+unsigned hash_wy(const char *str, size_t len);
+
+// The full 64 bits hash_wy folds in half
+uint64_t hash_wy64(const char *str, size_t len);
+
+// The hash function for each hash_kind_t
+extern unsigned (*const hash_functions[HASH_KINDS])(const char *str, size_t len);
 
 // Create a new gradebook instance
 // class_name: The name of the class for grades
+// capacity: Number of entries to size the table for up front,
+//           or 0 to start small and grow as scores are added
 // Returns: Pointer to a gradebook_t representing an empty gradebook
 //          or NULL if an error occurs
-gradebook_t *create_gradebook(const char *class_name);
+gradebook_t *create_gradebook(const char *class_name, unsigned capacity);
+
+// Choose the hash function for a book. Only an empty book can switch.
+// book: A pointer to the gradebook
+// kind: The hash to use
+// Returns: 0 on success or -1 if the book is not empty or kind is invalid
+int set_gradebook_hash(gradebook_t *book, hash_kind_t kind);
+
+// Put a filter in front of a book's table so lookups of absent names
+// mostly stop there, or take it away. The filter is built from the
+// book's entries now (or, for a lazy book, once it is loaded) and kept
+// up to date by every later add.
+// book: A pointer to the gradebook
+// fp_rate: Share of absent names allowed past the filter, above 0 and
+//          below 1, or 0 to remove the filter
+// Returns: 0 on success or -1 if fp_rate is out of range or no memory is
+//          available, which leaves the book as it was
+int set_gradebook_filter(gradebook_t *book, double fp_rate);
+
+// Measure a book's filter
+// book: A pointer to the gradebook
+// stats: Filled in with the filter's size and expected false positive
+//        rate, or zeroed if the book has no filter
+void gradebook_filter_stats(const gradebook_t *book, filter_stats_t *stats);
+
+// Measure how far entries sit from their home group, each in whichever
+// table of a growing book it is in. The book is only read: nothing is
+// migrated, and a lazy book is not loaded but measured as empty.
+// book: A pointer to the gradebook to measure
+// stats: Filled in with the measurements
+void gradebook_probe_stats(const gradebook_t *book, probe_stats_t *stats);
 
 // Returns a pointer to the gradebook class name
 // book: A pointer to a gradebook to get the class name of
@@ -35,28 +367,246 @@ const char *get_gradebook_name(const gradebook_t *book);
 //          or -1 if the score could not be added/updated
 int add_score(gradebook_t *book, const char *name, int score);
 
-// Search for a specific student's score in the gradebook
+// Search for a specific student's score in the gradebook. The book is
+// only read, so several threads may search it at once while none
+// modifies it.
 // book: A pointer to a gradebook to search for the student score in
 // name: The student's name
 // Returns: The student's score if their name is found
 //          or -1 if no matching student name is found
 int find_score(const gradebook_t *book, const char *name);
 
-// Print out all scores in the gradebook
+// Add or update many scores at once. Names are hashed and their table
+// groups, nodes and names prefetched a few BATCH_DISTANCEs ahead of being
+// resolved, so the cache misses of several names overlap.
+// book: A pointer to a gradebook to add the scores to
+// names: The students' names
+// scores: The students' scores, scores[i] going with names[i]
+// n: The number of names
+// Returns: n if every score was added/updated, otherwise the index of the
+//          first one that could not be (earlier ones are kept)
+unsigned add_scores_batch(gradebook_t *book, const char *const *names, const int *scores,
+                          unsigned n);
+
+// Search for many students' scores at once, prefetching like
+// add_scores_batch
+// book: A pointer to a gradebook to search for the student scores in
+// names: The students' names
+// scores: Filled in with each student's score, or -1 if not found
+// n: The number of names
+// Returns: The number of names found
+unsigned find_scores_batch(const gradebook_t *book, const char *const *names, int *scores,
+                           unsigned n);
+
+// Merge every score of src into dst as a partitioned hash join. dst's
+// table is sized for both books at once, src's entries are split into
+// partitions of dst's table by home group, and the partitions are probed
+// in table order, on several threads once there are enough entries.
+// The matches and new names are then applied to dst on this thread, in
+// the same order. src's scores are not changed unless it is dst, but a
+// lazy src is loaded and a growing one finishes migrating.
+// dst: A pointer to the gradebook to merge into
+// src: A pointer to the gradebook to merge from
+// policy: How to combine the scores of a student in both books
+// Returns: The number of students of src that were new to dst, or -1 if
+//          policy is invalid or memory ran out (some scores may be merged)
+long merge_gradebooks(gradebook_t *dst, gradebook_t *src, merge_policy_t policy);
+
+// Call visit on every student of book whose name is not in other, in
+// name order: an anti-join of the two books
+// book: A pointer to the gradebook to list students of
+// other: A pointer to the gradebook to leave out the students of
+// visit: Called with each student's name, score and arg
+// arg: Passed through to visit
+// Returns: The number of students visited
+unsigned for_each_not_in(gradebook_t *book, gradebook_t *other,
+                         void (*visit)(const char *name, int score, void *arg), void *arg);
+
+// Summarize the book's scores in O(1). Only after a book is loaded from a
+// binary file, or an update the running aggregates could not follow, are
+// the scores walked to rebuild them.
+// book: A pointer to the gradebook to summarize
+// summary: Filled in with the count, sum, mean, min and max
+// Returns: 0 on success or -1 if the aggregates could not be rebuilt
+int gradebook_stats(gradebook_t *book, score_summary_t *summary);
+
+// Find the score at a percentile (nearest rank) from the score histogram.
+// Scores of 2 * STATS_SUB or more are reported as the lowest score of
+// their bucket, which is within 1/STATS_SUB of the true value.
+// book: A pointer to the gradebook to look in
+// percent: Percentile to find, from 0 to 100
+// score: Set to the score at that percentile
+// Returns: 0 on success, or -1 if the book is empty, percent is out of
+//          range or the aggregates could not be rebuilt
+int score_percentile(gradebook_t *book, double percent, int *score);
+
+// List the highest scores, highest first and ties in name order. This is
+// a copy of the book's ranked entries, so O(k) while enough of them are
+// kept.
+// book: A pointer to the gradebook to look in
+// k: Number of scores wanted, at most STATS_TOP_K
+// names: Filled in with the students' names, valid until the book is next
+//        modified
+// scores: Filled in with their scores
+// Returns: The number of entries filled in (fewer than k if the book is
+//          smaller), or 0 if the aggregates could not be rebuilt
+unsigned top_scores(gradebook_t *book, unsigned k, const char **names, int *scores);
+
+// Call visit on every student whose name starts with prefix, in name
+// order. The book's name index is binary searched for the first match,
+// so this takes O(log n + k) for k matches and no memory beyond the
+// index.
+// book: A pointer to the gradebook to search
+// prefix: Start of the names wanted; "" matches every name
+// visit: Called with each student's name, score and arg
+// arg: Passed through to visit
+// Returns: The number of students visited
+unsigned for_each_with_prefix(gradebook_t *book, const char *prefix,
+                              void (*visit)(const char *name, int score, void *arg), void *arg);
+
+// Call visit on every score from lo to hi inclusive, lowest first and
+// ties in name order. Takes O(log n + k) for k scores in range once the
+// book's score index is built; the first range query builds it.
+// book: A pointer to the gradebook to walk
+// lo: Lowest score to visit
+// hi: Highest score to visit
+// visit: Called with each student's name, score and arg
+// arg: Passed through to visit
+// Returns: The number of scores visited, or -1 if the score index could
+//          not be built
+long for_each_in_range(gradebook_t *book, int lo, int hi,
+                       void (*visit)(const char *name, int score, void *arg), void *arg);
+
+// Count the scores from lo to hi inclusive in O(log n), building the
+// book's score index if needed
+// book: A pointer to the gradebook to count in
+// lo: Lowest score to count
+// hi: Highest score to count
+// Returns: The number of scores in range, or -1 if the score index could
+//          not be built
+long count_range(gradebook_t *book, int lo, int hi);
+
+// Print out all scores in the gradebook, sorted by student name
 // book: A pointer to the gradebook containing the scores to print
-void print_gradebook(const gradebook_t *book);
+void print_gradebook(gradebook_t *book);
+
+// Call visit on every score in the gradebook, in no particular order
+// book: A pointer to the gradebook to walk
+// visit: Called with each student's name, score and arg
+// arg: Passed through to visit
+void for_each_score(gradebook_t *book,
+                    void (*visit)(const char *name, int score, void *arg), void *arg);
+
+// Count the memory the gradebook holds, including slack in its tables,
+// slabs and name chunks
+// book: A pointer to the gradebook to measure
+// Returns: The number of bytes allocated for the gradebook
+size_t gradebook_memory_usage(const gradebook_t *book);
 
 // Frees all memory used to store the contents of the gradebook
 // book: A pointer to the gradebook to free
 void free_gradebook(gradebook_t *book);
 
-// Write out all scores in the gradebook to a text file
+// Write out all scores in the gradebook to <class>.txt, sorted by student
+// name. The file is
+// replaced atomically: it is written to <class>.txt.tmp and renamed.
+// <class>.txt.idx is written after it for read_gradebook_from_text_lazy.
 // book: A pointer to the gradebook containing the scores to write out
-int write_gradebook_to_text(const gradebook_t *book);
+// Returns: 0 on success or -1 if the file could not be written
+int write_gradebook_to_text(gradebook_t *book);
+
+// Take a point-in-time, read-only snapshot of a gradebook for another
+// thread to write out while this one keeps adding scores. It costs one
+// pointer per SLAB_NODES entries and per NAME_CHUNK_SIZE bytes of names;
+// nothing per entry is copied. A book has at most one live snapshot.
+// book: A pointer to the gradebook to snapshot
+// Returns: A pointer to the new snapshot
+//          or NULL if the book already has one or no memory is available
+gradebook_snapshot_t *snapshot_gradebook(gradebook_t *book);
+
+// Write out every score in a snapshot to <class>.txt, in the same format
+// as write_gradebook_to_text. It may run on any one thread, alongside
+// calls on the book from the thread that owns it.
+// snapshot: A pointer to the snapshot to write out
+// Returns: 0 on success or -1 if the file could not be written
+int write_snapshot_to_text(gradebook_snapshot_t *snapshot);
+
+// Release a snapshot once nothing is using it, from the thread that owns
+// the book. Every snapshot must be released before its book is freed.
+// snapshot: A pointer to the snapshot to release
+void release_snapshot(gradebook_snapshot_t *snapshot);
 
-// Read in all scores from a text file and add to a new gradebook
+// Read in all scores from a text file and add to a new gradebook. The
+// file must start with the number of entries, followed by exactly that
+// many "<name> <score>" pairs; the table is sized from that count.
 // file_name: The name of the text file to read
 // Returns: A pointer to a new gradebook with all scores as recorded in the file
 //          or NULL if the read operation fails
 gradebook_t *read_gradebook_from_text(const char *file_name);
 
+// Open a text file without reading its entries into the book. Only the
+// count and the index write_gradebook_to_text left beside the file,
+// <file>.idx, are read: lookups binary search the lines the index points
+// to and scan at most LAZY_INDEX_STRIDE lines from there, and the entries
+// are loaded the first time anything else is asked of the book. A file
+// with no index, or one changed since its index was written, cannot be
+// trusted to be sorted and is loaded right away instead.
+// file_name: The name of the text file to open
+// Returns: A pointer to a new gradebook backed by the file
+//          or NULL if the file cannot be mapped, has no valid count, or
+//          is not sorted and cannot be loaded
+gradebook_t *read_gradebook_from_text_lazy(const char *file_name);
+
+// Read a text file on several threads. The file is cut into chunks of
+// whole lines, and each thread parses and hashes its chunk into runs, one
+// per partition of the table: a partition is a contiguous range of
+// groups, found from the top bits of each name's home group. The table is
+// sized from the file's count up front, so each partition's range, node
+// ids and name chunks can then be filled by one thread without locks; the
+// few names whose probe runs past their range are inserted afterwards.
+// Score aggregates and the name order are left for the first query that
+// needs them. The file must be one "<name> <score>" line per entry, as
+// write_gradebook_to_text writes it; any other layout is read on one
+// thread, as read_gradebook_from_text would.
+// file_name: The name of the text file to read
+// num_threads: Threads to use, at most PARALLEL_MAX_THREADS and one per
+//              PARALLEL_MIN_CHUNK bytes of the file, or 0 for one per
+//              online core
+// Returns: A pointer to a new gradebook with all scores as recorded in the file
+//          or NULL if the read operation fails
+gradebook_t *read_gradebook_from_text_parallel(const char *file_name, unsigned num_threads);
+
+// Write out the gradebook's hash table, nodes and names to <class>.bin in
+// a layout that read_gradebook_from_bin can use without parsing. Finishes
+// any in-progress table growth first. Like the text file, it is written
+// to a temporary file and renamed into place.
+// book: A pointer to the gradebook containing the scores to write out
+// Returns: 0 on success or -1 if the file could not be written
+int write_gradebook_to_bin(gradebook_t *book);
+
+// As write_gradebook_to_bin, but to file_name rather than <class>.bin
+// book: A pointer to the gradebook containing the scores to write out
+// file_name: The name of the binary file to write
+// Returns: 0 on success or -1 if the file could not be written
+int write_gradebook_to_bin_file(gradebook_t *book, const char *file_name);
+
+// Map a binary file written by write_gradebook_to_bin and wrap it in a new
+// gradebook. Lookups are answered from the mapping; nothing is parsed or
+// allocated per entry. Besides the header, one pass over the table and
+// the name order checks that every node id is in range and every name
+// it leads to lies in the names section and ends in '\0', so a corrupted
+// file is rejected rather than read out of bounds.
+// file_name: The name of the binary file to read
+// Returns: A pointer to a new gradebook backed by the file
+//          or NULL if the read operation fails
+gradebook_t *read_gradebook_from_bin(const char *file_name);
+
+// As read_gradebook_from_bin, but the book is named class_name whatever
+// the file is called
+// file_name: The name of the binary file to read
+// class_name: The name of the class the file holds
+// Returns: A pointer to a new gradebook backed by the file
+//          or NULL if the read operation fails
+gradebook_t *read_gradebook_from_bin_file(const char *file_name, const char *class_name);
+
+#endif
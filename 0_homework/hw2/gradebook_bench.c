@@ -0,0 +1,1709 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "catalog.h"
+#include "concurrent_gradebook.h"
+#include "frozen.h"
+#include "gradebook.h"
+#include "journal.h"
+#include "latency.h"
+
+// Benchmarks for the gradebook engine. Build with "make bench" and run
+//   ./gradebook_bench <benchmark> [num_names]
+// Names are generated the same way as test_cases/input/create_large.txt
+// (seven random lowercase letters, scores 0-1999), just many more of them.
+
+#define BENCH_NAME_LEN 8
+#define DEFAULT_NUM_NAMES 2000000
+#define MAX_LOOKUPS 1000000
+#define LEGACY_MAX_NAMES 250000 // Chained adds are O(n / 1741) each; cap the baseline
+
+typedef struct {
+    char (*names)[BENCH_NAME_LEN]; // Names that get added
+    char (*misses)[BENCH_NAME_LEN]; // Names that are never added
+    int *scores;
+    unsigned n;
+} workload_t;
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+// xorshift64, so every run sees the same names
+static unsigned long long next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void random_name(char *out, char first) {
+    out[0] = first;
+    for (int i = 1; i < BENCH_NAME_LEN - 1; i++) {
+        out[i] = 'a' + next_rand() % 26;
+    }
+    out[BENCH_NAME_LEN - 1] = '\0';
+}
+
+static int make_workload(workload_t *w, unsigned n) {
+    w->n = n;
+    w->names = malloc(sizeof(*w->names) * n);
+    w->misses = malloc(sizeof(*w->misses) * n);
+    w->scores = malloc(sizeof(int) * n);
+    if (w->names == NULL || w->misses == NULL || w->scores == NULL) {
+        return -1;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        // hits start with a-m and misses with n-z so the two never overlap
+        random_name(w->names[i], 'a' + next_rand() % 13);
+        random_name(w->misses[i], 'n' + next_rand() % 13);
+        w->scores[i] = next_rand() % 2000;
+    }
+    return 0;
+}
+
+static void free_workload(workload_t *w) {
+    free(w->names);
+    free(w->misses);
+    free(w->scores);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *engine, const char *op, double elapsed_ns, unsigned ops) {
+    printf("%-8s %-12s %10u ops %10.1f ns/op\n", engine, op, ops, elapsed_ns / ops);
+}
+
+// The chained table gradebook.c used before the open-addressing engine,
+// kept here as the baseline the new engine is measured against
+#define LEGACY_NUM_BUCKETS 1741
+
+typedef struct legacy_node {
+    char name[MAX_NAME_LEN];
+    int score;
+    struct legacy_node *next;
+} legacy_node_t;
+
+typedef struct {
+    legacy_node_t *buckets[LEGACY_NUM_BUCKETS];
+    unsigned size;
+} legacy_book_t;
+
+static unsigned legacy_hash(const char *str) {
+    unsigned hash_val = 5381;
+    for (int i = 0; str[i] != '\0'; i++) {
+        hash_val = ((hash_val << 5) + hash_val) + str[i];
+    }
+    return hash_val % LEGACY_NUM_BUCKETS;
+}
+
+static int legacy_add(legacy_book_t *book, const char *name, int score) {
+    unsigned idx = legacy_hash(name);
+    for (legacy_node_t *curr = book->buckets[idx]; curr != NULL; curr = curr->next) {
+        if (strcmp(curr->name, name) == 0) {
+            curr->score = score;
+            return 0;
+        }
+    }
+    legacy_node_t *node = malloc(sizeof(legacy_node_t));
+    if (node == NULL) {
+        return -1;
+    }
+    strncpy(node->name, name, MAX_NAME_LEN - 1);
+    node->name[MAX_NAME_LEN - 1] = '\0';
+    node->score = score;
+    node->next = book->buckets[idx];
+    book->buckets[idx] = node;
+    book->size++;
+    return 0;
+}
+
+static int legacy_find(const legacy_book_t *book, const char *name) {
+    for (legacy_node_t *curr = book->buckets[legacy_hash(name)]; curr != NULL; curr = curr->next) {
+        if (strcmp(curr->name, name) == 0) {
+            return curr->score;
+        }
+    }
+    return -1;
+}
+
+static void legacy_free(legacy_book_t *book) {
+    for (int i = 0; i < LEGACY_NUM_BUCKETS; i++) {
+        legacy_node_t *curr = book->buckets[i];
+        while (curr != NULL) {
+            legacy_node_t *next = curr->next;
+            free(curr);
+            curr = next;
+        }
+    }
+    free(book);
+}
+
+// Allocator calls are counted by interposing on malloc and friends; the
+// real allocator is reached through glibc's __libc_* entry points
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_calls;
+static unsigned long free_calls;
+
+void *malloc(size_t size) {
+    alloc_calls++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_calls++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_calls++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr != NULL) {
+        free_calls++;
+    }
+    __libc_free(ptr);
+}
+
+// Volatile sink so lookups are not optimized away
+static volatile long sink;
+
+static void bench_table(const workload_t *w) {
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    double start;
+    long total;
+
+    gradebook_t *book = create_gradebook("bench", 0);
+    start = now_ns();
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    report("open", "add", now_ns() - start, w->n);
+    start = now_ns();
+    total = 0;
+    for (unsigned i = 0; i < lookups; i++) {
+        total += find_score(book, w->names[(i * 7919ULL) % w->n]);
+    }
+    report("open", "find_hit", now_ns() - start, lookups);
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += find_score(book, w->misses[i]);
+    }
+    report("open", "find_miss", now_ns() - start, lookups);
+    sink = total;
+    free_gradebook(book);
+
+    unsigned legacy_n = w->n < LEGACY_MAX_NAMES ? w->n : LEGACY_MAX_NAMES;
+    legacy_book_t *legacy = calloc(1, sizeof(legacy_book_t));
+    start = now_ns();
+    for (unsigned i = 0; i < legacy_n; i++) {
+        legacy_add(legacy, w->names[i], w->scores[i]);
+    }
+    report("chained", "add", now_ns() - start, legacy_n);
+    // Chains average n / 1741 links, so a fraction of the lookups is plenty
+    lookups = lookups / 100 + 1;
+    start = now_ns();
+    total = 0;
+    for (unsigned i = 0; i < lookups; i++) {
+        total += legacy_find(legacy, w->names[(i * 7919ULL) % legacy_n]);
+    }
+    report("chained", "find_hit", now_ns() - start, lookups);
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += legacy_find(legacy, w->misses[i]);
+    }
+    report("chained", "find_miss", now_ns() - start, lookups);
+    sink = total;
+    legacy_free(legacy);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Time every add individually and report the tail, which is where a
+// stop-the-world rehash would show up
+static void add_latencies(const workload_t *w, const char *label, unsigned capacity) {
+    double *lat = malloc(sizeof(double) * w->n);
+    gradebook_t *book = create_gradebook("bench", capacity);
+    double total_start = now_ns();
+    for (unsigned i = 0; i < w->n; i++) {
+        double start = now_ns();
+        add_score(book, w->names[i], w->scores[i]);
+        lat[i] = now_ns() - start;
+    }
+    double total = now_ns() - total_start;
+    qsort(lat, w->n, sizeof(double), compare_doubles);
+    printf("%-10s %10.1f ns/op  p50 %8.0f  p99 %8.0f  p99.9 %8.0f  max %10.0f ns\n", label,
+           total / w->n, lat[w->n / 2], lat[(unsigned) (w->n * 0.99)],
+           lat[(unsigned) (w->n * 0.999)], lat[w->n - 1]);
+    free_gradebook(book);
+    free(lat);
+}
+
+static void bench_growth(const workload_t *w) {
+    add_latencies(w, "growing", 0);
+    add_latencies(w, "presized", w->n);
+}
+
+// Allocator traffic and time to build and tear down a book, as the
+// create_large test and a following clear or exit would
+static void bench_alloc(const workload_t *w) {
+    unsigned long allocs = alloc_calls, frees = free_calls;
+    double start = now_ns();
+    gradebook_t *book = create_gradebook("bench", 0);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double built = now_ns();
+    printf("build    %10u adds  %10lu allocs  %10.3f ms\n", w->n, alloc_calls - allocs,
+           (built - start) / 1e6);
+    free_gradebook(book);
+    printf("free     %10u nodes %10lu frees   %10.3f ms\n", w->n, free_calls - frees,
+           (now_ns() - built) / 1e6);
+}
+
+// Resident set size of this process in bytes
+static long resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Bytes per entry, both as the book accounts for itself and as the
+// growth in resident memory, next to the chained layout it replaced
+static void bench_memory(const workload_t *w) {
+    long before = resident_bytes();
+    gradebook_t *book = create_gradebook("bench", 0);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    long rss = resident_bytes() - before;
+    printf("%-8s %10u entries %8.1f bytes/entry accounted %8.1f bytes/entry resident\n", "open",
+           book->size, (double) gradebook_memory_usage(book) / book->size, (double) rss / book->size);
+    unsigned size = book->size;
+    free_gradebook(book);
+
+    // Duplicate checks do not change the footprint, so chains are filled
+    // without them to keep the baseline quick
+    before = resident_bytes();
+    legacy_book_t *legacy = calloc(1, sizeof(legacy_book_t));
+    for (unsigned i = 0; i < size; i++) {
+        legacy_node_t *node = malloc(sizeof(legacy_node_t));
+        strcpy(node->name, w->names[i]);
+        node->score = w->scores[i];
+        unsigned idx = legacy_hash(node->name);
+        node->next = legacy->buckets[idx];
+        legacy->buckets[idx] = node;
+    }
+    rss = resident_bytes() - before;
+    printf("%-8s %10u entries %8.1f bytes/entry accounted %8.1f bytes/entry resident\n", "chained",
+           size, (double) (sizeof(legacy_book_t) + (size_t) size * sizeof(legacy_node_t)) / size,
+           (double) rss / size);
+    legacy_free(legacy);
+}
+
+// Time from opening a saved book to answering its first lookup, for the
+// text format and the mapped binary format
+static void bench_bin(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    write_gradebook_to_text(book);
+    printf("write_text %10.3f ms\n", (now_ns() - start) / 1e6);
+    start = now_ns();
+    write_gradebook_to_bin(book);
+    printf("write_bin  %10.3f ms\n", (now_ns() - start) / 1e6);
+    free_gradebook(book);
+
+    const char *files[] = {"bench.txt", "bench.bin"};
+    for (int f = 0; f < 2; f++) {
+        start = now_ns();
+        book = f == 0 ? read_gradebook_from_text(files[f]) : read_gradebook_from_bin(files[f]);
+        double loaded = now_ns();
+        sink = find_score(book, w->names[w->n / 2]);
+        printf("%-10s load %10.3f ms  first lookup %8.3f ms\n", files[f], (loaded - start) / 1e6,
+               (now_ns() - loaded) / 1e6);
+        free_gradebook(book);
+        remove(files[f]);
+    }
+}
+
+// Throughput of read_gradebook_from_text on a file of w->n entries
+static void bench_textload(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    unsigned size = book->size;
+    write_gradebook_to_text(book);
+    free_gradebook(book);
+
+    struct stat st;
+    stat("bench.txt", &st);
+    double start = now_ns();
+    book = read_gradebook_from_text("bench.txt");
+    double elapsed = now_ns() - start;
+    if (book == NULL || book->size != size) {
+        printf("read_text failed or lost entries\n");
+    } else {
+        printf("read_text %10u entries %8.1f MB %10.3f ms %8.1f MB/s %8.1f ns/entry\n", size,
+               st.st_size / 1e6, elapsed / 1e6, st.st_size / 1e6 / (elapsed / 1e9), elapsed / size);
+    }
+    free_gradebook(book);
+    remove("bench.txt");
+    remove("bench.txt.idx");
+}
+
+// Nanoseconds print_gradebook takes with stdout sent to /dev/null
+static double time_print(gradebook_t *book) {
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    double start = now_ns();
+    print_gradebook(book);
+    fflush(stdout);
+    double elapsed = now_ns() - start;
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+    return elapsed;
+}
+
+// Time write_text and print (to /dev/null) for a book of w->n entries
+static void bench_save(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    write_gradebook_to_text(book);
+    printf("write_text %10u entries %10.3f ms\n", book->size, (now_ns() - start) / 1e6);
+    remove("bench.txt");
+    remove("bench.txt.idx");
+
+    printf("print      %10u entries %10.3f ms\n", book->size, time_print(book) / 1e6);
+    free_gradebook(book);
+}
+
+// One call per name against the batch calls, on the same randomly ordered
+// names so every lookup is a cache miss on a large book
+static void bench_batch(const workload_t *w) {
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    const char **names = malloc(sizeof(char *) * w->n);
+    const char **probes = malloc(sizeof(char *) * lookups);
+    const char **misses = malloc(sizeof(char *) * lookups);
+    int *scores = malloc(sizeof(int) * lookups);
+    for (unsigned i = 0; i < w->n; i++) {
+        names[i] = w->names[i];
+    }
+    for (unsigned i = 0; i < lookups; i++) {
+        probes[i] = w->names[(i * 7919ULL) % w->n];
+        misses[i] = w->misses[i];
+    }
+    double start;
+    long total = 0;
+
+    gradebook_t *book = create_gradebook("bench", 0);
+    start = now_ns();
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, names[i], w->scores[i]);
+    }
+    report("single", "add", now_ns() - start, w->n);
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += find_score(book, probes[i]);
+    }
+    report("single", "find_hit", now_ns() - start, lookups);
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += find_score(book, misses[i]);
+    }
+    report("single", "find_miss", now_ns() - start, lookups);
+    free_gradebook(book);
+
+    book = create_gradebook("bench", 0);
+    start = now_ns();
+    add_scores_batch(book, names, w->scores, w->n);
+    report("batch", "add", now_ns() - start, w->n);
+    start = now_ns();
+    total += find_scores_batch(book, probes, scores, lookups);
+    report("batch", "find_hit", now_ns() - start, lookups);
+    start = now_ns();
+    total += find_scores_batch(book, misses, scores, lookups);
+    report("batch", "find_miss", now_ns() - start, lookups);
+    free_gradebook(book);
+
+    sink = total;
+    free(names);
+    free(probes);
+    free(misses);
+    free(scores);
+}
+
+#define ORDERED_ROUNDS 16
+
+typedef struct {
+    const char **names;
+    unsigned len;
+} gathered_t;
+
+static void gather_name(const char *name, int score, void *arg) {
+    gathered_t *g = arg;
+    g->names[g->len++] = name;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+// Interleave adds with sorted walks: the maintained name index against
+// gathering every name and sorting them on each walk
+static void bench_ordered(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", 0);
+    const char **names = malloc(sizeof(char *) * w->n);
+    unsigned per_round = w->n / ORDERED_ROUNDS;
+    double index_ns = 0, qsort_ns = 0;
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    for (unsigned r = 0; r < ORDERED_ROUNDS; r++) {
+        for (unsigned i = r * per_round; i < (r + 1) * per_round; i++) {
+            add_score(book, w->names[i], w->scores[i]);
+        }
+        // print_gradebook merges the pending names in before writing
+        dup2(devnull, STDOUT_FILENO);
+        double start = now_ns();
+        print_gradebook(book);
+        index_ns += now_ns() - start;
+        dup2(saved_stdout, STDOUT_FILENO);
+
+        gathered_t g = {names, 0};
+        start = now_ns();
+        for_each_score(book, gather_name, &g);
+        qsort(names, g.len, sizeof(char *), compare_names);
+        qsort_ns += now_ns() - start;
+        sink += g.len;
+    }
+    close(devnull);
+    close(saved_stdout);
+    printf("%u rounds of %u adds, %u entries at the end\n", ORDERED_ROUNDS, per_round, book->size);
+    printf("index    print        %10.3f ms (merge and write)\n", index_ns / 1e6);
+    printf("qsort    gather+sort  %10.3f ms (sort only, nothing written)\n", qsort_ns / 1e6);
+    free(names);
+    free_gradebook(book);
+}
+
+#define MT_OPS_PER_THREAD 500000
+
+// One thread's share of a mixed read/write run. Engines are the striped
+// concurrent gradebook and a plain gradebook behind one mutex.
+typedef struct {
+    const workload_t *w;
+    concurrent_gradebook_t *striped;
+    gradebook_t *locked;
+    pthread_mutex_t *lock;
+    unsigned write_pct;
+    unsigned long long seed;
+    long total;
+} mt_arg_t;
+
+static void *mt_worker(void *p) {
+    mt_arg_t *arg = p;
+    unsigned long long x = arg->seed;
+    long total = 0;
+    for (unsigned i = 0; i < MT_OPS_PER_THREAD; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        // Writes go anywhere in the workload, so half of them insert
+        const char *name = arg->w->names[(x >> 8) % arg->w->n];
+        int write = x % 100 < arg->write_pct;
+        if (arg->striped != NULL) {
+            if (write) {
+                concurrent_add_score(arg->striped, name, i);
+            } else {
+                total += concurrent_find_score(arg->striped, name);
+            }
+        } else {
+            pthread_mutex_lock(arg->lock);
+            if (write) {
+                add_score(arg->locked, name, i);
+            } else {
+                total += find_score(arg->locked, name);
+            }
+            pthread_mutex_unlock(arg->lock);
+        }
+    }
+    arg->total = total;
+    return NULL;
+}
+
+// Scale threads from 1 to every core (at least 4) for each write mix
+static void bench_concurrent(const workload_t *w) {
+    static const unsigned write_pcts[] = {1, 10, 50};
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = cores > 4 ? cores : 4;
+    pthread_t *threads = malloc(sizeof(pthread_t) * max_threads);
+    mt_arg_t *args = malloc(sizeof(mt_arg_t) * max_threads);
+    printf("%ld cores\n", cores);
+    for (unsigned m = 0; m < sizeof(write_pcts) / sizeof(write_pcts[0]); m++) {
+        for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+            for (int engine = 0; engine < 2; engine++) {
+                concurrent_gradebook_t *striped = NULL;
+                gradebook_t *locked = NULL;
+                pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+                if (engine == 0) {
+                    striped = create_concurrent_gradebook("bench");
+                } else {
+                    locked = create_gradebook("bench", 0);
+                }
+                for (unsigned i = 0; i < w->n / 2; i++) {
+                    if (striped != NULL) {
+                        concurrent_add_score(striped, w->names[i], w->scores[i]);
+                    } else {
+                        add_score(locked, w->names[i], w->scores[i]);
+                    }
+                }
+                double start = now_ns();
+                for (unsigned t = 0; t < num_threads; t++) {
+                    args[t] = (mt_arg_t) {w, striped, locked, &lock, write_pcts[m],
+                                          0x9e3779b97f4a7c15ULL * (t + 1), 0};
+                    pthread_create(&threads[t], NULL, mt_worker, &args[t]);
+                }
+                for (unsigned t = 0; t < num_threads; t++) {
+                    pthread_join(threads[t], NULL);
+                    sink += args[t].total;
+                }
+                double elapsed = now_ns() - start;
+                printf("%-8s %2u%% writes %3u threads %8.2f Mops/s\n",
+                       engine == 0 ? "striped" : "locked", write_pcts[m], num_threads,
+                       num_threads * (double) MT_OPS_PER_THREAD / elapsed * 1e3);
+                free_concurrent_gradebook(striped);
+                free_gradebook(locked);
+            }
+        }
+    }
+    free(threads);
+    free(args);
+}
+
+#define CATALOG_CLASSES 256
+#define CATALOG_ACCESSES 20000
+
+// Spread the workload over CATALOG_CLASSES classes, cap the catalog at a
+// quarter of their memory, then touch classes with an 80/20 skew
+static void bench_catalog(const workload_t *w) {
+    unsigned per_class = w->n / CATALOG_CLASSES;
+    size_t total_bytes = 0;
+    catalog_t *catalog = create_catalog((size_t) -1);
+    char class_name[MAX_NAME_LEN];
+    for (unsigned c = 0; c < CATALOG_CLASSES; c++) {
+        snprintf(class_name, sizeof(class_name), "bench_c%03u", c);
+        gradebook_t *book = create_gradebook(class_name, per_class);
+        for (unsigned i = c * per_class; i < (c + 1) * per_class; i++) {
+            add_score(book, w->names[i], w->scores[i]);
+        }
+        total_bytes += gradebook_memory_usage(book);
+        catalog_add(catalog, book);
+    }
+    catalog->memory_budget = total_bytes / 4;
+
+    unsigned long long x = 88172645463325252ULL;
+    long total = 0;
+    double start = now_ns();
+    for (unsigned a = 0; a < CATALOG_ACCESSES; a++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        unsigned hot = CATALOG_CLASSES / 5;
+        unsigned c = x % 5 != 0 ? (x >> 8) % hot : hot + (x >> 8) % (CATALOG_CLASSES - hot);
+        snprintf(class_name, sizeof(class_name), "bench_c%03u", c);
+        gradebook_t *book = catalog_get(catalog, class_name);
+        unsigned i = c * per_class + (x >> 32) % per_class;
+        total += find_score(book, w->names[i]);
+        // One access in ten also writes, so that book must be saved again
+        if (a % 10 == 0) {
+            add_score(book, w->names[i], a);
+        }
+    }
+    double elapsed = now_ns() - start;
+    sink = total;
+    printf("%u classes, %zu bytes, budget %zu bytes\n", CATALOG_CLASSES, total_bytes,
+           catalog->memory_budget);
+    report("catalog", "access", elapsed, CATALOG_ACCESSES);
+    printf("hits %lu misses %lu evictions %lu\n", catalog->hits, catalog->misses,
+           catalog->evictions);
+    // Deletes the spill files too
+    free_catalog(catalog);
+}
+
+#define JOURNAL_UPDATES 200000
+#define REWRITE_UPDATES 20
+
+static long file_bytes(const char *file_name) {
+    struct stat st;
+    return stat(file_name, &st) == 0 ? st.st_size : 0;
+}
+
+// Persist every update: through the journal under each sync policy, and
+// by rewriting the whole text file as write_text does
+static void bench_journal(const workload_t *w) {
+    static const struct {
+        const char *name;
+        journal_sync_t sync;
+    } policies[] = {{"none", JOURNAL_SYNC_NONE}, {"group", JOURNAL_SYNC_GROUP}};
+    for (unsigned p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        remove("bench.bin");
+        remove("bench.log");
+        journal_t *journal = open_journal("bench", policies[p].sync);
+        for (unsigned i = 0; i < w->n; i++) {
+            add_score(journal->book, w->names[i], w->scores[i]);
+        }
+        journal_compact(journal);
+        unsigned long compactions = journal->compactions;
+        double start = now_ns();
+        for (unsigned i = 0; i < JOURNAL_UPDATES; i++) {
+            journal_add_score(journal, w->names[(i * 7919ULL) % w->n], i);
+        }
+        journal_commit(journal);
+        double elapsed = now_ns() - start;
+        // Each record is 9 bytes plus the name, and every compaction
+        // rewrote a snapshot about the size of the last one
+        compactions = journal->compactions - compactions;
+        double written = (double) compactions * file_bytes("bench.bin");
+        for (unsigned i = 0; i < JOURNAL_UPDATES; i++) {
+            written += 9 + strlen(w->names[(i * 7919ULL) % w->n]);
+        }
+        report(policies[p].name, "update", elapsed, JOURNAL_UPDATES);
+        printf("%-8s %-12s %10.1f bytes/update, %lu compactions\n", policies[p].name, "update",
+               written / JOURNAL_UPDATES, compactions);
+        close_journal(journal);
+    }
+    remove("bench.bin");
+    remove("bench.log");
+
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    for (unsigned i = 0; i < REWRITE_UPDATES; i++) {
+        add_score(book, w->names[(i * 7919ULL) % w->n], i);
+        write_gradebook_to_text(book);
+    }
+    report("rewrite", "update", now_ns() - start, REWRITE_UPDATES);
+    printf("%-8s %-12s %10.1f bytes/update\n", "rewrite", "update", (double) file_bytes("bench.txt"));
+    remove("bench.txt");
+    remove("bench.txt.idx");
+    free_gradebook(book);
+}
+
+#define STATS_QUERIES 100000
+#define STATS_SCANS 5
+
+typedef struct {
+    int *scores;
+    unsigned len;
+} gathered_scores_t;
+
+static void gather_score(const char *name, int score, void *arg) {
+    gathered_scores_t *g = arg;
+    g->scores[g->len++] = score;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Summary, median, 90th percentile and top 10 after every update, read
+// from the running aggregates, against walking and sorting every score
+static void bench_stats(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    score_summary_t summary;
+    const char *names[10];
+    int scores[10], median, p90;
+    double start = now_ns();
+    for (unsigned i = 0; i < STATS_QUERIES; i++) {
+        add_score(book, w->names[(i * 7919ULL) % w->n], next_rand() % 2000);
+        gradebook_stats(book, &summary);
+        score_percentile(book, 50, &median);
+        score_percentile(book, 90, &p90);
+        sink += top_scores(book, 10, names, scores) + summary.sum + median + p90;
+    }
+    report("running", "update+query", now_ns() - start, STATS_QUERIES);
+
+    gathered_scores_t g = {malloc(sizeof(int) * w->n), 0};
+    start = now_ns();
+    for (unsigned i = 0; i < STATS_SCANS; i++) {
+        add_score(book, w->names[(i * 7919ULL) % w->n], next_rand() % 2000);
+        g.len = 0;
+        for_each_score(book, gather_score, &g);
+        long long sum = 0;
+        for (unsigned j = 0; j < g.len; j++) {
+            sum += g.scores[j];
+        }
+        qsort(g.scores, g.len, sizeof(int), compare_ints);
+        sink += sum + g.scores[g.len / 2] + g.scores[g.len * 9 / 10] + g.scores[g.len - 1];
+    }
+    report("scan", "update+query", now_ns() - start, STATS_SCANS);
+    free(g.scores);
+    free_gradebook(book);
+}
+
+#define RANGE_ROUNDS 20000
+#define RANGE_SCANS 5
+
+typedef struct {
+    int lo;
+    int hi;
+    long count;
+} range_scan_t;
+
+static void count_in_range(const char *name, int score, void *arg) {
+    range_scan_t *scan = arg;
+    scan->count += score >= scan->lo && score <= scan->hi;
+}
+
+static void count_visit(const char *name, int score, void *arg) {
+    (*(long *) arg)++;
+}
+
+// Rounds of one update, one count over a tenth of the scores and one
+// walk over a single score's students (about 1 in 2000) against scanning
+// every score for each query
+static void bench_range(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    count_range(book, 0, 0);
+    report("index", "build", now_ns() - start, 1);
+
+    long visited = 0;
+    start = now_ns();
+    for (unsigned i = 0; i < RANGE_ROUNDS; i++) {
+        add_score(book, w->names[(i * 7919ULL) % w->n], next_rand() % 2000);
+        int lo = next_rand() % 2000;
+        sink += count_range(book, lo, lo + 199);
+        for_each_in_range(book, lo, lo, count_visit, &visited);
+    }
+    report("index", "update+range", now_ns() - start, RANGE_ROUNDS);
+    printf("%-8s %-12s %10.1f scores visited/round\n", "index", "update+range",
+           (double) visited / RANGE_ROUNDS);
+
+    start = now_ns();
+    for (unsigned i = 0; i < RANGE_SCANS; i++) {
+        add_score(book, w->names[(i * 7919ULL) % w->n], next_rand() % 2000);
+        int lo = next_rand() % 2000;
+        range_scan_t wide = {lo, lo + 199, 0}, narrow = {lo, lo, 0};
+        for_each_score(book, count_in_range, &wide);
+        for_each_score(book, count_in_range, &narrow);
+        sink += wide.count + narrow.count;
+    }
+    report("scan", "update+range", now_ns() - start, RANGE_SCANS);
+    free_gradebook(book);
+}
+
+#define PREFIX_QUERIES 20000
+#define PREFIX_SCANS 5
+
+typedef struct {
+    const char *prefix;
+    size_t len;
+    long count;
+} prefix_scan_t;
+
+static void count_with_prefix(const char *name, int score, void *arg) {
+    prefix_scan_t *scan = arg;
+    scan->count += strncmp(name, scan->prefix, scan->len) == 0;
+}
+
+// Prefixes of 2 and 4 letters (about 3000 and 5 matches in a million
+// names) taken from added names, answered from the name index, with and
+// without an add before each query, against scanning the table
+static void bench_prefix(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    for (size_t len = 2; len <= 4; len += 2) {
+        for (int interleaved = 0; interleaved < 2; interleaved++) {
+            long visited = 0, counted = 0;
+            char prefix[BENCH_NAME_LEN];
+            double start = now_ns();
+            for (unsigned i = 0; i < PREFIX_QUERIES; i++) {
+                if (interleaved) {
+                    add_score(book, w->misses[i % w->n], i);
+                }
+                memcpy(prefix, w->names[(i * 7919ULL) % w->n], len);
+                prefix[len] = '\0';
+                visited += for_each_with_prefix(book, prefix, count_visit, &counted);
+            }
+            report("index", interleaved ? (len == 2 ? "add+prefix2" : "add+prefix4") :
+                   (len == 2 ? "prefix2" : "prefix4"), now_ns() - start, PREFIX_QUERIES);
+            printf("%-8s %-12s %10.1f matches/query\n", "index", "", (double) visited / PREFIX_QUERIES);
+            sink += counted;
+        }
+        double start = now_ns();
+        for (unsigned i = 0; i < PREFIX_SCANS; i++) {
+            prefix_scan_t scan = {w->names[(i * 7919ULL) % w->n], len, 0};
+            for_each_score(book, count_with_prefix, &scan);
+            sink += scan.count;
+        }
+        report("scan", len == 2 ? "prefix2" : "prefix4", now_ns() - start, PREFIX_SCANS);
+    }
+    free_gradebook(book);
+}
+
+#define LATENCY_ROUNDS 5
+
+static latency_histogram_t bench_timings;
+static volatile int bench_timing; // volatile, like a flag set by a command at run time
+
+// add_score and find_score on their own, then wrapped the way
+// gradebook_main times commands, with timing off and on. The best of
+// LATENCY_ROUNDS is reported for each.
+static void bench_latency(const workload_t *w) {
+    const char *modes[] = {"bare", "off", "on"};
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    for (int mode = 0; mode < 3; mode++) {
+        bench_timing = mode == 2;
+        double best_add = 1e300, best_find = 1e300;
+        for (int round = 0; round < LATENCY_ROUNDS; round++) {
+            gradebook_t *book = create_gradebook("bench", 0);
+            double start = now_ns();
+            for (unsigned i = 0; i < w->n; i++) {
+                if (mode == 0) {
+                    add_score(book, w->names[i], w->scores[i]);
+                    continue;
+                }
+                uint64_t began = bench_timing ? latency_now_ns() : 0;
+                add_score(book, w->names[i], w->scores[i]);
+                if (began != 0) {
+                    latency_record(&bench_timings, latency_now_ns() - began);
+                }
+            }
+            double elapsed = now_ns() - start;
+            best_add = elapsed < best_add ? elapsed : best_add;
+
+            long total = 0;
+            start = now_ns();
+            for (unsigned i = 0; i < lookups; i++) {
+                const char *name = w->names[(i * 7919ULL) % w->n];
+                if (mode == 0) {
+                    total += find_score(book, name);
+                    continue;
+                }
+                uint64_t began = bench_timing ? latency_now_ns() : 0;
+                total += find_score(book, name);
+                if (began != 0) {
+                    latency_record(&bench_timings, latency_now_ns() - began);
+                }
+            }
+            elapsed = now_ns() - start;
+            best_find = elapsed < best_find ? elapsed : best_find;
+            sink += total;
+            free_gradebook(book);
+        }
+        report(modes[mode], "add", best_add, w->n);
+        report(modes[mode], "find", best_find, lookups);
+    }
+}
+
+#define SNAPSHOT_UPDATES 500000
+
+static void *write_snapshot_thread(void *arg) {
+    sink += write_snapshot_to_text(arg);
+    return NULL;
+}
+
+// How long write_text holds up adds, against taking a snapshot and
+// writing it on another thread while score updates carry on
+static void bench_snapshot(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    write_gradebook_to_text(book);
+    printf("write_text blocking   %10.3f ms\n", (now_ns() - start) / 1e6);
+
+    start = now_ns();
+    for (unsigned i = 0; i < SNAPSHOT_UPDATES; i++) {
+        add_score(book, w->names[next_rand() % w->n], i % 2000);
+    }
+    report("alone", "update", now_ns() - start, SNAPSHOT_UPDATES);
+
+    start = now_ns();
+    gradebook_snapshot_t *snapshot = snapshot_gradebook(book);
+    printf("snapshot              %10.3f us\n", (now_ns() - start) / 1e3);
+    pthread_t writer;
+    pthread_create(&writer, NULL, write_snapshot_thread, snapshot);
+    start = now_ns();
+    for (unsigned i = 0; i < SNAPSHOT_UPDATES; i++) {
+        add_score(book, w->names[next_rand() % w->n], i % 2000);
+    }
+    report("writing", "update", now_ns() - start, SNAPSHOT_UPDATES);
+    pthread_join(writer, NULL);
+    printf("background write done %10.3f ms after the snapshot\n", (now_ns() - start) / 1e6);
+    release_snapshot(snapshot);
+    free_gradebook(book);
+    remove("bench.txt");
+    remove("bench.txt.idx");
+}
+
+#define ARCHIVE_COLD_LOOKUPS 200
+#define ARCHIVE_COLD_LOADS 3
+
+// Drop a file's pages from the page cache, so the next read goes to disk
+static void evict_file(const char *file_name) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Size of the archive format against text and binary files, and a
+// lookup in a cold archive against loading the whole text file
+static void bench_archive(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    double start = now_ns();
+    write_gradebook_to_archive(book);
+    printf("write_archive %10.3f ms\n", (now_ns() - start) / 1e6);
+    write_gradebook_to_text(book);
+    write_gradebook_to_bin(book);
+    long arc = file_bytes("bench.arc"), txt = file_bytes("bench.txt"), bin = file_bytes("bench.bin");
+    printf("bench.arc %10ld bytes %6.2f bytes/entry\n", arc, (double) arc / book->size);
+    printf("bench.txt %10ld bytes %6.2f bytes/entry  %5.2fx the archive\n", txt,
+           (double) txt / book->size, (double) txt / arc);
+    printf("bench.bin %10ld bytes %6.2f bytes/entry  %5.2fx the archive\n", bin,
+           (double) bin / book->size, (double) bin / arc);
+    free_gradebook(book);
+
+    // Cold: every lookup opens the archive with nothing of it cached
+    double elapsed = 0;
+    long total = 0;
+    for (unsigned i = 0; i < ARCHIVE_COLD_LOOKUPS; i++) {
+        evict_file("bench.arc");
+        start = now_ns();
+        archive_t *archive = open_archive("bench.arc");
+        total += archive_find_score(archive, w->names[next_rand() % w->n]);
+        close_archive(archive);
+        elapsed += now_ns() - start;
+    }
+    report("archive", "cold_find", elapsed, ARCHIVE_COLD_LOOKUPS);
+    elapsed = 0;
+    for (unsigned i = 0; i < ARCHIVE_COLD_LOADS; i++) {
+        evict_file("bench.txt");
+        start = now_ns();
+        book = read_gradebook_from_text("bench.txt");
+        total += find_score(book, w->names[next_rand() % w->n]);
+        elapsed += now_ns() - start;
+        free_gradebook(book);
+    }
+    report("text", "cold_find", elapsed, ARCHIVE_COLD_LOADS);
+
+    // Warm: the index is loaded once and blocks come from the page cache
+    archive_t *archive = open_archive("bench.arc");
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += archive_find_score(archive, w->names[(i * 7919ULL) % w->n]);
+    }
+    report("archive", "warm_find", now_ns() - start, lookups);
+    close_archive(archive);
+    start = now_ns();
+    book = read_gradebook_from_archive("bench.arc");
+    report("archive", "load", now_ns() - start, book->size);
+    free_gradebook(book);
+    sink += total;
+    remove("bench.arc");
+    remove("bench.txt");
+    remove("bench.txt.idx");
+    remove("bench.bin");
+}
+
+#define LAZY_COLD_OPENS 200
+#define LAZY_COLD_LOADS 3
+
+// Time to first lookup with a lazily opened text file against a full
+// load, cold and warm, and what the first add then pays to load it
+static void bench_lazy(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    write_gradebook_to_text(book);
+    free_gradebook(book);
+
+    double elapsed = 0;
+    long total = 0;
+    for (unsigned i = 0; i < LAZY_COLD_OPENS; i++) {
+        evict_file("bench.txt");
+        double start = now_ns();
+        book = read_gradebook_from_text_lazy("bench.txt");
+        total += find_score(book, w->names[next_rand() % w->n]);
+        elapsed += now_ns() - start;
+        free_gradebook(book);
+    }
+    report("lazy", "cold_first_find", elapsed, LAZY_COLD_OPENS);
+    elapsed = 0;
+    for (unsigned i = 0; i < LAZY_COLD_LOADS; i++) {
+        evict_file("bench.txt");
+        double start = now_ns();
+        book = read_gradebook_from_text("bench.txt");
+        total += find_score(book, w->names[next_rand() % w->n]);
+        elapsed += now_ns() - start;
+        free_gradebook(book);
+    }
+    report("text", "cold_first_find", elapsed, LAZY_COLD_LOADS);
+
+    double start = now_ns();
+    book = read_gradebook_from_text_lazy("bench.txt");
+    total += find_score(book, w->names[next_rand() % w->n]);
+    report("lazy", "warm_first_find", now_ns() - start, 1);
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    start = now_ns();
+    for (unsigned i = 0; i < lookups; i++) {
+        total += find_score(book, w->names[(i * 7919ULL) % w->n]);
+    }
+    report("lazy", "find", now_ns() - start, lookups);
+    start = now_ns();
+    add_score(book, "bench-lazy-add", 1);
+    report("lazy", "first_add", now_ns() - start, 1);
+    free_gradebook(book);
+    start = now_ns();
+    book = read_gradebook_from_text("bench.txt");
+    total += find_score(book, w->names[next_rand() % w->n]);
+    report("text", "warm_first_find", now_ns() - start, 1);
+    free_gradebook(book);
+    sink += total;
+    remove("bench.txt");
+    remove("bench.txt.idx");
+}
+
+// Text load time against threads, 1, 2, 4, ... up to twice the online
+// cores, next to the one-thread reader. Each count is timed a few times
+// and the fastest run kept.
+#define PARALLEL_RUNS 3
+
+static void bench_parallel(const workload_t *w) {
+    gradebook_t *book = create_gradebook("bench", w->n);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    write_gradebook_to_text(book);
+    free_gradebook(book);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%ld online cores, bench.txt %ld bytes\n", cores, file_bytes("bench.txt"));
+
+    double serial = 0;
+    for (unsigned run = 0; run < PARALLEL_RUNS; run++) {
+        double start = now_ns();
+        book = read_gradebook_from_text("bench.txt");
+        double elapsed = now_ns() - start;
+        serial = run == 0 || elapsed < serial ? elapsed : serial;
+        sink += book->size;
+        free_gradebook(book);
+    }
+    report("text", "read", serial, w->n);
+    double one_thread = 0;
+    for (unsigned threads = 1; threads <= PARALLEL_MAX_THREADS && threads <= 2 * cores;
+         threads *= 2) {
+        double best = 0;
+        for (unsigned run = 0; run < PARALLEL_RUNS; run++) {
+            double start = now_ns();
+            book = read_gradebook_from_text_parallel("bench.txt", threads);
+            double elapsed = now_ns() - start;
+            best = run == 0 || elapsed < best ? elapsed : best;
+            sink += book->size;
+            free_gradebook(book);
+        }
+        one_thread = threads == 1 ? best : one_thread;
+        char op[32];
+        snprintf(op, sizeof(op), "read_%u_threads", threads);
+        report("parallel", op, best, w->n);
+        printf("%-8s %-14s %10.2fx one thread %6.2fx read_text\n", "parallel", op,
+               one_thread / best, serial / best);
+    }
+    remove("bench.txt");
+    remove("bench.txt.idx");
+}
+
+// Merging two books that share half their students: merge_gradebooks
+// against re-adding every source score through find_score and add_score,
+// then the anti-join of the source against the merged book and against
+// the original destination.
+static gradebook_t *range_book(const workload_t *w, const char *class_name, unsigned first,
+                               unsigned end) {
+    gradebook_t *book = create_gradebook(class_name, end - first);
+    for (unsigned i = first; i < end; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    return book;
+}
+
+static void readd_max(const char *name, int score, void *arg) {
+    gradebook_t *dst = arg;
+    int old = find_score(dst, name);
+    if (score > old) {
+        add_score(dst, name, score);
+    }
+}
+
+static void count_missing(const char *name, int score, void *arg) {
+    (void) name;
+    *(long *) arg += score;
+}
+
+static void bench_merge(const workload_t *w) {
+    unsigned third = w->n / 3;
+    gradebook_t *src = range_book(w, "src", third, w->n);
+    unsigned ops = src->size;
+
+    gradebook_t *dst = range_book(w, "dst", 0, 2 * third);
+    double start = now_ns();
+    for_each_score(src, readd_max, dst);
+    report("re-add", "merge_max", now_ns() - start, ops);
+    sink += dst->size;
+    free_gradebook(dst);
+
+    dst = range_book(w, "dst", 0, 2 * third);
+    gradebook_t *original = range_book(w, "dst", 0, 2 * third);
+    start = now_ns();
+    long added = merge_gradebooks(dst, src, MERGE_MAX);
+    report("join", "merge_max", now_ns() - start, ops);
+    printf("%ld new of %u merged, %u in the result\n", added, ops, dst->size);
+
+    long total = 0;
+    start = now_ns();
+    sink += for_each_not_in(src, original, count_missing, &total);
+    report("join", "anti_join", now_ns() - start, ops);
+    start = now_ns();
+    sink += for_each_not_in(src, dst, count_missing, &total);
+    report("join", "anti_join_none", now_ns() - start, ops);
+    sink += total;
+    free_gradebook(original);
+    free_gradebook(dst);
+    free_gradebook(src);
+}
+
+// Lookups of absent and present names with no filter and with filters
+// at a few false positive rates, and what each filter costs in memory.
+// Absent names are looked up one at a time and in batches.
+static void bench_filter(const workload_t *w) {
+    static const double rates[] = {0, 0.1, 0.01, 0.001};
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    gradebook_t *book = create_gradebook("bench", 0);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    const char **misses = malloc(lookups * sizeof(char *));
+    int *scores = malloc(lookups * sizeof(int));
+    for (unsigned i = 0; i < lookups; i++) {
+        misses[i] = w->misses[(i * 7919ULL) % w->n];
+    }
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        char engine[32];
+        snprintf(engine, sizeof(engine), r == 0 ? "no_filter" : "fp_%g", rates[r]);
+        double start = now_ns();
+        set_gradebook_filter(book, rates[r]);
+        report(engine, "build", now_ns() - start, book->size);
+        long total = 0;
+        start = now_ns();
+        for (unsigned i = 0; i < lookups; i++) {
+            total += find_score(book, misses[i]);
+        }
+        report(engine, "find_miss", now_ns() - start, lookups);
+        start = now_ns();
+        total += find_scores_batch(book, misses, scores, lookups);
+        report(engine, "batch_miss", now_ns() - start, lookups);
+        start = now_ns();
+        for (unsigned i = 0; i < lookups; i++) {
+            total += find_score(book, w->names[(i * 7919ULL) % w->n]);
+        }
+        report(engine, "find_hit", now_ns() - start, lookups);
+        sink += total;
+        filter_stats_t stats;
+        gradebook_filter_stats(book, &stats);
+        printf("%-8s filter %zu bytes (%.2f bits per name, %u hashes, %.4f%% false "
+               "positives), book %zu bytes\n", engine, stats.bytes, stats.bits_per_name,
+               stats.num_hashes, stats.fp_rate * 100, gradebook_memory_usage(book));
+    }
+    free(misses);
+    free(scores);
+    free_gradebook(book);
+}
+
+// Building and searching a frozen book against the mutable table: the
+// table built by adding every name, then frozen; hits and misses looked
+// up one at a time and in batches in each; and the memory of each.
+static void bench_freeze(const workload_t *w) {
+    unsigned lookups = w->n < MAX_LOOKUPS ? w->n : MAX_LOOKUPS;
+    double start = now_ns();
+    gradebook_t *book = create_gradebook("bench", 0);
+    for (unsigned i = 0; i < w->n; i++) {
+        add_score(book, w->names[i], w->scores[i]);
+    }
+    report("table", "build", now_ns() - start, w->n);
+    start = now_ns();
+    frozen_gradebook_t *frozen = freeze_gradebook(book);
+    report("frozen", "build", now_ns() - start, w->n);
+    if (frozen == NULL) {
+        printf("freeze failed\n");
+        free_gradebook(book);
+        return;
+    }
+
+    const char **hits = malloc(lookups * sizeof(char *));
+    const char **misses = malloc(lookups * sizeof(char *));
+    int *scores = malloc(lookups * sizeof(int));
+    for (unsigned i = 0; i < lookups; i++) {
+        hits[i] = w->names[(i * 7919ULL) % w->n];
+        misses[i] = w->misses[(i * 7919ULL) % w->n];
+    }
+    const char **sets[] = {hits, misses};
+    const char *ops[][2] = {{"find_hit", "batch_hit"}, {"find_miss", "batch_miss"}};
+    long total = 0;
+    for (unsigned s = 0; s < 2; s++) {
+        start = now_ns();
+        for (unsigned i = 0; i < lookups; i++) {
+            total += find_score(book, sets[s][i]);
+        }
+        report("table", ops[s][0], now_ns() - start, lookups);
+        start = now_ns();
+        for (unsigned i = 0; i < lookups; i++) {
+            total += frozen_find_score(frozen, sets[s][i]);
+        }
+        report("frozen", ops[s][0], now_ns() - start, lookups);
+        start = now_ns();
+        total += find_scores_batch(book, sets[s], scores, lookups);
+        report("table", ops[s][1], now_ns() - start, lookups);
+        start = now_ns();
+        total += frozen_find_scores_batch(frozen, sets[s], scores, lookups);
+        report("frozen", ops[s][1], now_ns() - start, lookups);
+    }
+    sink += total;
+    printf("table %zu bytes, frozen %zu bytes (%.2f pilot bits per name)\n",
+           gradebook_memory_usage(book), frozen_memory_usage(frozen),
+           32.0 * frozen->num_buckets / w->n);
+    free(hits);
+    free(misses);
+    free(scores);
+    free_frozen_gradebook(frozen);
+    free_gradebook(book);
+}
+
+// The suite: one standard set of measurements at sizes 10^3, 10^4, ...
+// up to a maximum, written as JSON so a later run can be compared with
+// it. Run with
+//   ./gradebook_bench suite [max_names] [results.json]
+//   ./gradebook_bench compare <baseline.json> <results.json> [tolerance_pct]
+// or through "make bench-suite", "make bench-baseline" and
+// "make bench-compare". Each size runs in its own child process so its
+// peak resident set size is its own; the workload's names count towards
+// it as well.
+#define SUITE_MIN_NAMES 1000
+#define SUITE_MAX_NAMES 10000000
+#define SUITE_MIN_OPS 1000000   // Small sizes repeat each pass until this many ops; the fastest counts
+#define SUITE_TOLERANCE 10.0    // Percent slower than the baseline that counts as a regression
+#define SUITE_MAX_RESULTS 16
+#define SUITE_DEFAULT_FILE "bench_results.json"
+
+typedef enum {
+    M_ADD,
+    M_FIND_HIT,
+    M_FIND_MISS,
+    M_PRINT,
+    M_WRITE_TEXT,
+    M_READ_TEXT,
+    M_WRITE_BIN,
+    M_READ_BIN,
+    M_BYTES,
+    M_PEAK_RSS,
+    NUM_SUITE_METRICS,
+} suite_metric_t;
+
+// JSON key of each metric; every one of them is better when lower
+static const char *suite_keys[NUM_SUITE_METRICS] = {
+    [M_ADD] = "add_ns",
+    [M_FIND_HIT] = "find_hit_ns",
+    [M_FIND_MISS] = "find_miss_ns",
+    [M_PRINT] = "print_ns_per_entry",
+    [M_WRITE_TEXT] = "write_text_ns_per_entry",
+    [M_READ_TEXT] = "read_text_ns_per_entry",
+    [M_WRITE_BIN] = "write_bin_ns_per_entry",
+    [M_READ_BIN] = "read_bin_ns",
+    [M_BYTES] = "bytes_per_entry",
+    [M_PEAK_RSS] = "peak_rss_bytes",
+};
+
+typedef struct {
+    unsigned entries;
+    double values[NUM_SUITE_METRICS];
+} suite_result_t;
+
+static double min_double(double a, double b) {
+    return a < b ? a : b;
+}
+
+// Fills in everything but M_PEAK_RSS for a book of w->n entries
+static void suite_measure(const workload_t *w, suite_result_t *r) {
+    unsigned n = w->n;
+    unsigned reps = (SUITE_MIN_OPS + n - 1) / n;
+    double best[NUM_SUITE_METRICS];
+    for (int m = 0; m < NUM_SUITE_METRICS; m++) {
+        best[m] = 1e300;
+    }
+
+    gradebook_t *book = NULL;
+    for (unsigned rep = 0; rep < reps; rep++) {
+        if (book != NULL) {
+            free_gradebook(book);
+        }
+        book = create_gradebook("bench", 0);
+        double start = now_ns();
+        for (unsigned i = 0; i < n; i++) {
+            add_score(book, w->names[i], w->scores[i]);
+        }
+        best[M_ADD] = min_double(best[M_ADD], now_ns() - start);
+    }
+    r->entries = book->size;
+
+    for (unsigned rep = 0; rep < reps; rep++) {
+        long total = 0;
+        double start = now_ns();
+        for (unsigned i = 0; i < n; i++) {
+            total += find_score(book, w->names[(i * 7919ULL) % n]);
+        }
+        best[M_FIND_HIT] = min_double(best[M_FIND_HIT], now_ns() - start);
+        start = now_ns();
+        for (unsigned i = 0; i < n; i++) {
+            total += find_score(book, w->misses[i]);
+        }
+        best[M_FIND_MISS] = min_double(best[M_FIND_MISS], now_ns() - start);
+        sink += total;
+    }
+
+    for (unsigned rep = 0; rep < reps; rep++) {
+        best[M_PRINT] = min_double(best[M_PRINT], time_print(book));
+
+        double start = now_ns();
+        write_gradebook_to_text(book);
+        best[M_WRITE_TEXT] = min_double(best[M_WRITE_TEXT], now_ns() - start);
+        start = now_ns();
+        write_gradebook_to_bin(book);
+        best[M_WRITE_BIN] = min_double(best[M_WRITE_BIN], now_ns() - start);
+
+        start = now_ns();
+        gradebook_t *loaded = read_gradebook_from_text("bench.txt");
+        best[M_READ_TEXT] = min_double(best[M_READ_TEXT], now_ns() - start);
+        free_gradebook(loaded);
+        // A binary load may defer work to the first lookup, so that is timed too
+        start = now_ns();
+        loaded = read_gradebook_from_bin("bench.bin");
+        sink += find_score(loaded, w->names[n / 2]);
+        best[M_READ_BIN] = min_double(best[M_READ_BIN], now_ns() - start);
+        free_gradebook(loaded);
+    }
+    remove("bench.txt");
+    remove("bench.txt.idx");
+    remove("bench.bin");
+
+    r->values[M_ADD] = best[M_ADD] / n;
+    r->values[M_FIND_HIT] = best[M_FIND_HIT] / n;
+    r->values[M_FIND_MISS] = best[M_FIND_MISS] / n;
+    r->values[M_PRINT] = best[M_PRINT] / r->entries;
+    r->values[M_WRITE_TEXT] = best[M_WRITE_TEXT] / r->entries;
+    r->values[M_READ_TEXT] = best[M_READ_TEXT] / r->entries;
+    r->values[M_WRITE_BIN] = best[M_WRITE_BIN] / r->entries;
+    r->values[M_READ_BIN] = best[M_READ_BIN];
+    r->values[M_BYTES] = (double) gradebook_memory_usage(book) / r->entries;
+    free_gradebook(book);
+}
+
+// Runs one size in a child process, which hands its results back through
+// shared memory. Returns: 0 on success or -1 if the child failed
+static int suite_run_size(unsigned n, suite_result_t *r) {
+    suite_result_t *shared = mmap(NULL, sizeof(suite_result_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        workload_t w;
+        if (make_workload(&w, n) != 0) {
+            _exit(1);
+        }
+        suite_measure(&w, shared);
+        free_workload(&w);
+        _exit(0);
+    }
+    int status = 0;
+    struct rusage usage;
+    int ok = pid > 0 && wait4(pid, &status, 0, &usage) == pid && WIFEXITED(status) &&
+             WEXITSTATUS(status) == 0;
+    if (ok) {
+        *r = *shared;
+        r->values[M_PEAK_RSS] = usage.ru_maxrss * 1024.0; // ru_maxrss is in kilobytes
+    }
+    munmap(shared, sizeof(suite_result_t));
+    return ok ? 0 : -1;
+}
+
+static int write_suite_json(const char *file_name, const suite_result_t *results,
+                            unsigned num_results) {
+    FILE *f = fopen(file_name, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "{\n  \"benchmark\": \"gradebook_suite\",\n  \"results\": [\n");
+    for (unsigned i = 0; i < num_results; i++) {
+        fprintf(f, "    {\"entries\": %u", results[i].entries);
+        for (int m = 0; m < NUM_SUITE_METRICS; m++) {
+            fprintf(f, ", \"%s\": %.1f", suite_keys[m], results[i].values[m]);
+        }
+        fprintf(f, "}%s\n", i + 1 < num_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int run_suite(unsigned max_names, const char *file_name) {
+    suite_result_t results[SUITE_MAX_RESULTS];
+    unsigned num_results = 0;
+    printf("%10s %8s %8s %8s %8s %8s %8s %8s %10s %8s %8s\n", "entries", "add", "hit", "miss",
+           "print", "w_text", "r_text", "w_bin", "r_bin(us)", "B/entry", "RSS(MB)");
+    for (unsigned long n = SUITE_MIN_NAMES; n <= max_names && num_results < SUITE_MAX_RESULTS;
+         n *= 10) {
+        suite_result_t *r = &results[num_results];
+        if (suite_run_size(n, r) != 0) {
+            printf("Could not run the suite with %lu names\n", n);
+            return 1;
+        }
+        num_results++;
+        const double *v = r->values;
+        printf("%10u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %10.1f %8.1f %8.1f\n", r->entries,
+               v[M_ADD], v[M_FIND_HIT], v[M_FIND_MISS], v[M_PRINT], v[M_WRITE_TEXT],
+               v[M_READ_TEXT], v[M_WRITE_BIN], v[M_READ_BIN] / 1e3, v[M_BYTES],
+               v[M_PEAK_RSS] / (1 << 20));
+    }
+    if (write_suite_json(file_name, results, num_results) != 0) {
+        printf("Could not write %s\n", file_name);
+        return 1;
+    }
+    printf("Results written to %s\n", file_name);
+    return 0;
+}
+
+// Reads back a file write_suite_json wrote: every object inside the
+// results array is one size, and unknown keys are skipped so files from
+// older or newer suites still compare on the metrics they share.
+// Returns: The number of results read or -1 if the file cannot be read
+static int read_suite_json(const char *file_name, suite_result_t *results) {
+    FILE *f = fopen(file_name, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int num_results = 0, depth = 0, c;
+    suite_result_t *curr = NULL;
+    char key[64];
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '{' && ++depth == 2) {
+            if (num_results == SUITE_MAX_RESULTS) {
+                break;
+            }
+            curr = &results[num_results++];
+            memset(curr, 0, sizeof(suite_result_t));
+            for (int m = 0; m < NUM_SUITE_METRICS; m++) {
+                curr->values[m] = -1; // Missing from this file
+            }
+        } else if (c == '}') {
+            depth--;
+            curr = NULL;
+        } else if (c == '"' && curr != NULL) {
+            double value;
+            if (fscanf(f, "%63[^\"]\" : %lf", key, &value) != 2) {
+                continue;
+            }
+            if (strcmp(key, "entries") == 0) {
+                curr->entries = value;
+            }
+            for (int m = 0; m < NUM_SUITE_METRICS; m++) {
+                if (strcmp(key, suite_keys[m]) == 0) {
+                    curr->values[m] = value;
+                }
+            }
+        }
+    }
+    fclose(f);
+    return num_results;
+}
+
+// Returns: 0 if no metric is more than tolerance percent worse than the
+//          baseline, 1 otherwise
+static int run_compare(const char *baseline_file, const char *results_file, double tolerance) {
+    suite_result_t baseline[SUITE_MAX_RESULTS], results[SUITE_MAX_RESULTS];
+    int num_baseline = read_suite_json(baseline_file, baseline);
+    int num_results = read_suite_json(results_file, results);
+    if (num_baseline < 0 || num_results < 0) {
+        printf("Could not read %s\n", num_baseline < 0 ? baseline_file : results_file);
+        return 1;
+    }
+    int regressions = 0;
+    for (int i = 0; i < num_results; i++) {
+        const suite_result_t *base = NULL;
+        for (int j = 0; j < num_baseline; j++) {
+            if (baseline[j].entries == results[i].entries) {
+                base = &baseline[j];
+            }
+        }
+        if (base == NULL) {
+            printf("%10u entries: not in %s\n", results[i].entries, baseline_file);
+            continue;
+        }
+        for (int m = 0; m < NUM_SUITE_METRICS; m++) {
+            double old = base->values[m], new = results[i].values[m];
+            if (old <= 0 || new < 0) {
+                continue;
+            }
+            double change = (new - old) / old * 100;
+            const char *verdict = "";
+            if (change > tolerance) {
+                verdict = "  REGRESSION";
+                regressions++;
+            } else if (change < -tolerance) {
+                verdict = "  improved";
+            }
+            printf("%10u %-24s %14.1f -> %14.1f %+7.1f%%%s\n", results[i].entries, suite_keys[m],
+                   old, new, change, verdict);
+        }
+    }
+    printf("%d regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s",
+           tolerance);
+    return regressions > 0;
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(const workload_t *w);
+} benchmark_t;
+
+static const benchmark_t benchmarks[] = {
+    {"table", bench_table},
+    {"growth", bench_growth},
+    {"alloc", bench_alloc},
+    {"memory", bench_memory},
+    {"bin", bench_bin},
+    {"textload", bench_textload},
+    {"save", bench_save},
+    {"ordered", bench_ordered},
+    {"batch", bench_batch},
+    {"concurrent", bench_concurrent},
+    {"catalog", bench_catalog},
+    {"journal", bench_journal},
+    {"stats", bench_stats},
+    {"range", bench_range},
+    {"prefix", bench_prefix},
+    {"latency", bench_latency},
+    {"snapshot", bench_snapshot},
+    {"archive", bench_archive},
+    {"lazy", bench_lazy},
+    {"parallel", bench_parallel},
+    {"merge", bench_merge},
+    {"filter", bench_filter},
+    {"freeze", bench_freeze},
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void usage(const char *prog) {
+    printf("Usage: %s <benchmark> [num_names]\n", prog);
+    printf("Benchmarks:");
+    for (unsigned i = 0; i < NUM_BENCHMARKS; i++) {
+        printf(" %s", benchmarks[i].name);
+    }
+    printf("\n");
+    printf("       %s suite [max_names] [results.json]\n", prog);
+    printf("       %s compare <baseline.json> <results.json> [tolerance_pct]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "suite") == 0) {
+        unsigned max_names = argc > 2 ? strtoul(argv[2], NULL, 10) : SUITE_MAX_NAMES;
+        return run_suite(max_names, argc > 3 ? argv[3] : SUITE_DEFAULT_FILE);
+    }
+    if (strcmp(argv[1], "compare") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_compare(argv[2], argv[3], argc > 4 ? strtod(argv[4], NULL) : SUITE_TOLERANCE);
+    }
+    unsigned n = DEFAULT_NUM_NAMES;
+    if (argc > 2) {
+        n = strtoul(argv[2], NULL, 10);
+    }
+    if (n == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (unsigned i = 0; i < NUM_BENCHMARKS; i++) {
+        if (strcmp(argv[1], benchmarks[i].name) == 0) {
+            workload_t w;
+            if (make_workload(&w, n) != 0) {
+                printf("Could not allocate workload of %u names\n", n);
+                return 1;
+            }
+            benchmarks[i].run(&w);
+            free_workload(&w);
+            return 0;
+        }
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gradebook.h"
+
+// Compares the hash functions on a real name distribution. Build with
+// "make diag" and run
+//   ./gradebook_diag <class>.txt
+// on any file write_text produced. Every name is re-added to a book using
+// each hash in turn, and the table's probe lengths and the number of full
+// 32-bit hash collisions are reported.
+
+static const char *hash_names[HASH_KINDS] = {
+    [HASH_WY] = "wyhash",
+    [HASH_DJB2] = "djb2",
+};
+
+typedef struct {
+    const char **names;
+    int *scores;
+    unsigned len;
+} entries_t;
+
+static void collect(const char *name, int score, void *arg) {
+    entries_t *entries = arg;
+    entries->names[entries->len] = name;
+    entries->scores[entries->len] = score;
+    entries->len++;
+}
+
+static int compare_unsigned(const void *a, const void *b) {
+    unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void diagnose(const entries_t *entries, hash_kind_t kind) {
+    unsigned *hashes = malloc(sizeof(unsigned) * (entries->len + 1));
+    double start = now_ns();
+    for (unsigned i = 0; i < entries->len; i++) {
+        hashes[i] = hash_functions[kind](entries->names[i], strlen(entries->names[i]));
+    }
+    double hash_ns = entries->len == 0 ? 0 : (now_ns() - start) / entries->len;
+    qsort(hashes, entries->len, sizeof(unsigned), compare_unsigned);
+    unsigned collisions = 0;
+    for (unsigned i = 1; i < entries->len; i++) {
+        collisions += hashes[i] == hashes[i - 1];
+    }
+    free(hashes);
+
+    gradebook_t *book = create_gradebook("diag", 0);
+    set_gradebook_hash(book, kind);
+    for (unsigned i = 0; i < entries->len; i++) {
+        add_score(book, entries->names[i], entries->scores[i]);
+    }
+    probe_stats_t stats;
+    gradebook_probe_stats(book, &stats);
+    printf("%s: %.1f ns/hash, %u full-hash collisions\n", hash_names[kind], hash_ns, collisions);
+    printf("  %u slots, %u of %u groups full, mean probe %.3f groups, max %u\n",
+           book->table.capacity, stats.full_groups, stats.num_groups, stats.mean_probe,
+           stats.max_probe);
+    for (int i = 0; i < PROBE_HISTOGRAM_SIZE; i++) {
+        if (stats.histogram[i] != 0) {
+            printf("  probe %2d%s %10u\n", i + 1, i == PROBE_HISTOGRAM_SIZE - 1 ? "+" : " ",
+                   stats.histogram[i]);
+        }
+    }
+    free_gradebook(book);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s <class>.txt\n", argv[0]);
+        return 1;
+    }
+    gradebook_t *source = read_gradebook_from_text(argv[1]);
+    if (source == NULL) {
+        printf("Failed to read gradebook from text file\n");
+        return 1;
+    }
+    entries_t entries;
+    entries.names = malloc(sizeof(char *) * (source->size + 1));
+    entries.scores = malloc(sizeof(int) * (source->size + 1));
+    entries.len = 0;
+    for_each_score(source, collect, &entries);
+    printf("%u names from %s\n", entries.len, argv[1]);
+    for (int kind = 0; kind < HASH_KINDS; kind++) {
+        diagnose(&entries, kind);
+    }
+    free(entries.names);
+    free(entries.scores);
+    free_gradebook(source);
+    return 0;
+}
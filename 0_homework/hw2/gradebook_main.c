@@ -1,10 +1,144 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "archive.h"
+#include "frozen.h"
 #include "gradebook.h"
+#include "latency.h"
 
 #define MAX_CMD_LEN 128
 
+// Commands whose latency 'perf show' reports
+typedef enum {
+    TIMED_ADD,
+    TIMED_LOOKUP,
+    TIMED_MISS,
+    TIMED_PRINT,
+    TIMED_WRITE_TEXT,
+    TIMED_READ_TEXT,
+    NUM_TIMED,
+} timed_command_t;
+
+static const char *timed_names[NUM_TIMED] = {
+    [TIMED_ADD] = "add",
+    [TIMED_LOOKUP] = "lookup",
+    [TIMED_MISS] = "miss",
+    [TIMED_PRINT] = "print",
+    [TIMED_WRITE_TEXT] = "write_text",
+    [TIMED_READ_TEXT] = "read_text",
+};
+
+static latency_histogram_t timings[NUM_TIMED];
+static int timing_enabled;
+
+// False positive rate of the filter every book gets, or 0 for none
+static double filter_rate;
+
+// Give a book just created or loaded the filter set by 'filter'
+static void use_filter(gradebook_t *book) {
+    if (book != NULL && filter_rate != 0 && set_gradebook_filter(book, filter_rate) != 0) {
+        printf("Error: Could not build filter\n");
+    }
+}
+
+// Returns: The time a command started, or 0 while timing is off
+static uint64_t timer_start(void) {
+    return timing_enabled ? latency_now_ns() : 0;
+}
+
+static void timer_stop(timed_command_t command, uint64_t start) {
+    if (start != 0) {
+        latency_record(&timings[command], latency_now_ns() - start);
+    }
+}
+
+// A write_text_bg in progress: a snapshot being written out on its own
+// thread while commands carry on
+typedef struct {
+    gradebook_snapshot_t *snapshot; // NULL when no write is in progress
+    pthread_t thread;
+    int result;                     // write_snapshot_to_text's result, once joined
+} background_write_t;
+
+static void *write_in_background(void *arg) {
+    background_write_t *write = arg;
+    write->result = write_snapshot_to_text(write->snapshot);
+    return NULL;
+}
+
+// Wait for a background write, if one is in progress, and report it
+static void finish_background_write(background_write_t *write) {
+    if (write->snapshot == NULL) {
+        return;
+    }
+    pthread_join(write->thread, NULL);
+    if (write->result != 0) {
+        printf("Failed to write gradebook to text file\n");
+    } else {
+        printf("Gradebook successfully written to %s.txt\n",
+               get_gradebook_name(&write->snapshot->view));
+    }
+    release_snapshot(write->snapshot);
+    write->snapshot = NULL;
+}
+
+static void print_score(const char *name, int score, void *arg) {
+    printf("%s: %d\n", name, score);
+}
+
+// Load a second gradebook for merge and anti_join, from a binary,
+// archive or text file by its extension
+static gradebook_t *read_other_gradebook(const char *file_name) {
+    size_t len = strlen(file_name);
+    if (len > 4 && strcmp(file_name + len - 4, ".bin") == 0) {
+        return read_gradebook_from_bin(file_name);
+    } else if (len > 4 && strcmp(file_name + len - 4, ".arc") == 0) {
+        return read_gradebook_from_archive(file_name);
+    }
+    return read_gradebook_from_text(file_name);
+}
+
+// Command latencies, then the health of the current book's table
+static void print_perf(const gradebook_t *book) {
+    printf("Timing is %s\n", timing_enabled ? "on" : "off");
+    printf("%-10s %8s %10s %10s %10s %10s %10s\n", "command", "count", "mean ns", "p50 ns",
+           "p90 ns", "p99 ns", "max ns");
+    for (int i = 0; i < NUM_TIMED; i++) {
+        const latency_histogram_t *hist = &timings[i];
+        printf("%-10s %8llu %10llu %10llu %10llu %10llu %10llu\n", timed_names[i],
+               (unsigned long long) hist->count,
+               (unsigned long long) (hist->count == 0 ? 0 : hist->total_ns / hist->count),
+               (unsigned long long) latency_percentile(hist, 50),
+               (unsigned long long) latency_percentile(hist, 90),
+               (unsigned long long) latency_percentile(hist, 99),
+               (unsigned long long) hist->max_ns);
+    }
+    if (book == NULL) {
+        return;
+    }
+    if (book->lazy.data != NULL) {
+        // A lazy book has no table until something loads it, and perf
+        // show is not going to
+        printf("Table: not loaded yet, lookups read the file\n");
+    } else {
+        probe_stats_t probes;
+        gradebook_probe_stats(book, &probes);
+        unsigned capacity = book->table.capacity;
+        printf("Table: %u entries in %u slots, load factor %.3f\n", book->size, capacity,
+               capacity == 0 ? 0 : (double) book->size / capacity);
+        printf("Probes: mean %.3f groups, longest %u, %u of %u groups full\n", probes.mean_probe,
+               probes.max_probe, probes.full_groups, probes.num_groups);
+    }
+    printf("Memory: %zu bytes\n", gradebook_memory_usage(book));
+    filter_stats_t filter;
+    gradebook_filter_stats(book, &filter);
+    if (filter.bytes != 0) {
+        printf("Filter: %zu bytes, %u hashes, %.2f bits per name, %.4f%% false positives\n",
+               filter.bytes, filter.num_hashes, filter.bits_per_name, filter.fp_rate * 100);
+    }
+}
+
 /*
  * Pay attention to the notion of switching between gradebooks in one
  * run of the program.
@@ -13,9 +147,22 @@
  * The code below has to check if gradebook is NULL before the operations
  * occur. Also, the user has to explicitly clear the current gradebook before
  * they can create or load in a new one.
+ *
+ * Running with --perf turns command timing on from the start, and the
+ * 'perf show' report is printed again on exit.
+ *
+ * write_text_bg writes a snapshot of the gradebook on another thread, so
+ * adds and lookups carry on meanwhile. Its result is reported once it is
+ * waited for: by the next write_text, write_text_bg or clear, or on exit.
+ *
+ * freeze keeps a frozen copy of the gradebook that answers lookups from
+ * then on; adds and merges are refused until the gradebook is cleared.
  */
 int main(int argc, char **argv) {
     gradebook_t *book = NULL;
+    frozen_gradebook_t *frozen = NULL;
+    background_write_t background = {NULL};
+    timing_enabled = argc > 1 && strcmp(argv[1], "--perf") == 0;
 
     printf("Gradebook System\n");
     printf("Commands:\n");
@@ -27,6 +174,24 @@ int main(int argc, char **argv) {
     printf("  print:                  shows all scores, sorted by student name\n");
     printf("  write_text:             saves all scores to text file\n");
     printf("  read_text <file_name>:  loads scores from text file\n");
+    printf("  write_bin:              saves all scores to binary file\n");
+    printf("  read_bin <file_name>:   loads scores from binary file\n");
+    printf("  stats:                  shows count, mean, min, median, 90th percentile and max\n");
+    printf("  top <count>:            shows the highest scores, best first\n");
+    printf("  range <lo> <hi>:        shows scores from lo to hi\n");
+    printf("  count_range <lo> <hi>:  counts scores from lo to hi\n");
+    printf("  prefix <prefix>:        shows scores of names starting with prefix\n");
+    printf("  perf <on|off|reset|show>:  times commands and shows the report\n");
+    printf("  write_text_bg:          saves all scores to text file in the background\n");
+    printf("  write_archive:          saves all scores to compact archive file\n");
+    printf("  read_archive <file_name>:  loads scores from archive file\n");
+    printf("  lookup_archive <file_name> <name>:  looks up one score in an archive file without loading it\n");
+    printf("  read_text_lazy <file_name>:  opens text file, loading scores when first needed\n");
+    printf("  read_text_parallel <file_name> <threads>:  loads scores from text file on several threads\n");
+    printf("  merge <file_name> <max|latest|sum>:  adds scores from another file, resolving repeats\n");
+    printf("  anti_join <file_name>:  shows students not in another file\n");
+    printf("  filter <rate|off>:      sets the false positive rate of a filter for absent names\n");
+    printf("  freeze:                 makes a read-only copy for lookups until clear\n");
     printf("  exit:                   exits the program\n");
 
     char cmd[MAX_CMD_LEN];
@@ -50,7 +215,8 @@ int main(int argc, char **argv) {
                 printf("Error: You already have a gradebook.\n");
                 printf("You can remove it with the \'clear\' command\n");
             } else {
-                book = create_gradebook(cmd);
+                book = create_gradebook(cmd, 0);
+                use_filter(book);
                 if (book == NULL) {
                     printf("Gradebook creation failed\n");
                 }
@@ -69,10 +235,17 @@ int main(int argc, char **argv) {
             scanf("%s %d", name, &score);
             if (book == NULL) {
                 printf("Error: You must create or load a gradebook first\n");
+            } else if (frozen != NULL) {
+                printf("Error: The gradebook is frozen\n");
             } else if (score < 0) {
                 printf("Error: You must enter a score in the valid range (0 <= score)\n");
-            } else if (add_score(book, name, score) != 0) {
-                printf("Error: Could not add score\n");
+            } else {
+                uint64_t start = timer_start();
+                int result = add_score(book, name, score);
+                timer_stop(TIMED_ADD, start);
+                if (result != 0) {
+                    printf("Error: Could not add score\n");
+                }
             }
         }
 
@@ -81,8 +254,12 @@ int main(int argc, char **argv) {
             if (book == NULL) {
                 printf("Error: You must create or load a gradebook first\n");
             } else {
-                int found = find_score(book, name);
+                uint64_t start = timer_start();
+                int found = frozen != NULL ? frozen_find_score(frozen, name) :
+                                             find_score(book, name);
+                timer_stop(TIMED_LOOKUP, start);
                 if (found == -1) {
+                    timer_stop(TIMED_MISS, start);
                     printf("No score for '%s' found\n", name);
                 } else {
                     printf("%s: %d\n", name, found);
@@ -90,31 +267,306 @@ int main(int argc, char **argv) {
             }
         }
 
+        else if (strcmp("stats", cmd) == 0) {
+            score_summary_t summary;
+            int median, p90;
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (gradebook_stats(book, &summary) != 0) {
+                printf("Error: Could not compute statistics\n");
+            } else if (summary.count == 0) {
+                printf("No scores in %s\n", get_gradebook_name(book));
+            } else if (score_percentile(book, 50, &median) != 0 ||
+                       score_percentile(book, 90, &p90) != 0) {
+                printf("Error: Could not compute statistics\n");
+            } else {
+                printf("Students: %u\n", summary.count);
+                printf("Mean: %.2f\n", summary.mean);
+                printf("Min: %d\n", summary.min);
+                printf("Median: %d\n", median);
+                printf("90th percentile: %d\n", p90);
+                printf("Max: %d\n", summary.max);
+            }
+        }
+
+        else if (strcmp("top", cmd) == 0) {
+            scanf("%d", &score); // Read in how many scores to show
+            const char *top_names[STATS_TOP_K];
+            int top_values[STATS_TOP_K];
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (score < 1 || score > STATS_TOP_K) {
+                printf("Error: You must enter a count in the valid range (1 <= count <= %d)\n",
+                       STATS_TOP_K);
+            } else {
+                unsigned n = top_scores(book, score, top_names, top_values);
+                printf("Top scores in %s:\n", get_gradebook_name(book));
+                for (unsigned i = 0; i < n; i++) {
+                    printf("%s: %d\n", top_names[i], top_values[i]);
+                }
+            }
+        }
+
+        else if (strcmp("prefix", cmd) == 0) {
+            scanf("%s", name);
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else {
+                printf("Students starting with '%s' in %s:\n", name, get_gradebook_name(book));
+                for_each_with_prefix(book, name, print_score, NULL);
+            }
+        }
+
+        else if (strcmp("range", cmd) == 0 || strcmp("count_range", cmd) == 0) {
+            int lo, hi;
+            scanf("%d %d", &lo, &hi);
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (lo > hi) {
+                printf("Error: You must enter a range with its lowest score first\n");
+            } else if (strcmp("range", cmd) == 0) {
+                printf("Scores from %d to %d in %s:\n", lo, hi, get_gradebook_name(book));
+                if (for_each_in_range(book, lo, hi, print_score, NULL) < 0) {
+                    printf("Error: Could not search scores\n");
+                }
+            } else {
+                long count = count_range(book, lo, hi);
+                if (count < 0) {
+                    printf("Error: Could not search scores\n");
+                } else {
+                    printf("%ld scores from %d to %d\n", count, lo, hi);
+                }
+            }
+        }
+
+        else if (strcmp("merge", cmd) == 0) {
+            char file_name[MAX_NAME_LEN];
+            scanf("%s %s", file_name, cmd); // Read in the file and the policy
+            merge_policy_t policy = strcmp("max", cmd) == 0 ? MERGE_MAX :
+                                    strcmp("latest", cmd) == 0 ? MERGE_LATEST :
+                                    strcmp("sum", cmd) == 0 ? MERGE_SUM : MERGE_POLICIES;
+            gradebook_t *other = NULL;
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (frozen != NULL) {
+                printf("Error: The gradebook is frozen\n");
+            } else if (policy == MERGE_POLICIES) {
+                printf("Error: You must enter one of max, latest or sum\n");
+            } else if ((other = read_other_gradebook(file_name)) == NULL) {
+                printf("Failed to read gradebook to merge\n");
+            } else {
+                long added = merge_gradebooks(book, other, policy);
+                if (added < 0) {
+                    printf("Error: Could not merge gradebooks\n");
+                } else {
+                    printf("Merged %ld new and %ld existing students from %s into %s\n", added,
+                           (long) other->size - added, get_gradebook_name(other),
+                           get_gradebook_name(book));
+                }
+            }
+            free_gradebook(other);
+        }
+
+        else if (strcmp("anti_join", cmd) == 0) {
+            char file_name[MAX_NAME_LEN];
+            scanf("%s", file_name);
+            gradebook_t *other = NULL;
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if ((other = read_other_gradebook(file_name)) == NULL) {
+                printf("Failed to read gradebook to compare\n");
+            } else {
+                printf("Students in %s but not in %s:\n", get_gradebook_name(book),
+                       get_gradebook_name(other));
+                for_each_not_in(book, other, print_score, NULL);
+            }
+            free_gradebook(other);
+        }
+
+        else if (strcmp("filter", cmd) == 0) {
+            // Applies to the current book and every book after it
+            double rate;
+            scanf("%s", cmd); // Read in the rate, or off
+            if (strcmp("off", cmd) == 0) {
+                rate = 0;
+            } else if (sscanf(cmd, "%lf", &rate) != 1 || !(rate > 0 && rate < 1)) {
+                rate = -1;
+            }
+            if (rate < 0) {
+                printf("Error: You must enter off or a false positive rate between 0 and 1\n");
+            } else if (book != NULL && set_gradebook_filter(book, rate) != 0) {
+                printf("Error: Could not build filter\n");
+            } else {
+                filter_rate = rate;
+                if (rate == 0) {
+                    printf("Filter off\n");
+                } else {
+                    printf("Filter on, %g false positives\n", rate);
+                }
+            }
+        }
+
+        else if (strcmp("perf", cmd) == 0) {
+            scanf("%s", cmd); // Read in what to do
+            if (strcmp("on", cmd) == 0) {
+                timing_enabled = 1;
+            } else if (strcmp("off", cmd) == 0) {
+                timing_enabled = 0;
+            } else if (strcmp("reset", cmd) == 0) {
+                for (int i = 0; i < NUM_TIMED; i++) {
+                    latency_reset(&timings[i]);
+                }
+            } else if (strcmp("show", cmd) == 0) {
+                print_perf(book);
+            } else {
+                printf("Error: You must enter one of on, off, reset or show\n");
+            }
+        }
+
         else if (strcmp("clear", cmd) == 0) {
             if (book == NULL) {
                 printf("Error: No gradebook to clear\n");
             } else {
+                finish_background_write(&background);
+                free_frozen_gradebook(frozen);
+                frozen = NULL;
                 free_gradebook(book);
                 book = NULL;
             }
         }
 
+        else if (strcmp("freeze", cmd) == 0) {
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (frozen != NULL) {
+                printf("Error: The gradebook is already frozen\n");
+            } else if ((frozen = freeze_gradebook(book)) == NULL) {
+                printf("Failed to freeze gradebook\n");
+            } else {
+                printf("Froze %u students of %s into %zu bytes\n", frozen->size,
+                       get_gradebook_name(book), frozen_memory_usage(frozen));
+            }
+        }
+
         else if (strcmp("print", cmd) == 0) {
             if (book == NULL) {
                 printf("Error: You must create or load a gradebook first\n");
             } else {
                 printf("Scores for all students in %s:\n", get_gradebook_name(book));
+                uint64_t start = timer_start();
                 print_gradebook(book);
+                timer_stop(TIMED_PRINT, start);
             }
         }
 
         else if (strcmp("write_text", cmd) == 0) {
             if (book == NULL) {
                 printf("Error: You must create or load a gradebook first\n");
-            } else if (write_gradebook_to_text(book) != 0) {
-                printf("Failed to write gradebook to text file\n");
             } else {
-                printf("Gradebook successfully written to %s.txt\n", get_gradebook_name(book));
+                finish_background_write(&background);
+                uint64_t start = timer_start();
+                int result = write_gradebook_to_text(book);
+                timer_stop(TIMED_WRITE_TEXT, start);
+                if (result != 0) {
+                    printf("Failed to write gradebook to text file\n");
+                } else {
+                    printf("Gradebook successfully written to %s.txt\n", get_gradebook_name(book));
+                }
+            }
+        }
+
+        else if (strcmp("write_text_bg", cmd) == 0) {
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else {
+                finish_background_write(&background);
+                background.snapshot = snapshot_gradebook(book);
+                if (background.snapshot == NULL) {
+                    printf("Failed to write gradebook to text file\n");
+                } else if (pthread_create(&background.thread, NULL, write_in_background,
+                                          &background) != 0) {
+                    // No thread to spare: write it out here instead
+                    background.result = write_snapshot_to_text(background.snapshot);
+                    release_snapshot(background.snapshot);
+                    background.snapshot = NULL;
+                    if (background.result != 0) {
+                        printf("Failed to write gradebook to text file\n");
+                    } else {
+                        printf("Gradebook successfully written to %s.txt\n",
+                               get_gradebook_name(book));
+                    }
+                } else {
+                    printf("Writing gradebook to %s.txt in the background\n",
+                           get_gradebook_name(book));
+                }
+            }
+        }
+
+        else if (strcmp("write_bin", cmd) == 0) {
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (write_gradebook_to_bin(book) != 0) {
+                printf("Failed to write gradebook to binary file\n");
+            } else {
+                printf("Gradebook successfully written to %s.bin\n", get_gradebook_name(book));
+            }
+        }
+
+        else if (strcmp("read_bin", cmd) == 0) {
+            scanf("%s", name);
+            if (book != NULL) {
+                printf("Error: You must clear current gradebook first\n");
+            } else {
+                book = read_gradebook_from_bin(name);
+                use_filter(book);
+                if (book == NULL) {
+                    printf("Failed to read gradebook from binary file\n");
+                } else {
+                    printf("Gradebook loaded from binary file\n");
+                }
+            }
+        }
+
+        else if (strcmp("write_archive", cmd) == 0) {
+            if (book == NULL) {
+                printf("Error: You must create or load a gradebook first\n");
+            } else if (write_gradebook_to_archive(book) != 0) {
+                printf("Failed to write gradebook to archive file\n");
+            } else {
+                printf("Gradebook successfully written to %s.arc\n", get_gradebook_name(book));
+            }
+        }
+
+        else if (strcmp("read_archive", cmd) == 0) {
+            scanf("%s", name);
+            if (book != NULL) {
+                printf("Error: You must clear current gradebook first\n");
+            } else {
+                book = read_gradebook_from_archive(name);
+                use_filter(book);
+                if (book == NULL) {
+                    printf("Failed to read gradebook from archive file\n");
+                } else {
+                    printf("Gradebook loaded from archive file\n");
+                }
+            }
+        }
+
+        else if (strcmp("lookup_archive", cmd) == 0) {
+            // Searches a file without loading it, so no gradebook is needed
+            char file_name[MAX_NAME_LEN];
+            scanf("%s %s", file_name, name);
+            archive_t *archive = open_archive(file_name);
+            if (archive == NULL) {
+                printf("Failed to open archive file\n");
+            } else {
+                int found = archive_find_score(archive, name);
+                if (found == -1) {
+                    printf("No score for '%s' found\n", name);
+                } else {
+                    printf("%s: %d\n", name, found);
+                }
+                close_archive(archive);
             }
         }
 
@@ -123,7 +575,10 @@ int main(int argc, char **argv) {
             if (book != NULL) {
                 printf("Error: You must clear current gradebook first\n");
             } else {
+                uint64_t start = timer_start();
                 book = read_gradebook_from_text(name);
+                use_filter(book);
+                timer_stop(TIMED_READ_TEXT, start);
                 if (book == NULL) {
                     printf("Failed to read gradebook from text file\n");
                 } else {
@@ -132,11 +587,51 @@ int main(int argc, char **argv) {
             }
         }
 
+        else if (strcmp("read_text_parallel", cmd) == 0) {
+            unsigned threads;
+            scanf("%s %u", name, &threads);
+            if (book != NULL) {
+                printf("Error: You must clear current gradebook first\n");
+            } else {
+                uint64_t start = timer_start();
+                book = read_gradebook_from_text_parallel(name, threads);
+                use_filter(book);
+                timer_stop(TIMED_READ_TEXT, start);
+                if (book == NULL) {
+                    printf("Failed to read gradebook from text file\n");
+                } else {
+                    printf("Gradebook loaded from text file\n");
+                }
+            }
+        }
+
+        else if (strcmp("read_text_lazy", cmd) == 0) {
+            scanf("%s", name);
+            if (book != NULL) {
+                printf("Error: You must clear current gradebook first\n");
+            } else {
+                uint64_t start = timer_start();
+                book = read_gradebook_from_text_lazy(name);
+                use_filter(book);
+                timer_stop(TIMED_READ_TEXT, start);
+                if (book == NULL) {
+                    printf("Failed to read gradebook from text file\n");
+                } else {
+                    printf("Gradebook opened from text file\n");
+                }
+            }
+        }
+
         else {
             printf("Unknown command %s\n", cmd);
         }
     }
 
+    finish_background_write(&background);
+    if (timing_enabled) {
+        print_perf(book);
+    }
+    free_frozen_gradebook(frozen);
     if (book != NULL) {
         free_gradebook(book);
     }
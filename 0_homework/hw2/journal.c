@@ -0,0 +1,234 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define RECORD_HEADER 5 // name_len and score
+#define RECORD_CHECK 4
+
+static uint32_t fnv1a(const unsigned char *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void put_le32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t get_le32(const unsigned char *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t) in[3] << 24;
+}
+
+// <class><ext> into out, which has room for MAX_NAME_LEN + 8 bytes
+static void journal_file_name(const char *class_name, const char *ext, char *out) {
+    strcpy(out, class_name);
+    strcat(out, ext);
+}
+
+// Apply every intact record in the log to book. Returns the length of
+// the intact prefix, or -1 if the log cannot be read or applied.
+static long replay_log(gradebook_t *book, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    unsigned char *log = malloc(st.st_size + 1);
+    if (log == NULL) {
+        return -1;
+    }
+    size_t len = 0;
+    while (len < (size_t) st.st_size) {
+        ssize_t n = read(fd, log + len, st.st_size - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    size_t pos = 0;
+    while (pos + RECORD_HEADER <= len) {
+        size_t name_len = log[pos];
+        size_t record_len = RECORD_HEADER + name_len + RECORD_CHECK;
+        if (name_len == 0 || name_len >= MAX_NAME_LEN || pos + record_len > len ||
+            fnv1a(log + pos, record_len - RECORD_CHECK) !=
+            get_le32(log + pos + record_len - RECORD_CHECK)) {
+            break;
+        }
+        char name[MAX_NAME_LEN];
+        memcpy(name, log + pos + RECORD_HEADER, name_len);
+        name[name_len] = '\0';
+        if (add_score(book, name, (int) get_le32(log + pos + 1)) != 0) {
+            free(log);
+            return -1;
+        }
+        pos += record_len;
+    }
+    free(log);
+    return pos;
+}
+
+journal_t *open_journal(const char *class_name, journal_sync_t sync) {
+    if (class_name == NULL || strlen(class_name) >= MAX_NAME_LEN) {
+        return NULL;
+    }
+    char file_name[MAX_NAME_LEN + 8];
+    journal_t *journal = calloc(1, sizeof(journal_t));
+    if (journal == NULL) {
+        return NULL;
+    }
+    journal->sync = sync;
+    journal->fd = -1;
+
+    struct stat st;
+    journal_file_name(class_name, ".bin", file_name);
+    if (stat(file_name, &st) == 0) {
+        journal->book = read_gradebook_from_bin(file_name);
+        journal->snapshot_bytes = st.st_size;
+    } else if (errno == ENOENT) {
+        journal->book = create_gradebook(class_name, 0);
+    }
+    if (journal->book == NULL) {
+        free(journal);
+        return NULL;
+    }
+
+    journal_file_name(class_name, ".log", file_name);
+    journal->fd = open(file_name, O_RDWR | O_CREAT | O_APPEND, 0666);
+    long intact = journal->fd < 0 ? -1 : replay_log(journal->book, journal->fd);
+    // A torn final record is dropped so new records follow intact ones
+    if (intact < 0 || ftruncate(journal->fd, intact) != 0) {
+        if (journal->fd >= 0) {
+            close(journal->fd);
+        }
+        free_gradebook(journal->book);
+        free(journal);
+        return NULL;
+    }
+    journal->log_bytes = intact;
+    return journal;
+}
+
+int journal_commit(journal_t *journal) {
+    if (journal->buf_len == 0) {
+        return 0;
+    }
+    size_t done = 0;
+    int err = 0;
+    while (!err && done < journal->buf_len) {
+        ssize_t n = write(journal->fd, journal->buf + done, journal->buf_len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        err = n < 0;
+        done += err ? 0 : n;
+    }
+    err = err || (journal->sync != JOURNAL_SYNC_NONE && fdatasync(journal->fd) != 0);
+    if (err) {
+        // Drop whatever part of the group reached the log, so the records
+        // stay buffered and no torn record is left ahead of a retry
+        int ignored = ftruncate(journal->fd, journal->log_bytes - journal->buf_len);
+        (void) ignored;
+        return -1;
+    }
+    journal->buf_len = 0;
+    journal->buf_records = 0;
+    journal->commits++;
+    return 0;
+}
+
+int journal_compact(journal_t *journal) {
+    if (journal_commit(journal) != 0 || write_gradebook_to_bin(journal->book) != 0) {
+        return -1;
+    }
+    // The snapshot is synced and in place, so the log can go
+    if (ftruncate(journal->fd, 0) != 0 || fsync(journal->fd) != 0) {
+        return -1;
+    }
+    char file_name[MAX_NAME_LEN + 8];
+    struct stat st;
+    journal_file_name(journal->book->class_name, ".bin", file_name);
+    journal->snapshot_bytes = stat(file_name, &st) == 0 ? st.st_size : 0;
+    journal->log_bytes = 0;
+    journal->compactions++;
+    return 0;
+}
+
+// Drop the last buffered record, record_len bytes long
+static void unbuffer_record(journal_t *journal, size_t record_len) {
+    journal->buf_len -= record_len;
+    journal->buf_records--;
+    journal->log_bytes -= record_len;
+}
+
+int journal_add_score(journal_t *journal, const char *name, int score) {
+    if (journal == NULL || name == NULL) {
+        return -1;
+    }
+    size_t name_len = strnlen(name, MAX_NAME_LEN - 1);
+    size_t record_len = RECORD_HEADER + name_len + RECORD_CHECK;
+    if (name_len == 0) {
+        return -1;
+    }
+    if (journal->buf_len + record_len > JOURNAL_BUFFER_SIZE && journal_commit(journal) != 0) {
+        return -1;
+    }
+    // The record is buffered, and committed if this add calls for it,
+    // before the book changes, so the book is never ahead of the log
+    unsigned char *record = (unsigned char *) journal->buf + journal->buf_len;
+    record[0] = name_len;
+    put_le32(record + 1, score);
+    memcpy(record + RECORD_HEADER, name, name_len);
+    put_le32(record + RECORD_HEADER + name_len, fnv1a(record, RECORD_HEADER + name_len));
+    journal->buf_len += record_len;
+    journal->buf_records++;
+    journal->log_bytes += record_len;
+
+    int committed = 0;
+    if (journal->sync == JOURNAL_SYNC_ALWAYS || journal->buf_records >= JOURNAL_GROUP_RECORDS) {
+        if (journal_commit(journal) != 0) {
+            // The records before this one stay buffered for the next commit
+            unbuffer_record(journal, record_len);
+            return -1;
+        }
+        committed = 1;
+    }
+    if (add_score(journal->book, name, score) != 0) {
+        // Only running out of memory gets here. A committed record cannot
+        // be taken back, and is applied again when the log is replayed.
+        if (!committed) {
+            unbuffer_record(journal, record_len);
+        }
+        return -1;
+    }
+    // Compacting once the log outgrows the snapshot spreads the cost of
+    // each snapshot over at least as many log bytes as it writes. The add
+    // is logged either way, so a failed compaction is only retried once
+    // the log has doubled.
+    if (journal->log_bytes >= JOURNAL_MIN_COMPACT && journal->log_bytes >= journal->snapshot_bytes &&
+        journal_compact(journal) != 0) {
+        journal->snapshot_bytes = journal->log_bytes * 2;
+    }
+    return 0;
+}
+
+int close_journal(journal_t *journal) {
+    if (journal == NULL) {
+        return -1;
+    }
+    int err = journal_commit(journal);
+    err = close(journal->fd) != 0 || err;
+    free_gradebook(journal->book);
+    free(journal);
+    return err ? -1 : 0;
+}
@@ -0,0 +1,80 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gradebook.h"
+
+#define JOURNAL_GROUP_RECORDS 64      // Records buffered per group commit
+#define JOURNAL_BUFFER_SIZE 8192      // Bytes of records buffered per group commit
+#define JOURNAL_MIN_COMPACT (1 << 20) // Log bytes before compaction is considered
+
+// When a group commit reaches the disk
+typedef enum {
+    JOURNAL_SYNC_ALWAYS, // Every add is written and fdatasync'd before returning
+    JOURNAL_SYNC_GROUP,  // Adds are written and fdatasync'd JOURNAL_GROUP_RECORDS at a time
+    JOURNAL_SYNC_NONE,   // Adds are written a group at a time; the kernel flushes them
+} journal_sync_t;
+
+// A gradebook persisted as a snapshot, <class>.bin, plus an append-only
+// log of the adds since, <class>.log. Each add appends one small record,
+// so persisting it costs O(1) I/O. Once the log outgrows the snapshot
+// (and JOURNAL_MIN_COMPACT) the book is written out as a fresh snapshot
+// and the log emptied, which keeps the bytes written per add constant.
+//
+// Log records are
+//   name_len (1 byte) | score (4 bytes, little-endian) | name | check (4 bytes)
+// where check is an FNV-1a hash of everything before it. Replay stops at
+// the first record that is cut short or fails its check, and the log is
+// truncated there.
+typedef struct {
+    gradebook_t *book;          // The current state; read it freely
+    int fd;                     // Log, opened for appending
+    journal_sync_t sync;        // When commits reach the disk
+    char buf[JOURNAL_BUFFER_SIZE]; // Records not yet written
+    size_t buf_len;             // Bytes in buf
+    unsigned buf_records;       // Records in buf
+    uint64_t log_bytes;         // Bytes in the log, including buf
+    uint64_t snapshot_bytes;    // Size of the snapshot when last written or loaded
+    unsigned long commits;      // Group commits so far
+    unsigned long compactions;  // Snapshots written so far
+} journal_t;
+
+// Open a class's journal, loading the snapshot (if any) and replaying the
+// log on top of it, or starting an empty book if neither exists
+// class_name: The name of the class for grades
+// sync: When commits reach the disk
+// Returns: A pointer to the journal or NULL if an error occurs
+journal_t *open_journal(const char *class_name, journal_sync_t sync);
+
+// Log a score and then add or update it. With JOURNAL_SYNC_ALWAYS the
+// record is on disk before the book changes; otherwise it is buffered
+// first and on disk after the next commit. If the record cannot be
+// buffered or committed, the book is left as it was.
+// journal: A pointer to the journal of the book to add the score to
+// name: Student's name
+// score: Student's score
+// Returns: 0 if the score was successfully added/updated and logged
+//          or -1 if the score could not be added/updated or logged
+int journal_add_score(journal_t *journal, const char *name, int score);
+
+// Write out buffered records, syncing them unless the policy is
+// JOURNAL_SYNC_NONE. If that fails, the log is cut back to its last
+// commit and the records stay buffered.
+// journal: A pointer to the journal to commit
+// Returns: 0 on success or -1 if the records could not be written
+int journal_commit(journal_t *journal);
+
+// Commit, write the whole book as a new snapshot and empty the log. A
+// crash in between only replays records the snapshot already holds.
+// journal: A pointer to the journal to compact
+// Returns: 0 on success or -1 if an error occurs
+int journal_compact(journal_t *journal);
+
+// Commit and close the journal, freeing its book
+// journal: A pointer to the journal to close
+// Returns: 0 if the final commit succeeded, otherwise -1
+int close_journal(journal_t *journal);
+
+#endif
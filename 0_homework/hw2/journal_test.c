@@ -0,0 +1,128 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+#define COMPACT_ADDS 100000
+
+static long file_size(const char *file_name) {
+    struct stat st;
+    return stat(file_name, &st) == 0 ? st.st_size : -1;
+}
+
+// Records survive a close and reopen, and a record cut short by a crash
+// is dropped along with nothing before it
+static void test_replay_truncated(void) {
+    journal_t *journal = open_journal("journal_a", JOURNAL_SYNC_ALWAYS);
+    CHECK(journal != NULL && journal->book->size == 0);
+    CHECK(journal_add_score(journal, "Ada", 91) == 0);
+    CHECK(journal_add_score(journal, "Ken", 74) == 0);
+    CHECK(journal_add_score(journal, "Ada", 93) == 0);
+    long intact = file_size("journal_a.log");
+    CHECK(journal_add_score(journal, "Barbara", 95) == 0);
+    CHECK(close_journal(journal) == 0);
+
+    journal = open_journal("journal_a", JOURNAL_SYNC_ALWAYS);
+    CHECK(journal != NULL && journal->book->size == 3);
+    CHECK(find_score(journal->book, "Ada") == 93);
+    CHECK(find_score(journal->book, "Barbara") == 95);
+    CHECK(close_journal(journal) == 0);
+
+    // Cut the last record off partway through its name
+    long full = file_size("journal_a.log");
+    CHECK(truncate("journal_a.log", full - 6) == 0);
+    journal = open_journal("journal_a", JOURNAL_SYNC_ALWAYS);
+    CHECK(journal != NULL && journal->book->size == 2);
+    CHECK(find_score(journal->book, "Ada") == 93);
+    CHECK(find_score(journal->book, "Ken") == 74);
+    CHECK(find_score(journal->book, "Barbara") == -1);
+    CHECK(file_size("journal_a.log") == intact);
+    // New records follow the intact ones
+    CHECK(journal_add_score(journal, "Linus", 67) == 0);
+    CHECK(close_journal(journal) == 0);
+
+    journal = open_journal("journal_a", JOURNAL_SYNC_GROUP);
+    CHECK(journal != NULL && journal->book->size == 3);
+    CHECK(find_score(journal->book, "Linus") == 67);
+    CHECK(find_score(journal->book, "Barbara") == -1);
+    CHECK(close_journal(journal) == 0);
+    unlink("journal_a.log");
+}
+
+// A record that cannot be committed is not applied to the book
+static void test_failed_commit(void) {
+    journal_t *journal = open_journal("journal_b", JOURNAL_SYNC_ALWAYS);
+    CHECK(journal != NULL);
+    CHECK(journal_add_score(journal, "Ada", 91) == 0);
+    int log_fd = journal->fd;
+    journal->fd = open("/dev/null", O_RDONLY);
+    CHECK(journal_add_score(journal, "Ada", 10) == -1);
+    CHECK(journal_add_score(journal, "Ken", 74) == -1);
+    CHECK(find_score(journal->book, "Ada") == 91);
+    CHECK(find_score(journal->book, "Ken") == -1);
+    CHECK(journal->buf_len == 0);
+    close(journal->fd);
+    journal->fd = log_fd;
+    CHECK(close_journal(journal) == 0);
+
+    journal = open_journal("journal_b", JOURNAL_SYNC_ALWAYS);
+    CHECK(journal != NULL && journal->book->size == 1);
+    CHECK(find_score(journal->book, "Ada") == 91);
+    CHECK(close_journal(journal) == 0);
+    unlink("journal_b.log");
+}
+
+// Compaction writes a snapshot and empties the log, and the snapshot plus
+// the records after it reopen to the same book
+static void test_compaction(void) {
+    journal_t *journal = open_journal("journal_c", JOURNAL_SYNC_NONE);
+    CHECK(journal != NULL);
+    char name[MAX_NAME_LEN];
+    for (unsigned i = 0; i < COMPACT_ADDS; i++) {
+        snprintf(name, sizeof(name), "s%06u", i % (COMPACT_ADDS / 2));
+        CHECK(journal_add_score(journal, name, i) == 0);
+    }
+    CHECK(journal->compactions >= 1);
+    CHECK(journal_compact(journal) == 0);
+    CHECK(file_size("journal_c.log") == 0);
+    CHECK(journal_add_score(journal, "after", 5) == 0);
+    unsigned long compactions = journal->compactions;
+    CHECK(close_journal(journal) == 0);
+
+    journal = open_journal("journal_c", JOURNAL_SYNC_NONE);
+    CHECK(journal != NULL && journal->book->size == COMPACT_ADDS / 2 + 1);
+    CHECK(compactions >= 2);
+    for (unsigned i = 0; i < COMPACT_ADDS / 2; i++) {
+        snprintf(name, sizeof(name), "s%06u", i);
+        if (find_score(journal->book, name) != (int) (i + COMPACT_ADDS / 2)) {
+            CHECK(find_score(journal->book, name) == (int) (i + COMPACT_ADDS / 2));
+            break;
+        }
+    }
+    CHECK(find_score(journal->book, "after") == 5);
+    CHECK(close_journal(journal) == 0);
+    unlink("journal_c.bin");
+    unlink("journal_c.log");
+}
+
+int main(void) {
+    test_replay_truncated();
+    test_failed_commit();
+    test_compaction();
+    if (failures == 0) {
+        printf("journal_test: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
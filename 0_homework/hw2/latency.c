@@ -0,0 +1,69 @@
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+uint64_t latency_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void latency_reset(latency_histogram_t *hist) {
+    memset(hist, 0, sizeof(latency_histogram_t));
+}
+
+static unsigned latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB) {
+        return ns;
+    }
+    if (ns >> LATENCY_MAX_BITS != 0) {
+        return LATENCY_BUCKETS - 1;
+    }
+    unsigned shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    // ns >> shift is in [LATENCY_SUB, 2 * LATENCY_SUB)
+    return (shift + 1) * LATENCY_SUB + (ns >> shift) - LATENCY_SUB;
+}
+
+// Largest value that lands in bucket
+static uint64_t bucket_high(unsigned bucket) {
+    if (bucket < LATENCY_SUB) {
+        return bucket;
+    }
+    if (bucket == LATENCY_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    unsigned shift = bucket / LATENCY_SUB - 1;
+    uint64_t low = (uint64_t) (LATENCY_SUB + bucket % LATENCY_SUB) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void latency_record(latency_histogram_t *hist, uint64_t ns) {
+    if (hist->count == 0 || ns < hist->min_ns) {
+        hist->min_ns = ns;
+    }
+    if (ns > hist->max_ns) {
+        hist->max_ns = ns;
+    }
+    hist->count++;
+    hist->total_ns += ns;
+    hist->buckets[latency_bucket(ns)]++;
+}
+
+uint64_t latency_percentile(const latency_histogram_t *hist, double percent) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    // Nearest rank: the smallest value at least percent% of values are <=
+    uint64_t rank = (uint64_t) (percent / 100 * hist->count);
+    rank += rank < percent / 100 * hist->count || rank == 0;
+    uint64_t seen = 0;
+    for (unsigned bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t high = bucket_high(bucket);
+            return high < hist->max_ns ? high : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// HDR-style latency histogram. Values below LATENCY_SUB are counted
+// exactly; above that, every power of two is split into LATENCY_SUB
+// equal buckets, so a bucket is never wider than 1/LATENCY_SUB of the
+// values it holds (about 6%). Recording is a few shifts and an
+// increment, cheap enough to leave on around every command.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 40 // Longer latencies (about 18 minutes) go in the last bucket
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+typedef struct {
+    uint64_t count;                     // Values recorded
+    uint64_t total_ns;                  // Sum of the values
+    uint64_t min_ns;                    // Smallest value, or 0 if there are none
+    uint64_t max_ns;                    // Largest value, or 0 if there are none
+    uint64_t buckets[LATENCY_BUCKETS];  // Values by bucket
+} latency_histogram_t;
+
+// Current time of the monotonic clock in nanoseconds
+uint64_t latency_now_ns(void);
+
+// Empty a histogram
+// hist: The histogram to reset
+void latency_reset(latency_histogram_t *hist);
+
+// Count one value
+// hist: The histogram to record in
+// ns: The latency in nanoseconds
+void latency_record(latency_histogram_t *hist, uint64_t ns);
+
+// Estimate a percentile from the buckets
+// hist: The histogram to read
+// percent: Between 0 and 100
+// Returns: The upper bound of the bucket holding the value at that rank,
+//          clamped to the largest value seen, or 0 if the histogram is empty
+uint64_t latency_percentile(const latency_histogram_t *hist, double percent);
+
+#endif